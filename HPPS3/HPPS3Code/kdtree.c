@@ -1,6 +1,7 @@
 #include "kdtree.h"
 #include "sort.h"
 #include "util.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
@@ -82,6 +83,7 @@ struct node* kdtree_create_node(int d, const double *points, int depth, int n, i
 // Create a k-d tree
 //d:dimensions, n:datapoints, points: pointer to points array
 struct kdtree *kdtree_create(int d, int n, const double *points) {
+    TRACE_BEGIN("kdtree_create"); // compiles to nothing unless CFLAGS has -DTRACE (see trace.h)
     struct kdtree *tree = malloc(sizeof(struct kdtree));// allocate memory for the tree structure
     tree->d = d; // access d in the tree structure
     tree->points = points; // access points in the tree structue
@@ -95,6 +97,7 @@ struct kdtree *kdtree_create(int d, int n, const double *points) {
     tree->root = kdtree_create_node(d, points, 0, n, indexes);
     free(indexes); // free memory after creating the tree.
 
+    TRACE_END();
     return tree; //return the finished tree structure
 }
 
@@ -147,6 +150,7 @@ void kdtree_knn_node(const struct kdtree *tree, int k, const double* query,
 // Find k nearest neighbors in the k-d tree
 //tree: the kdtree, k: the amount of neighbours we are searching for, q: the point for which we are looking for neighbours.
 int* kdtree_knn(const struct kdtree *tree, int k, const double* query) {
+    TRACE_BEGIN("kdtree_knn");
     int *closest = malloc(k * sizeof(int));// an array that will store the k nearest neighbours
     double radius = INFINITY;// the distance to the furthest point in the closest array, initialize to infinity because no points have been found yet
 
@@ -155,6 +159,7 @@ int* kdtree_knn(const struct kdtree *tree, int k, const double* query) {
     }
     // the function that performs the actual search through the kdtree to find the nearest neighbours
     kdtree_knn_node(tree, k, query, closest, &radius, tree->root);
+    TRACE_END();
 
     //returns an array of the closest points(their indices)
     return closest;
@@ -5,6 +5,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#include "perf_counters.h"
 
 int main(int argc, char** argv) {
   if (argc != 4 && argc != 5) {
@@ -12,6 +13,10 @@ int main(int argc, char** argv) {
     exit(1);
   }
 
+  struct perf_counters *counters = perf_counters_open();
+  struct perf_sample before, after, counts;
+  perf_counters_read(counters, &before);
+
   FILE * points_f = fopen(argv[1], "r");
   assert(points_f != NULL);
   FILE * queries_f = fopen(argv[2], "r");
@@ -47,11 +52,26 @@ int main(int argc, char** argv) {
   printf("Queries: %d\n", n_queries);
   printf("Finding indexes of %d nearest neighbours\n", k);
 
+  perf_counters_read(counters, &after);
+  memset(&counts, 0, sizeof(counts));
+  perf_sample_accumulate(&counts, &before, &after);
+  perf_counters_print(counters, stdout, "load", &counts, 1);
+
+  perf_counters_read(counters, &before);
   struct kdtree *kdtree = kdtree_create(d, n_points, points);
+  perf_counters_read(counters, &after);
+  memset(&counts, 0, sizeof(counts));
+  perf_sample_accumulate(&counts, &before, &after);
+  perf_counters_print(counters, stdout, "build", &counts, 1);
+
   int* indexes = malloc(n_queries*k*sizeof(int));
 
+  memset(&counts, 0, sizeof(counts));
   for (int q = 0; q < n_queries; q++) {
+    perf_counters_read(counters, &before);
     int *closest = kdtree_knn(kdtree, k, &queries[q*d]);
+    perf_counters_read(counters, &after);
+    perf_sample_accumulate(&counts, &before, &after);
 
     printf("Query %d: ", q);
     for (int i = 0; i < k; i++) {
@@ -63,6 +83,9 @@ int main(int argc, char** argv) {
     free(closest);
   }
 
+  perf_counters_print(counters, stdout, "query", &counts, 1);
+  perf_counters_print(counters, stdout, "per query", &counts, n_queries);
+
   if (argc == 5) {
     FILE *output_f = fopen(argv[4], "w");
     assert(output_f != NULL);
@@ -75,6 +98,7 @@ int main(int argc, char** argv) {
 
   kdtree_free(kdtree);
 
+  perf_counters_close(counters);
   free(indexes);
   free(points);
   free(queries);
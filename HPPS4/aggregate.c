@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "record.h"
+#include "secondary_index.h"
+#include "bigmem.h"
+#include "timing.h"
+
+// Group-by aggregation over the records, for reports such as
+//
+//   ./aggregate planet-latest_geonames.tsv country_code class
+//
+// which prints, for every combination of country_code and class, the
+// number of places and their mean and largest importance and mean
+// place_rank, as tab-separated values.  Timings go to stderr.
+//
+// The group columns are dictionary-encoded with a secondary index, so
+// every record gets a small integer code per column, and the codes
+// are combined into one 64-bit key that is mapped to a dense group
+// number.  The numeric columns are copied into plain arrays, and the
+// records are then aggregated by several threads, each over its own
+// chunk and into its own partial aggregates, which are finally added
+// together.
+
+// Below this many records per thread, starting threads costs more
+// than it saves.
+#define RECORDS_PER_THREAD (1 << 16)
+
+#define MAX_THREADS 64
+
+// Aggregates of one group.
+struct aggregate {
+  int64_t count;
+  double importance_sum;
+  double importance_max;
+  int64_t place_rank_sum;
+};
+
+// Work item for one aggregating thread.
+struct task {
+  const uint32_t *groups;     // Group number of each record
+  const double *importance;   // Importance of each record
+  const int *place_rank;      // Place rank of each record
+  int from, to;               // Range of records to aggregate
+  int ngroups;
+  struct aggregate *partial;  // Aggregates of this thread, one per group
+};
+
+static void* aggregate_thread(void *arg) {
+  struct task *t = arg;
+  struct aggregate *a = t->partial;
+
+  for (int g = 0; g < t->ngroups; g++) {
+    a[g].count = 0;
+    a[g].importance_sum = 0;
+    a[g].importance_max = -1;
+    a[g].place_rank_sum = 0;
+  }
+
+  for (int i = t->from; i < t->to; i++) {
+    struct aggregate *ag = &a[t->groups[i]];
+    double importance = t->importance[i];
+    ag->count++;
+    ag->importance_sum += importance;
+    ag->importance_max = importance > ag->importance_max ? importance : ag->importance_max;
+    ag->place_rank_sum += t->place_rank[i];
+  }
+
+  return NULL;
+}
+
+// Map from combined keys to dense group numbers (open addressing).
+struct group_table {
+  uint64_t *keys;
+  int *groups;       // -1 for empty slots
+  size_t capacity;   // A power of two
+};
+
+static int group_of(struct group_table *t, uint64_t key, int *ngroups) {
+  size_t mask = t->capacity-1;
+  size_t i = (key * 0x9E3779B97F4A7C15ULL) >> 20 & mask;
+  while (t->groups[i] >= 0 && t->keys[i] != key) {
+    i = (i+1) & mask;
+  }
+  if (t->groups[i] < 0) {
+    t->keys[i] = key;
+    t->groups[i] = (*ngroups)++;
+  }
+  return t->groups[i];
+}
+
+// Used for sorting the output.
+static const struct record *sort_rs;
+static const enum record_column *sort_columns;
+static int sort_ncolumns;
+
+// Order groups (represented by one of their records) by their values
+// of the group columns.
+static int compare_groups(const void *a, const void *b) {
+  const struct record *x = &sort_rs[*(const int*)a];
+  const struct record *y = &sort_rs[*(const int*)b];
+  for (int c = 0; c < sort_ncolumns; c++) {
+    int d = strcmp(record_string(x, sort_columns[c]), record_string(y, sort_columns[c]));
+    if (d != 0) {
+      return d;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s FILE COLUMN...\n", argv[0]);
+    exit(1);
+  }
+
+  int ncolumns = argc-2;
+  enum record_column *columns = malloc(ncolumns * sizeof(enum record_column));
+  if (!columns) {
+    fprintf(stderr, "Failed to allocate columns\n");
+    exit(1);
+  }
+  for (int c = 0; c < ncolumns; c++) {
+    int column = record_column_by_name(argv[c+2]);
+    if (column < 0) {
+      fprintf(stderr, "Unknown string column: %s\n", argv[c+2]);
+      exit(1);
+    }
+    columns[c] = column;
+  }
+
+  uint64_t start, runtime;
+  int n;
+
+  start = microseconds();
+  struct record *rs = read_records(argv[1], &n);
+  runtime = microseconds()-start;
+
+  if (!rs) {
+    fprintf(stderr, "Failed to read input from %s (errno: %s)\n",
+            argv[1], strerror(errno));
+    return 1;
+  }
+
+  fprintf(stderr, "Reading records: %dms\n", (int)runtime/1000);
+
+  start = microseconds();
+
+  // Combine the dictionary codes of the group columns into one key
+  // per record, in mixed radix.  An empty value gets the code after
+  // the last distinct value.
+  uint64_t *keys = bigmem_alloc((n > 0 ? n : 1) * sizeof(uint64_t));
+  int *codes = bigmem_alloc((n > 0 ? n : 1) * sizeof(int));
+  if (!keys || !codes) {
+    fprintf(stderr, "Failed to allocate group keys\n");
+    exit(1);
+  }
+  memset(keys, 0, (n > 0 ? n : 1) * sizeof(uint64_t));
+
+  uint64_t radix = 1;
+  for (int c = 0; c < ncolumns; c++) {
+    struct secondary_index *index = secondary_index_create(rs, n, columns[c]);
+    if (!index) {
+      fprintf(stderr, "Failed to build dictionary for %s\n", argv[c+2]);
+      exit(1);
+    }
+    uint64_t distinct = secondary_index_encode(index, codes, NULL) + 1;
+    secondary_index_free(index);
+
+    if (radix > UINT64_MAX / distinct) {
+      fprintf(stderr, "Too many combinations of group values\n");
+      exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+      keys[i] += radix * (uint64_t)(codes[i] < 0 ? distinct-1 : (uint64_t)codes[i]);
+    }
+    radix *= distinct;
+  }
+  bigmem_free(codes);
+
+  // Number the distinct keys densely, remembering a record of each.
+  struct group_table table;
+  table.capacity = 16;
+  while (table.capacity < 2*(size_t)n) {
+    table.capacity *= 2;
+  }
+  table.keys = bigmem_alloc(table.capacity * sizeof(uint64_t));
+  table.groups = bigmem_alloc(table.capacity * sizeof(int));
+  uint32_t *groups = bigmem_alloc((n > 0 ? n : 1) * sizeof(uint32_t));
+  int *examples = bigmem_alloc((n > 0 ? n : 1) * sizeof(int));
+  double *importance = bigmem_alloc((n > 0 ? n : 1) * sizeof(double));
+  int *place_rank = bigmem_alloc((n > 0 ? n : 1) * sizeof(int));
+  if (!table.keys || !table.groups || !groups || !examples || !importance || !place_rank) {
+    fprintf(stderr, "Failed to allocate group table\n");
+    exit(1);
+  }
+  for (size_t i = 0; i < table.capacity; i++) {
+    table.groups[i] = -1;
+  }
+
+  int ngroups = 0;
+  for (int i = 0; i < n; i++) {
+    int before = ngroups;
+    groups[i] = group_of(&table, keys[i], &ngroups);
+    if (ngroups != before) {
+      examples[groups[i]] = i;
+    }
+    importance[i] = rs[i].importance;
+    place_rank[i] = rs[i].place_rank;
+  }
+  bigmem_free(keys);
+  bigmem_free(table.keys);
+  bigmem_free(table.groups);
+
+  runtime = microseconds()-start;
+  fprintf(stderr, "Building dictionaries: %dms (%d groups)\n", (int)runtime/1000, ngroups);
+
+  start = microseconds();
+
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int nthreads = n / RECORDS_PER_THREAD;
+  if (nthreads > ncpus) nthreads = ncpus;
+  if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+  if (nthreads < 1) nthreads = 1;
+
+  struct task tasks[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  int chunk = (n + nthreads - 1) / nthreads;
+  for (int t = 0; t < nthreads; t++) {
+    tasks[t].groups = groups;
+    tasks[t].importance = importance;
+    tasks[t].place_rank = place_rank;
+    tasks[t].from = t * chunk < n ? t * chunk : n;
+    tasks[t].to = (t+1) * chunk < n ? (t+1) * chunk : n;
+    tasks[t].ngroups = ngroups;
+    tasks[t].partial = bigmem_alloc((ngroups > 0 ? ngroups : 1) * sizeof(struct aggregate));
+    if (!tasks[t].partial) {
+      fprintf(stderr, "Failed to allocate partial aggregates\n");
+      exit(1);
+    }
+  }
+
+  for (int t = 1; t < nthreads; t++) {
+    if (pthread_create(&threads[t], NULL, aggregate_thread, &tasks[t]) != 0) {
+      fprintf(stderr, "Failed to create thread\n");
+      exit(1);
+    }
+  }
+  aggregate_thread(&tasks[0]);
+
+  // Combine the partial aggregates into those of the first thread.
+  struct aggregate *total = tasks[0].partial;
+  for (int t = 1; t < nthreads; t++) {
+    pthread_join(threads[t], NULL);
+    for (int g = 0; g < ngroups; g++) {
+      const struct aggregate *p = &tasks[t].partial[g];
+      total[g].count += p->count;
+      total[g].importance_sum += p->importance_sum;
+      if (p->importance_max > total[g].importance_max) {
+        total[g].importance_max = p->importance_max;
+      }
+      total[g].place_rank_sum += p->place_rank_sum;
+    }
+    bigmem_free(tasks[t].partial);
+  }
+
+  runtime = microseconds()-start;
+  fprintf(stderr, "Aggregating: %dms (%d threads)\n", (int)runtime/1000, nthreads);
+
+  // Print the groups in order of their values.
+  int *order = bigmem_alloc((ngroups > 0 ? ngroups : 1) * sizeof(int));
+  int *group_of_example = bigmem_alloc((n > 0 ? n : 1) * sizeof(int));
+  if (!order || !group_of_example) {
+    fprintf(stderr, "Failed to allocate output order\n");
+    exit(1);
+  }
+  for (int g = 0; g < ngroups; g++) {
+    order[g] = examples[g];
+    group_of_example[examples[g]] = g;
+  }
+  sort_rs = rs;
+  sort_columns = columns;
+  sort_ncolumns = ncolumns;
+  qsort(order, ngroups, sizeof(int), compare_groups);
+
+  for (int c = 0; c < ncolumns; c++) {
+    printf("%s\t", record_column_name(columns[c]));
+  }
+  printf("count\tmean_importance\tmax_importance\tmean_place_rank\n");
+
+  for (int i = 0; i < ngroups; i++) {
+    const struct record *r = &rs[order[i]];
+    const struct aggregate *a = &total[group_of_example[order[i]]];
+    for (int c = 0; c < ncolumns; c++) {
+      printf("%s\t", record_string(r, columns[c]));
+    }
+    printf("%ld\t%f\t%f\t%f\n", (long)a->count, a->importance_sum / a->count,
+           a->importance_max, (double)a->place_rank_sum / a->count);
+  }
+
+  bigmem_free(order);
+  bigmem_free(group_of_example);
+  bigmem_free(total);
+  bigmem_free(groups);
+  bigmem_free(examples);
+  bigmem_free(importance);
+  bigmem_free(place_rank);
+  free(columns);
+  free_records(rs, n);
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// Runs several query programs on the same dataset and queries, and
+// tabulates how they did, for example
+//
+//   ./benchmark planet-latest_geonames.tsv ids.txt id_query_naive id_query_binsort
+//
+// Each program is run as "PROGRAM FILE" with the queries on stdin,
+// and its output is parsed: the lines printed by the query loops
+// (Reading records, Building index, Peak RSS after load and after
+// build, Index size, Query time, Total query runtime and Query
+// latency) give the measurements, and all other lines are results,
+// which must be the same for every program.  The table is written as
+// CSV, or as JSON with -j, and the exit status is non-zero if any
+// program failed or disagreed with the first one.
+//
+// As the results are compared exactly, the programs must break ties as
+// the naive ones do: an id that is in the dataset more than once is
+// answered with its first record in the file, and of several records
+// equally near a point, the first in the file is the nearest.
+
+// Measurements of one program.
+struct run {
+  const char *program;
+  int ok;                 // Did the program exit successfully?
+  int load_ms, build_ms;
+  long load_rss_kb;       // Peak resident set size after loading
+  long build_rss_kb;      // Peak resident set size after building
+  long peak_rss_kb;       // Largest resident set size
+  long long index_bytes;  // Reported index size, or -1
+  long queries;
+  long long total_us;
+  unsigned long p50, p90, p99, p999, max;
+  uint64_t results_hash;  // Hash of the result lines
+  long results;           // Number of result lines
+};
+
+static uint64_t hash_line(uint64_t h, const char *s) {
+  for (; *s; s++) {
+    h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+  }
+  return h;
+}
+
+// Run the program and fill in 'run'.
+static void run_program(struct run *run, const char *program, const char *file,
+                        const char *queries) {
+  memset(run, 0, sizeof(struct run));
+  run->program = program;
+  run->index_bytes = -1;
+  run->results_hash = 14695981039346656037ULL;
+
+  int fds[2];
+  if (pipe(fds) != 0) {
+    fprintf(stderr, "Error: pipe failed (errno: %s)\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  // Look up programs given without a directory in the current one, as
+  // make would.
+  char path[4096];
+  snprintf(path, sizeof(path), strchr(run->program, '/') ? "%s" : "./%s", run->program);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "Error: fork failed (errno: %s)\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    int in = open(queries, O_RDONLY);
+    if (in < 0) {
+      fprintf(stderr, "Failed to open %s (errno: %s)\n", queries, strerror(errno));
+      _exit(127);
+    }
+    dup2(in, 0);
+    dup2(fds[1], 1);
+    close(in);
+    close(fds[0]);
+    close(fds[1]);
+    execl(path, path, file, (char*)NULL);
+    fprintf(stderr, "Failed to run %s (errno: %s)\n", path, strerror(errno));
+    _exit(127);
+  }
+
+  close(fds[1]);
+  FILE *out = fdopen(fds[0], "r");
+  char *line = NULL;
+  size_t line_len;
+  while (getline(&line, &line_len, out) != -1) {
+    if (sscanf(line, "Reading records: %dms", &run->load_ms) == 1 ||
+        sscanf(line, "Building index: %dms", &run->build_ms) == 1 ||
+        sscanf(line, "Total query runtime: %lldus", &run->total_us) == 1 ||
+        sscanf(line, "Peak RSS after load: %ld kB", &run->load_rss_kb) == 1 ||
+        sscanf(line, "Peak RSS after build: %ld kB", &run->build_rss_kb) == 1 ||
+        sscanf(line, "Index size: %lld bytes", &run->index_bytes) == 1 ||
+        sscanf(line, "Query latency: p50 %luns, p90 %luns, p99 %luns, p99.9 %luns, max %luns",
+               &run->p50, &run->p90, &run->p99, &run->p999, &run->max) == 5) {
+      continue;
+    }
+    if (strncmp(line, "Query time:", 11) == 0) {
+      run->queries++;
+      continue;
+    }
+    run->results_hash = hash_line(run->results_hash, line);
+    run->results++;
+  }
+  free(line);
+  fclose(out);
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) == pid) {
+    run->ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    run->peak_rss_kb = usage.ru_maxrss;
+  }
+}
+
+int main(int argc, char** argv) {
+  int json = argc > 1 && strcmp(argv[1], "-j") == 0;
+  if (argc < 4 + json) {
+    fprintf(stderr, "Usage: %s [-j] FILE QUERIES PROGRAM...\n", argv[0]);
+    exit(1);
+  }
+
+  const char *file = argv[1+json];
+  const char *queries = argv[2+json];
+  int nruns = argc - 3 - json;
+  struct run *runs = malloc(nruns * sizeof(struct run));
+  if (!runs) {
+    fprintf(stderr, "Error: Failed to allocate memory for runs.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int failed = 0;
+  for (int i = 0; i < nruns; i++) {
+    fprintf(stderr, "Running %s\n", argv[3+json+i]);
+    run_program(&runs[i], argv[3+json+i], file, queries);
+
+    if (!runs[i].ok) {
+      fprintf(stderr, "%s failed\n", runs[i].program);
+      failed = 1;
+    } else if (runs[i].results != runs[0].results ||
+               runs[i].results_hash != runs[0].results_hash) {
+      fprintf(stderr, "%s: results differ from %s\n", runs[i].program, runs[0].program);
+      failed = 1;
+    }
+  }
+
+  if (json) {
+    printf("[\n");
+  } else {
+    printf("program,ok,same_results,load_ms,build_ms,load_rss_kb,build_rss_kb,peak_rss_kb,"
+           "index_bytes,queries,queries_per_s,p50_ns,p90_ns,p99_ns,p999_ns,max_ns\n");
+  }
+  for (int i = 0; i < nruns; i++) {
+    const struct run *r = &runs[i];
+    int same = r->results == runs[0].results && r->results_hash == runs[0].results_hash;
+    double qps = r->total_us > 0 ? r->queries * 1e6 / r->total_us : 0;
+    if (json) {
+      printf("  {\"program\": \"%s\", \"ok\": %s, \"same_results\": %s, "
+             "\"load_ms\": %d, \"build_ms\": %d, \"load_rss_kb\": %ld, \"build_rss_kb\": %ld, "
+             "\"peak_rss_kb\": %ld, \"index_bytes\": %lld, "
+             "\"queries\": %ld, \"queries_per_s\": %.1f, \"p50_ns\": %lu, \"p90_ns\": %lu, "
+             "\"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu}%s\n",
+             r->program, r->ok ? "true" : "false", same ? "true" : "false",
+             r->load_ms, r->build_ms, r->load_rss_kb, r->build_rss_kb, r->peak_rss_kb,
+             r->index_bytes, r->queries, qps, r->p50, r->p90, r->p99, r->p999, r->max,
+             i+1 < nruns ? "," : "");
+    } else {
+      printf("%s,%d,%d,%d,%d,%ld,%ld,%ld,%lld,%ld,%.1f,%lu,%lu,%lu,%lu,%lu\n",
+             r->program, r->ok, same, r->load_ms, r->build_ms, r->load_rss_kb, r->build_rss_kb,
+             r->peak_rss_kb, r->index_bytes, r->queries, qps, r->p50, r->p90, r->p99, r->p999, r->max);
+    }
+  }
+  if (json) {
+    printf("]\n");
+  }
+
+  free(runs);
+  return failed;
+}
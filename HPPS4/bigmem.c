@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "bigmem.h"
+
+// Allocations of at least this many bytes are mapped.
+#define MAP_THRESHOLD (1 << 21)
+
+#define HUGE_PAGE_SIZE ((size_t)1 << 21)
+
+// Every allocation starts with a header, which keeps the memory after
+// it aligned to 64 bytes.
+#define HEADER_SIZE 64
+
+// From <linux/mempolicy.h>, which is not always installed.
+#define MPOL_INTERLEAVE 3
+
+struct header {
+  size_t size;       // Bytes asked for
+  void *base;        // Start of the mapping, or NULL if from malloc()
+  size_t mapped;     // Length of the mapping
+  size_t committed;  // Length of the part that can be used, if reserved
+};
+
+enum { HUGEPAGES_OFF, HUGEPAGES_THP, HUGEPAGES_EXPLICIT };
+
+static int hugepages = -1;  // -1 until the environment has been read
+static int interleave;
+
+static void read_policy() {
+  const char *h = getenv("BIGMEM_HUGEPAGES");
+  const char *numa = getenv("BIGMEM_NUMA");
+  hugepages = !h || strcmp(h, "thp") == 0 ? HUGEPAGES_THP
+    : strcmp(h, "explicit") == 0 ? HUGEPAGES_EXPLICIT
+    : HUGEPAGES_OFF;
+  interleave = numa && strcmp(numa, "interleave") == 0;
+}
+
+// Map 'length' bytes, a multiple of HUGE_PAGE_SIZE, at an address
+// aligned to HUGE_PAGE_SIZE, with any extra mmap() flags.  With
+// MAP_NORESERVE, the pages cannot be accessed until bigmem_commit().
+// Returns NULL on failure.
+static void* map_aligned(size_t length, int flags) {
+  if (hugepages == HUGEPAGES_EXPLICIT && !(flags & MAP_NORESERVE)) {
+    void *p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      return p;
+    }
+  }
+
+  // Map an extra huge page and trim the ends to the alignment.
+  // Inaccessible pages do not count against the commit limit, so a
+  // reservation works even when the kernel does not overcommit.
+  int prot = flags & MAP_NORESERVE ? PROT_NONE : PROT_READ | PROT_WRITE;
+  char *p = mmap(NULL, length + HUGE_PAGE_SIZE, prot,
+                 MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+  size_t head = (HUGE_PAGE_SIZE - (uintptr_t)p % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+  if (head > 0) {
+    munmap(p, head);
+  }
+  munmap(p + head + length, HUGE_PAGE_SIZE - head);
+  p += head;
+
+  if (hugepages != HUGEPAGES_OFF) {
+    madvise(p, length, MADV_HUGEPAGE);
+  }
+  return p;
+}
+
+// Set the NUMA policy of a fresh mapping, before any page is touched.
+// Failure (as on a kernel without NUMA support) leaves the default.
+static void place(void *p, size_t length) {
+  if (interleave) {
+    // The kernel leaves out the nodes that do not exist.
+    unsigned long nodes = ~0UL;
+    syscall(SYS_mbind, p, length, MPOL_INTERLEAVE, &nodes, sizeof(nodes) * 8, 0);
+  }
+}
+
+static void* alloc(size_t size, int flags) {
+  if (hugepages < 0) {
+    read_policy();
+  }
+
+  struct header *h;
+  if (size + HEADER_SIZE < MAP_THRESHOLD && !flags) {
+    if (posix_memalign((void**)&h, HEADER_SIZE, size + HEADER_SIZE) != 0) {
+      return NULL;
+    }
+    h->base = NULL;
+    h->mapped = 0;
+  } else {
+    size_t mapped = (size + HEADER_SIZE + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    void *base = map_aligned(mapped, flags);
+    if (!base) {
+      return NULL;
+    }
+    size_t committed = mapped;
+    if (flags & MAP_NORESERVE) {
+      // Only the header, to begin with.
+      committed = sysconf(_SC_PAGESIZE);
+      if (mprotect(base, committed, PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, mapped);
+        return NULL;
+      }
+    }
+    place(base, mapped);
+    h = base;
+    h->base = base;
+    h->mapped = mapped;
+    h->committed = committed;
+  }
+  h->size = size;
+  return (char*)h + HEADER_SIZE;
+}
+
+void* bigmem_alloc(size_t size) {
+  return alloc(size, 0);
+}
+
+void* bigmem_reserve(size_t size) {
+  return alloc(size, MAP_NORESERVE);
+}
+
+int bigmem_commit(void *p, size_t size) {
+  struct header *h = (struct header*)((char*)p - HEADER_SIZE);
+  size_t want = (size + HEADER_SIZE + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  if (want > h->mapped) {
+    want = h->mapped;
+  }
+  if (want <= h->committed) {
+    return 0;
+  }
+  if (mprotect((char*)h->base + h->committed, want - h->committed, PROT_READ | PROT_WRITE) != 0) {
+    return -1;
+  }
+  h->committed = want;
+  return 0;
+}
+
+void* bigmem_realloc(void *p, size_t size) {
+  if (!p) {
+    return bigmem_alloc(size);
+  }
+  struct header *h = (struct header*)((char*)p - HEADER_SIZE);
+
+  // A mapping can usually grow or shrink without copying.  The policy
+  // set by mbind() stays with it.  Otherwise, copy.
+  if (h->base && size + HEADER_SIZE >= MAP_THRESHOLD) {
+    size_t mapped = (size + HEADER_SIZE + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    void *base = mremap(h->base, h->mapped, mapped, MREMAP_MAYMOVE);
+    if (base != MAP_FAILED) {
+      if (hugepages != HUGEPAGES_OFF) {
+        madvise(base, mapped, MADV_HUGEPAGE);
+      }
+      h = base;
+      h->base = base;
+      h->mapped = mapped;
+      h->size = size;
+      return (char*)h + HEADER_SIZE;
+    }
+  }
+
+  void *q = bigmem_alloc(size);
+  if (!q) {
+    return NULL;
+  }
+  memcpy(q, p, h->size < size ? h->size : size);
+  bigmem_free(p);
+  return q;
+}
+
+void bigmem_free(void *p) {
+  if (!p) {
+    return;
+  }
+  struct header *h = (struct header*)((char*)p - HEADER_SIZE);
+  if (h->base) {
+    munmap(h->base, h->mapped);
+  } else {
+    free(h);
+  }
+}
@@ -0,0 +1,57 @@
+// Allocation of large arrays, such as the records and the arrays of
+// the indexes, with control over their pages.
+//
+// Random lookups into arrays of hundreds of megabytes miss the TLB on
+// most accesses when the arrays are in 4 KiB pages.  Large allocations
+// are therefore mapped directly, aligned to 2 MiB, and by default
+// marked for transparent huge pages.  On machines with several NUMA
+// nodes, they can also be interleaved across all nodes, so that the
+// threads on every node see the same mix of local and remote memory,
+// instead of the whole array being on the node that happened to
+// allocate it.
+//
+// The behaviour is chosen with environment variables, read on the
+// first allocation:
+//
+//   BIGMEM_HUGEPAGES=thp       Transparent huge pages (the default)
+//   BIGMEM_HUGEPAGES=explicit  Huge pages from the reserved pool
+//                              (vm.nr_hugepages), falling back to
+//                              transparent ones when it is empty
+//   BIGMEM_HUGEPAGES=off       Ordinary pages
+//   BIGMEM_NUMA=interleave     Interleave pages across all nodes
+//   BIGMEM_NUMA=local          The kernel's default policy (the default)
+//
+// Small allocations go to malloc(), so the functions can be used for
+// any array whose size depends on the data.
+
+#ifndef BIGMEM_H
+#define BIGMEM_H
+
+#include <stddef.h>
+
+// Like malloc(), but the memory is aligned to 64 bytes.  Returns NULL
+// on failure.
+void* bigmem_alloc(size_t size);
+
+// Like bigmem_alloc(), for an array whose final size is not known in
+// advance, but has an upper bound.  Only address space is reserved for
+// 'size' bytes, and none of it can be used until bigmem_commit() makes
+// it usable, so the array can grow up to 'size' without ever moving.
+// Returns NULL on failure, for example when RLIMIT_AS is lower than
+// 'size'.  Free it with bigmem_free().
+void* bigmem_reserve(size_t size);
+
+// Make the first 'size' bytes of memory from bigmem_reserve() usable,
+// in steps of whole huge pages.  Memory is still only used as pages
+// are first touched, but when the kernel does not overcommit, the
+// bytes count against its commit limit from now on.  Returns 0 on
+// success, or -1 with errno set.
+int bigmem_commit(void *p, size_t size);
+
+// Like realloc(), for memory from bigmem_alloc().
+void* bigmem_realloc(void *p, size_t size);
+
+// Like free(), for memory from bigmem_alloc().
+void bigmem_free(void *p);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "build_pipeline.h"
+#include "trace.h"
+
+struct build_pipeline {
+  const struct index_builder *builder;
+  void *index;
+  pthread_t thread;
+
+  // The fields below are protected by the lock.
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  const struct record *rs;
+  int ready;              // Records read so far
+  int added;              // Records given to the builder so far
+  int adding;             // Is the builder adding records?
+  int done;               // Has reading ended?
+  int failed;             // Did reading fail?
+};
+
+// The builder thread, which adds the records as they become ready.
+static void* build_thread(void *arg) {
+  struct build_pipeline *p = arg;
+  TRACE_THREAD("index builder");
+  TRACE_BEGIN("begin index");
+  p->index = p->builder->begin();
+  TRACE_END();
+
+  pthread_mutex_lock(&p->lock);
+  while (!p->failed) {
+    if (p->added == p->ready) {
+      if (p->done) {
+        break;
+      }
+      pthread_cond_wait(&p->cond, &p->lock);
+      continue;
+    }
+
+    // Take everything read since the last batch.
+    const struct record *rs = p->rs;
+    int from = p->added, to = p->ready;
+    p->adding = 1;
+    pthread_mutex_unlock(&p->lock);
+    TRACE_BEGIN("add records");
+    p->builder->add(p->index, rs, from, to);
+    TRACE_END();
+    pthread_mutex_lock(&p->lock);
+    p->added = to;
+    p->adding = 0;
+    pthread_cond_broadcast(&p->cond);
+  }
+  int failed = p->failed;
+  pthread_mutex_unlock(&p->lock);
+
+  if (!failed) {
+    TRACE_BEGIN("finish index");
+    p->builder->finish(p->index);
+    TRACE_END();
+  }
+  return NULL;
+}
+
+struct build_pipeline* build_pipeline_start(const struct index_builder *builder) {
+  struct build_pipeline *p = calloc(1, sizeof(struct build_pipeline));
+  if (!p) {
+    fprintf(stderr, "Error: Failed to allocate memory for build pipeline.\n");
+    exit(EXIT_FAILURE);
+  }
+  p->builder = builder;
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->cond, NULL);
+  if (pthread_create(&p->thread, NULL, build_thread, p) != 0) {
+    fprintf(stderr, "Error: Failed to create build thread.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+void build_pipeline_ready(void *pipeline, const struct record *rs, int n) {
+  struct build_pipeline *p = pipeline;
+  pthread_mutex_lock(&p->lock);
+  if (rs) {
+    p->rs = rs;
+    p->ready = n;
+  } else {
+    // The records are about to be freed, so wait for the builder to
+    // let go of them.
+    p->failed = 1;
+    while (p->adding) {
+      pthread_cond_wait(&p->cond, &p->lock);
+    }
+  }
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+}
+
+void* build_pipeline_finish(struct build_pipeline *p) {
+  pthread_mutex_lock(&p->lock);
+  p->done = 1;
+  pthread_cond_broadcast(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->thread, NULL);
+
+  void *index = p->index;
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->cond);
+  free(p);
+  return index;
+}
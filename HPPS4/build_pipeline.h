@@ -0,0 +1,62 @@
+// Building an index while the records are being read.
+//
+// Normally the records are read first, and the index is built from all
+// of them afterwards, so the CPU waits for the disk during the first
+// step and the disk is idle during the second.  An index that can take
+// the records in batches instead provides an index_builder, and is
+// built on a thread of its own, which adds each batch while the next
+// one is being read and parsed.  Starting up then takes about as long
+// as the slower of the two steps, rather than both.
+//
+// The array of records must not move while the builder keeps pointers
+// into it, so read_records_streaming() reserves address space for the
+// most records the file could hold, about 50 times its size, and
+// commits memory to it as it goes.  If the file is not a regular file,
+// as with a pipe, or the address space cannot be reserved, as under a
+// tight RLIMIT_AS, the whole file is read first and the builder then
+// gets all the records at once, so nothing overlaps.
+//
+// Usage:
+//
+//   struct build_pipeline *p = build_pipeline_start(&builder);
+//   struct record *rs = read_records_streaming(file, &n, build_pipeline_ready, p);
+//   void *index = build_pipeline_finish(p);
+
+#ifndef BUILD_PIPELINE_H
+#define BUILD_PIPELINE_H
+
+#include "record.h"
+
+// Create an empty index.
+typedef void* (*begin_index_fn)(void);
+
+// Add the records rs[from] to rs[to-1] to an index.  The records, and
+// those before them, stay where they are, so the index may keep
+// pointers to them.
+typedef void (*add_records_fn)(void*, const struct record*, int, int);
+
+// Complete an index once all the records have been added.
+typedef void (*finish_index_fn)(void*);
+
+// The functions for building an index in batches.
+struct index_builder {
+  begin_index_fn begin;
+  add_records_fn add;
+  finish_index_fn finish;
+};
+
+struct build_pipeline;
+
+// Start building an index with the builder, on a new thread.
+struct build_pipeline* build_pipeline_start(const struct index_builder *builder);
+
+// A records_ready_fn for read_records_streaming(), which passes the new
+// records on to the builder.  The argument is the pipeline.
+void build_pipeline_ready(void *pipeline, const struct record *rs, int n);
+
+// Wait for the builder to add the last records and finish the index,
+// and return the index.  If reading failed, the index is returned
+// unfinished, and must still be freed.  Frees the pipeline.
+void* build_pipeline_finish(struct build_pipeline *p);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "record.h"
+#include "secondary_index.h"
+#include "timing.h"
+
+// Exact-match lookups on string columns.  The columns to index are
+// named on the command line, and a hash index (see secondary_index.h)
+// is built on each of them.  Every line of input is a column name and
+// a value separated by a single space, for example
+//
+//   wikidata Q1748
+//   country_code dk
+//
+// and all records with that value are printed.
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s FILE COLUMN...\n", argv[0]);
+    exit(1);
+  }
+
+  int ncolumns = argc-2;
+  enum record_column columns[RECORD_NUM_STRING_COLUMNS];
+  if (ncolumns > RECORD_NUM_STRING_COLUMNS) {
+    ncolumns = RECORD_NUM_STRING_COLUMNS;
+  }
+  for (int c = 0; c < ncolumns; c++) {
+    int column = record_column_by_name(argv[c+2]);
+    if (column < 0) {
+      fprintf(stderr, "Unknown string column: %s\n", argv[c+2]);
+      exit(1);
+    }
+    columns[c] = column;
+  }
+
+  uint64_t start, runtime;
+  int n;
+
+  start = microseconds();
+  struct record *rs = read_records(argv[1], &n);
+  runtime = microseconds()-start;
+
+  if (!rs) {
+    fprintf(stderr, "Failed to read input from %s (errno: %s)\n",
+            argv[1], strerror(errno));
+    return 1;
+  }
+
+  printf("Reading records: %dms\n", (int)runtime/1000);
+
+  // Indexes by column; NULL for columns that were not requested.
+  struct secondary_index *indexes[RECORD_NUM_STRING_COLUMNS] = { NULL };
+
+  start = microseconds();
+  for (int c = 0; c < ncolumns; c++) {
+    if (!indexes[columns[c]]) {
+      indexes[columns[c]] = secondary_index_create(rs, n, columns[c]);
+      if (!indexes[columns[c]]) {
+        fprintf(stderr, "Failed to build index on %s\n", record_column_name(columns[c]));
+        exit(1);
+      }
+    }
+  }
+  runtime = microseconds()-start;
+  printf("Building index: %dms\n", (int)runtime/1000);
+
+  char *line = NULL;
+  size_t line_len;
+
+  uint64_t runtime_sum = 0;
+  while (getline(&line, &line_len, stdin) != -1) {
+    line[strcspn(line, "\n")] = 0;
+
+    char *value = strchr(line, ' ');
+    int column = -1;
+    if (value) {
+      *value++ = 0;
+      column = record_column_by_name(line);
+    }
+    if (column < 0 || !indexes[column]) {
+      fprintf(stderr, "Not an indexed column: %s\n", line);
+      continue;
+    }
+
+    int count;
+    start = microseconds();
+    const int *rows = secondary_index_lookup(indexes[column], value, &count);
+    runtime = microseconds()-start;
+
+    for (int i = 0; i < count; i++) {
+      const struct record *r = &rs[rows[i]];
+      printf("%s=%s: %ld %s %f %f\n", line, value, (long)r->osm_id, record_name(r), r->lon, r->lat);
+    }
+    if (count == 0) {
+      printf("%s=%s: not found\n", line, value);
+    }
+
+    printf("Query time: %dus\n", (int)runtime);
+    runtime_sum += runtime;
+  }
+
+  printf("Total query runtime: %dus\n", (int)runtime_sum);
+
+  free(line);
+  for (int c = 0; c < RECORD_NUM_STRING_COLUMNS; c++) {
+    secondary_index_free(indexes[c]);
+  }
+  free_records(rs, n);
+  return 0;
+}
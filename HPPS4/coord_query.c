@@ -3,62 +3,482 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
 
 #include "coord_query.h"
 #include "timing.h"
+#include "histogram.h"
+#include "outbuf.h"
+#include "query_server.h"
+#include "perf_counters.h"
+#include "build_pipeline.h"
+#include "live_index.h"
+#include "trace.h"
 
-int coord_query_loop(int argc, char** argv, mk_index_fn mk_index, free_index_fn free_index, lookup_fn lookup) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s FILE\n", argv[0]);
+// Parse "[-q] FILE", or "--serve SOCKET FILE" if 'can_serve' is set,
+// and return FILE.
+static const char* parse_args(int argc, char** argv, int can_serve,
+                              int *quiet, const char **socket_path) {
+  *quiet = argc == 3 && strcmp(argv[1], "-q") == 0;
+  *socket_path = can_serve && argc == 4 && strcmp(argv[1], "--serve") == 0 ? argv[2] : NULL;
+  if (argc != 2 && !*quiet && !*socket_path) {
+    if (can_serve) {
+      fprintf(stderr, "Usage: %s [-q] FILE\n       %s --serve SOCKET FILE\n", argv[0], argv[0]);
+    } else {
+      fprintf(stderr, "Usage: %s [-q] FILE\n", argv[0]);
+    }
     exit(1);
   }
+  return argv[argc-1];
+}
+
+// Results go through a buffer of our own, which must not be
+// interleaved with the output still buffered by stdio.
+static struct outbuf* result_buffer() {
+  fflush(stdout);
+  return outbuf_create(STDOUT_FILENO);
+}
+
+// Append "(lon,lat)", as printed with "(%f,%f)".
+static void print_point(struct outbuf *out, double lon, double lat) {
+  outbuf_char(out, '(');
+  outbuf_double(out, lon);
+  outbuf_char(out, ',');
+  outbuf_double(out, lat);
+  outbuf_char(out, ')');
+}
+
+// Append the result of a lookup for the query printed by
+// print_point(), or "not found".
+static void print_result(struct outbuf *out, const struct record *r) {
+  if (r) {
+    outbuf_str(out, ": ");
+    outbuf_str(out, record_name(r));
+    outbuf_char(out, ' ');
+    print_point(out, r->lon, r->lat);
+    outbuf_char(out, '\n');
+  } else {
+    outbuf_str(out, ": not found\n");
+  }
+}
+
+static void print_query_time(struct outbuf *out, uint64_t runtime) {
+  outbuf_str(out, "Query time: ");
+  outbuf_long(out, (int)(runtime/1000));
+  outbuf_str(out, "us\n");
+}
+
+static struct histogram* latency_histogram() {
+  struct histogram *latency = histogram_create();
+  if (!latency) {
+    fprintf(stderr, "Error: Failed to allocate memory for latency histogram.\n");
+    exit(EXIT_FAILURE);
+  }
+  return latency;
+}
+
+// One kind of query.  The driver reads the query lines and, for each,
+// calls 'parse', times 'lookup', and unless -q was given, calls
+// 'print'.  In between, the query and its result are kept in 'state'.
+struct query_mode {
+  // Parse a query line.  Returns 0 if the line is to be skipped, after
+  // reporting why.  The line may be modified, and stays valid until
+  // 'print' has been called.
+  int (*parse)(void *state, char *line, int n);
+  // Look up the parsed query in the index.
+  void (*lookup)(void *state, void *index);
+  // Append the query and its result, without the query time.
+  void (*print)(void *state, struct outbuf *out);
+  // Answer a request sent to the server, or NULL if the mode does not
+  // take --serve.
+  int (*answer)(void *state, void *index, const struct query_request *req,
+                const struct record **r);
+  void *state;
+};
+
+// What the query loop and the server need.
+struct coord_loop {
+  struct live_index *live;
+  const struct query_mode *mode;
+};
+
+static int answer_request(void *arg, const struct query_request *req, const struct record **r) {
+  struct coord_loop *loop = arg;
+
+  // Stay in the read until the server has copied out the records.
+  struct generation *g = live_index_enter(loop->live);
+  return loop->mode->answer(loop->mode->state, g->index, req, r);
+}
+
+static void release_records(void *arg) {
+  struct coord_loop *loop = arg;
+  live_index_exit(loop->live);
+}
+
+// SIGHUP makes the server reload the file it was started with.
+static void reload_same_file(void *arg) {
+  struct coord_loop *loop = arg;
+  live_index_reload(loop->live, NULL);
+}
+
+// Answer queries of the given mode, from stdin or over the socket, and
+// print the measurements.  Returns the exit status.
+static int run_queries(struct coord_loop *loop, int quiet, const char *socket_path,
+                       struct perf_counters *counters) {
+  const struct query_mode *mode = loop->mode;
+  if (socket_path) {
+    struct query_service service = { answer_request, release_records, reload_same_file, loop };
+    return query_server_serve(socket_path, &service);
+  }
 
   uint64_t start, runtime;
-  int n;
+  char *line = NULL;
+  size_t line_len;
+  struct histogram *latency = latency_histogram();
+  struct outbuf *out_buffer = result_buffer();
 
-  start = microseconds();
-  struct record *rs = read_records(argv[1], &n);
-  runtime = microseconds()-start;
+  uint64_t runtime_sum = 0;
+  struct perf_sample before, after, counts;
+  memset(&counts, 0, sizeof(counts));
+  while (getline(&line, &line_len, stdin) != -1) {
+    if (live_index_reload_line(loop->live, line)) {
+      continue;
+    }
+    struct generation *g = live_index_enter(loop->live);
+    if (!mode->parse(mode->state, line, g->n)) {
+      live_index_exit(loop->live);
+      continue;
+    }
+
+    perf_counters_read(counters, &before);
+    TRACE_BEGIN("lookup");
+    start = nanoseconds();
+    mode->lookup(mode->state, g->index);
+    runtime = nanoseconds()-start;
+    TRACE_END();
+    perf_counters_read(counters, &after);
+    perf_sample_accumulate(&counts, &before, &after);
+    histogram_record(latency, runtime);
+
+    if (!quiet) {
+      mode->print(mode->state, out_buffer);
+      print_query_time(out_buffer, runtime);
+    }
+    live_index_exit(loop->live);
+    runtime_sum += runtime;
+  }
+  outbuf_free(out_buffer);
+
+  printf("Total query runtime: %dus\n", (int)(runtime_sum/1000));
+  histogram_print(latency, stdout, "Query latency");
+  perf_counters_print(counters, stdout, "query", &counts, 1);
+  perf_counters_print(counters, stdout, "per query", &counts, histogram_count(latency));
+
+  histogram_free(latency);
+  free(line);
+  return 0;
+}
+
+// Read the records and build the index, then answer queries of the
+// given mode.  Only a mode that can answer requests takes --serve.
+static int run_query_loop(int argc, char** argv, mk_index_fn mk_index,
+                          const struct index_builder *builder, free_index_fn free_index,
+                          index_size_fn index_size, const struct query_mode *mode) {
+  int quiet;
+  const char *socket_path;
+  const char *file = parse_args(argc, argv, mode->answer != NULL, &quiet, &socket_path);
+
+  struct index_source source = { mk_index, builder, free_index };
+  struct perf_counters *counters = perf_counters_open();
+  struct generation *g = load_generation(file, &source, index_size, counters, 1);
+  if (!g) {
+    fprintf(stderr, "Failed to read input from %s (errno: %s)\n",
+            file, strerror(errno));
+    perf_counters_close(counters);
+    return 1;
+  }
+
+  struct coord_loop loop = { live_index_create(g, file, &source), mode };
+  int ret = run_queries(&loop, quiet, socket_path, counters);
+  live_index_free(loop.live);
+  perf_counters_close(counters);
+  return ret;
+}
+
+// Make room for k results in *out, which holds *capacity.
+static void reserve_results(const struct record ***out, int *capacity, int k) {
+  if (k > *capacity) {
+    const struct record **grown = realloc(*out, k * sizeof(const struct record*));
+    if (!grown) {
+      fprintf(stderr, "Error: Failed to allocate memory for results.\n");
+      exit(EXIT_FAILURE);
+    }
+    *out = grown;
+    *capacity = k;
+  }
+}
 
-  if (rs) {
-    printf("Reading records: %dms\n", (int)runtime/1000);
+// A query for the record closest to a point.
+struct point_query {
+  lookup_fn lookup;
+  double lon, lat;
+  const struct record *r;
+};
+
+static int parse_point(void *state, char *line, int n) {
+  struct point_query *q = state;
+  (void)n;
+  sscanf(line, "%lf %lf", &q->lon, &q->lat);
+  return 1;
+}
+
+static void lookup_point(void *state, void *index) {
+  struct point_query *q = state;
+  q->r = q->lookup(index, q->lon, q->lat);
+}
+
+static void print_point_result(void *state, struct outbuf *out) {
+  struct point_query *q = state;
+  print_point(out, q->lon, q->lat);
+  print_result(out, q->r);
+}
 
-    start = microseconds();
-    void *index = mk_index(rs, n);
-    runtime = microseconds()-start;
-    printf("Building index: %dms\n", (int)runtime/1000);
+static int answer_point(void *state, void *index, const struct query_request *req,
+                        const struct record **r) {
+  struct point_query *q = state;
+  if (req->type != QUERY_COORD) {
+    return QUERY_BAD_REQUEST;
+  }
+  *r = q->lookup(index, req->lon, req->lat);
+  return *r ? QUERY_FOUND : QUERY_NOT_FOUND;
+}
 
-    char *line = NULL;
-    size_t line_len;
+static int point_query_loop(int argc, char** argv, mk_index_fn mk_index,
+                            const struct index_builder *builder, free_index_fn free_index,
+                            lookup_fn lookup, index_size_fn index_size) {
+  struct point_query q = { lookup, 0, 0, NULL };
+  struct query_mode mode = { parse_point, lookup_point, print_point_result, answer_point, &q };
+  return run_query_loop(argc, argv, mk_index, builder, free_index, index_size, &mode);
+}
 
-    uint64_t runtime_sum = 0;
-    while (getline(&line, &line_len, stdin) != -1) {
-      double lon, lat;
-      sscanf(line, "%lf %lf", &lon, &lat);
+int coord_query_loop(int argc, char** argv, mk_index_fn mk_index, free_index_fn free_index,
+                     lookup_fn lookup, index_size_fn index_size) {
+  return point_query_loop(argc, argv, mk_index, NULL, free_index, lookup, index_size);
+}
 
-      start = microseconds();
-      const struct record *r = lookup(index, lon, lat);
-      runtime = microseconds()-start;
+int coord_query_stream_loop(int argc, char** argv, const struct index_builder *builder,
+                            free_index_fn free_index, lookup_fn lookup, index_size_fn index_size) {
+  return point_query_loop(argc, argv, NULL, builder, free_index, lookup, index_size);
+}
 
-      if (r) {
-        printf("(%f,%f): %s (%f,%f)\n", lon, lat, r->name, r->lon, r->lat);
-      } else {
-        printf("(%f,%f): not found\n", lon, lat);
-      }
+// Parse the filter words following the coordinates on a query line.
+// Unknown words are reported and ignored.  The strings in 'filter'
+// point into 'words', which is modified.
+static void parse_filter(char *words, struct coord_filter *filter) {
+  filter->max_place_rank = -1;
+  filter->class = NULL;
+  filter->type = NULL;
 
-      printf("Query time: %dus\n", (int)runtime);
-      runtime_sum += runtime;
+  char *save;
+  for (char *w = strtok_r(words, " \t\n", &save); w; w = strtok_r(NULL, " \t\n", &save)) {
+    if (strncmp(w, "rank<=", 6) == 0) {
+      filter->max_place_rank = atoi(w+6);
+    } else if (strncmp(w, "class=", 6) == 0) {
+      filter->class = w+6;
+    } else if (strncmp(w, "type=", 5) == 0) {
+      filter->type = w+5;
+    } else {
+      fprintf(stderr, "Ignoring unknown filter: %s\n", w);
     }
+  }
+}
+
+int coord_filter_matches(const struct coord_filter *filter, const struct record *r) {
+  return (filter->max_place_rank < 0 || r->place_rank <= filter->max_place_rank)
+    && (filter->class == NULL || strcmp(record_string(r, RECORD_CLASS), filter->class) == 0)
+    && (filter->type == NULL || strcmp(record_string(r, RECORD_TYPE), filter->type) == 0);
+}
+
+// A query for the record closest to a point among those that satisfy
+// a filter.
+struct filtered_query {
+  lookup_filtered_fn lookup;
+  double lon, lat;
+  struct coord_filter filter;
+  const struct record *r;
+};
+
+static int parse_filtered(void *state, char *line, int n) {
+  struct filtered_query *q = state;
+  int consumed = 0;
+  (void)n;
+  sscanf(line, "%lf %lf%n", &q->lon, &q->lat, &consumed);
+  parse_filter(line+consumed, &q->filter);
+  return 1;
+}
+
+static void lookup_filtered(void *state, void *index) {
+  struct filtered_query *q = state;
+  q->r = q->lookup(index, q->lon, q->lat, &q->filter);
+}
+
+static void print_filtered_result(void *state, struct outbuf *out) {
+  struct filtered_query *q = state;
+  print_point(out, q->lon, q->lat);
+  print_result(out, q->r);
+}
+
+int coord_query_filtered_loop(int argc, char** argv, mk_index_fn mk_index, free_index_fn free_index,
+                              lookup_filtered_fn lookup, index_size_fn index_size) {
+  struct filtered_query q;
+  memset(&q, 0, sizeof(q));
+  q.lookup = lookup;
+  struct query_mode mode = { parse_filtered, lookup_filtered, print_filtered_result, NULL, &q };
+  return run_query_loop(argc, argv, mk_index, NULL, free_index, index_size, &mode);
+}
+
+double coord_weighted_score(const struct record *r, double lon, double lat, double alpha) {
+  double importance = r->importance > MIN_IMPORTANCE ? r->importance : MIN_IMPORTANCE;
+  double distance = sqrt((lon - r->lon) * (lon - r->lon) + (lat - r->lat) * (lat - r->lat));
+  return distance / pow(importance, alpha);
+}
+
+// A query for the k records with the best weighted score for a point.
+struct topk_query {
+  lookup_topk_fn lookup;
+  double lon, lat, alpha;
+  int k;
+  int found;
+  int capacity;
+  const struct record **out;
+};
+
+static int parse_topk(void *state, char *line, int n) {
+  struct topk_query *q = state;
+  q->alpha = 1;
+  q->k = 10;
+  sscanf(line, "%lf %lf %d %lf", &q->lon, &q->lat, &q->k, &q->alpha);
+  if (q->k <= 0) {
+    fprintf(stderr, "Invalid K, not positive: %s", line);
+    return 0;
+  }
+  // No more than all the records can be found.
+  if (q->k > n) {
+    q->k = n;
+  }
+  // The pruning bounds of the indexes assume that more important
+  // records never score worse.
+  if (q->alpha < 0) {
+    q->alpha = 0;
+  }
+  reserve_results(&q->out, &q->capacity, q->k);
+  return 1;
+}
 
-    printf("Total query runtime: %dus\n", (int)runtime_sum);
+static void lookup_topk(void *state, void *index) {
+  struct topk_query *q = state;
+  q->found = q->lookup(index, q->lon, q->lat, q->k, q->alpha, q->out);
+}
 
-    free(line);
-    free_index(index);
-    free_records(rs, n);
+static void print_topk_result(void *state, struct outbuf *out) {
+  struct topk_query *q = state;
+  for (int i = 0; i < q->found; i++) {
+    print_point(out, q->lon, q->lat);
+    print_result(out, q->out[i]);
+  }
+  if (q->found == 0) {
+    print_point(out, q->lon, q->lat);
+    print_result(out, NULL);
+  }
+}
+
+int coord_query_topk_loop(int argc, char** argv, mk_index_fn mk_index, free_index_fn free_index,
+                          lookup_topk_fn lookup, index_size_fn index_size) {
+  struct topk_query q;
+  memset(&q, 0, sizeof(q));
+  q.lookup = lookup;
+  struct query_mode mode = { parse_topk, lookup_topk, print_topk_result, NULL, &q };
+  int ret = run_query_loop(argc, argv, mk_index, NULL, free_index, index_size, &mode);
+  free(q.out);
+  return ret;
+}
+
+int viewport_contains(const struct viewport *v, double lon, double lat) {
+  if (lat < v->south || lat > v->north) {
     return 0;
+  }
+  if (v->west <= v->east) {
+    return lon >= v->west && lon <= v->east;
   } else {
-    fprintf(stderr, "Failed to read input from %s (errno: %s)\n",
-            argv[1], strerror(errno));
-    return 1;
+    return lon >= v->west || lon <= v->east;
+  }
+}
+
+// Append "(west,south,east,north)", as printed with "(%f,%f,%f,%f)".
+static void print_viewport(struct outbuf *out, const struct viewport *v) {
+  outbuf_char(out, '(');
+  outbuf_double(out, v->west);
+  outbuf_char(out, ',');
+  outbuf_double(out, v->south);
+  outbuf_char(out, ',');
+  outbuf_double(out, v->east);
+  outbuf_char(out, ',');
+  outbuf_double(out, v->north);
+  outbuf_char(out, ')');
+}
+
+// A query for the k most important records inside a viewport.
+struct viewport_query {
+  lookup_viewport_fn lookup;
+  struct viewport v;
+  int k;
+  int found;
+  int capacity;
+  const struct record **out;
+};
+
+static int parse_viewport(void *state, char *line, int n) {
+  struct viewport_query *q = state;
+  struct viewport v = { 0, 0, 0, 0 };
+  q->k = 50;
+  sscanf(line, "%lf %lf %lf %lf %d", &v.west, &v.south, &v.east, &v.north, &q->k);
+  q->v = v;
+  if (q->k < 0) {
+    q->k = 0;
   }
+  // No more than all the records can be found.
+  if (q->k > n) {
+    q->k = n;
+  }
+  reserve_results(&q->out, &q->capacity, q->k);
+  return 1;
+}
+
+static void lookup_viewport(void *state, void *index) {
+  struct viewport_query *q = state;
+  q->found = q->lookup(index, &q->v, q->k, q->out);
+}
+
+static void print_viewport_result(void *state, struct outbuf *out) {
+  struct viewport_query *q = state;
+  for (int i = 0; i < q->found; i++) {
+    print_viewport(out, &q->v);
+    print_result(out, q->out[i]);
+  }
+  if (q->found == 0) {
+    print_viewport(out, &q->v);
+    print_result(out, NULL);
+  }
+}
+
+int coord_query_viewport_loop(int argc, char** argv, mk_index_fn mk_index, free_index_fn free_index,
+                              lookup_viewport_fn lookup, index_size_fn index_size) {
+  struct viewport_query q;
+  memset(&q, 0, sizeof(q));
+  q.lookup = lookup;
+  struct query_mode mode = { parse_viewport, lookup_viewport, print_viewport_result, NULL, &q };
+  int ret = run_query_loop(argc, argv, mk_index, NULL, free_index, index_size, &mode);
+  free(q.out);
+  return ret;
 }
@@ -4,6 +4,7 @@
 #define COORD_QUERY_LOOP_H
 
 #include "record.h"
+#include "build_pipeline.h"
 
 typedef void* (*mk_index_fn)(const struct record*, int);
 
@@ -11,6 +12,84 @@ typedef void (*free_index_fn)(void*);
 
 typedef const struct record* (*lookup_fn)(void*, double, double);
 
-int coord_query_loop(int argc, char** argv, mk_index_fn, free_index_fn, lookup_fn);
+typedef size_t (*index_size_fn)(void*);
+
+// Also accepts "--serve SOCKET FILE", as id_query_loop() does.  In
+// this loop and all the others below, a query line "reload" or "reload
+// FILE" reloads the records in the background, and so does SIGHUP for
+// a server; see live_index.h.
+int coord_query_loop(int argc, char** argv, mk_index_fn, free_index_fn, lookup_fn, index_size_fn);
+
+// Like coord_query_loop(), but the index is built by the index_builder
+// while the records are being read, as with id_query_stream_loop().
+int coord_query_stream_loop(int argc, char** argv, const struct index_builder*, free_index_fn,
+                            lookup_fn, index_size_fn);
+
+// A restriction on which records a filtered lookup may return.  A
+// negative max_place_rank, or a NULL class or type, means that field
+// is not restricted.
+struct coord_filter {
+  int max_place_rank;
+  const char *class;
+  const char *type;
+};
+
+// Does the record satisfy the filter?
+int coord_filter_matches(const struct coord_filter*, const struct record*);
+
+// Look up the record closest to a point among those that satisfy the
+// filter.
+typedef const struct record* (*lookup_filtered_fn)(void*, double, double, const struct coord_filter*);
+
+// Like coord_query_loop(), but each query line may carry filter words
+// after the coordinates, for example
+//
+//   12.5 55.7 class=place type=city rank<=16
+int coord_query_filtered_loop(int argc, char** argv, mk_index_fn, free_index_fn, lookup_filtered_fn, index_size_fn);
+
+// Records with an importance below this are ranked as if they had
+// this importance, so that they still get a finite score.
+#define MIN_IMPORTANCE 1e-6
+
+// The score used to rank records by both distance and importance:
+// distance / importance^alpha.  Lower is better.
+double coord_weighted_score(const struct record*, double lon, double lat, double alpha);
+
+// Find the (at most) k records with the best weighted score for a
+// point, and store them in the array, best first.  Ties are broken
+// towards the record that comes first in the dataset.  Returns the
+// number of records stored.
+typedef int (*lookup_topk_fn)(void*, double, double, int, double, const struct record**);
+
+// Like coord_query_loop(), but each query line is of the form
+//
+//   LON LAT [K [ALPHA]]
+//
+// and up to K records are printed for each query.  K defaults to 10
+// and ALPHA to 1.  A query with K below 1 is reported on stderr and
+// skipped, and K is capped at the number of records.
+int coord_query_topk_loop(int argc, char** argv, mk_index_fn, free_index_fn, lookup_topk_fn, index_size_fn);
+
+// A rectangle of the map.  If west > east, the viewport crosses the
+// antimeridian, and covers longitudes >= west as well as <= east.
+struct viewport {
+  double west, south, east, north;
+};
+
+// Is the point inside the viewport (borders included)?
+int viewport_contains(const struct viewport*, double lon, double lat);
+
+// Find the (at most) k most important records inside a viewport, and
+// store them in the array, most important first.  Ties are broken
+// towards the record that comes first in the dataset.  Returns the
+// number of records stored.
+typedef int (*lookup_viewport_fn)(void*, const struct viewport*, int, const struct record**);
+
+// Like coord_query_loop(), but each query line is of the form
+//
+//   WEST SOUTH EAST NORTH [K]
+//
+// and up to K records are printed for each query.  K defaults to 50.
+int coord_query_viewport_loop(int argc, char** argv, mk_index_fn, free_index_fn, lookup_viewport_fn, index_size_fn);
 
 #endif
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+
+#include "coord_query.h"
+#include "record.h"
+#include "bigmem.h"
+
+// Filtered nearest-neighbour search with a k-d tree whose nodes
+// summarise their subtrees.  Each node stores the smallest place_rank
+// in its subtree, and two 64-bit masks with one bit set per distinct
+// class and type in the subtree (a string is mapped to a bit by
+// hashing, so several strings may share a bit).  A query skips any
+// subtree whose summary shows it cannot contain a matching record,
+// so rare classes do not require visiting most of the tree.
+//
+// The tree is stored implicitly: the node for the range [lo,hi) of
+// the arrays is at the middle position, its left subtree is the range
+// before it and its right subtree the range after it.  Nodes at even
+// depth split on longitude and nodes at odd depth on latitude.
+
+// A point being placed in the tree.
+struct kd_point {
+    double coord[2]; // Longitude and latitude
+    int row;         // Index of the record
+};
+
+// Structure to hold the k-d tree
+struct filtered_data {
+    const struct record *rs; // Pointer to the array of records
+    int n;                   // Number of records
+    double *lon;             // Longitude of each node
+    double *lat;             // Latitude of each node
+    int *row;                // Record index of each node
+    int *min_rank;           // Smallest place_rank in each subtree
+    uint64_t *class_mask;    // Bits of the classes in each subtree
+    uint64_t *type_mask;     // Bits of the types in each subtree
+};
+
+// The bit representing a string in a class or type mask (FNV-1a hash).
+static uint64_t string_bit(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    return (uint64_t)1 << (h & 63);
+}
+
+// Rearrange p[lo,hi) so that p[nth] holds the element that would be
+// there if the range was sorted on 'axis', with no larger elements
+// before it and no smaller ones after it.
+static void select_nth(struct kd_point *p, int lo, int hi, int nth, int axis) {
+    while (hi - lo > 1) {
+        double pivot = p[lo + (hi - lo) / 2].coord[axis];
+        int i = lo, j = hi - 1;
+        while (i <= j) {
+            while (p[i].coord[axis] < pivot) i++;
+            while (p[j].coord[axis] > pivot) j--;
+            if (i <= j) {
+                struct kd_point tmp = p[i];
+                p[i] = p[j];
+                p[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        // Now p[lo,j] <= pivot, p[i,hi) >= pivot and everything
+        // strictly between j and i equals the pivot.
+        if (nth <= j) {
+            hi = j + 1;
+        } else if (nth >= i) {
+            lo = i;
+        } else {
+            return;
+        }
+    }
+}
+
+// Build the subtree for the range [lo,hi) and compute its summary.
+static void build_node(struct filtered_data *data, struct kd_point *p,
+                       int lo, int hi, int depth) {
+    if (lo >= hi) return;
+
+    int mid = lo + (hi - lo) / 2;
+    select_nth(p, lo, hi, mid, depth % 2);
+
+    build_node(data, p, lo, mid, depth + 1);
+    build_node(data, p, mid + 1, hi, depth + 1);
+
+    const struct record *r = &data->rs[p[mid].row];
+    data->lon[mid] = p[mid].coord[0];
+    data->lat[mid] = p[mid].coord[1];
+    data->row[mid] = p[mid].row;
+    data->min_rank[mid] = r->place_rank;
+    data->class_mask[mid] = string_bit(record_string(r, RECORD_CLASS));
+    data->type_mask[mid] = string_bit(record_string(r, RECORD_TYPE));
+
+    // Fold in the summaries of the children.
+    int children[2] = { lo + (mid - lo) / 2, mid + 1 + (hi - mid - 1) / 2 };
+    int present[2] = { lo < mid, mid + 1 < hi };
+    for (int c = 0; c < 2; c++) {
+        if (present[c]) {
+            int child = children[c];
+            if (data->min_rank[child] < data->min_rank[mid]) {
+                data->min_rank[mid] = data->min_rank[child];
+            }
+            data->class_mask[mid] |= data->class_mask[child];
+            data->type_mask[mid] |= data->type_mask[child];
+        }
+    }
+}
+
+// Function to create the k-d tree
+// Input: Pointer to the array of records (rs), number of records (n)
+// Output: Pointer to an initialized filtered_data structure
+struct filtered_data* mk_filtered(const struct record *rs, int n) {
+    struct filtered_data *data = malloc(sizeof(struct filtered_data));
+    struct kd_point *points = bigmem_alloc((n > 0 ? n : 1) * sizeof(struct kd_point));
+    if (!data || !points) {
+        fprintf(stderr, "Error: Failed to allocate memory for filtered_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t m = n > 0 ? n : 1;
+    data->rs = rs;
+    data->n = n;
+    data->lon = bigmem_alloc(m * sizeof(double));
+    data->lat = bigmem_alloc(m * sizeof(double));
+    data->row = bigmem_alloc(m * sizeof(int));
+    data->min_rank = bigmem_alloc(m * sizeof(int));
+    data->class_mask = bigmem_alloc(m * sizeof(uint64_t));
+    data->type_mask = bigmem_alloc(m * sizeof(uint64_t));
+    if (!data->lon || !data->lat || !data->row || !data->min_rank ||
+        !data->class_mask || !data->type_mask) {
+        fprintf(stderr, "Error: Failed to allocate memory for k-d tree arrays.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+        points[i].coord[0] = rs[i].lon;
+        points[i].coord[1] = rs[i].lat;
+        points[i].row = i;
+    }
+
+    build_node(data, points, 0, n, 0);
+    bigmem_free(points);
+
+    return data;
+}
+
+// Function to free the k-d tree
+// Input: Pointer to the filtered_data structure
+void free_filtered(struct filtered_data *data) {
+    if (data) {
+        bigmem_free(data->lon);
+        bigmem_free(data->lat);
+        bigmem_free(data->row);
+        bigmem_free(data->min_rank);
+        bigmem_free(data->class_mask);
+        bigmem_free(data->type_mask);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the filtered_data structure
+// Input: Pointer to the filtered_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_filtered(struct filtered_data *data) {
+    size_t m = data->n > 0 ? data->n : 1;
+    return sizeof(struct filtered_data)
+        + m * (2 * sizeof(double) + 2 * sizeof(int) + 2 * sizeof(uint64_t));
+}
+
+// State of a single search.
+struct search {
+    const struct filtered_data *data;
+    const struct coord_filter *filter;
+    double q[2];         // Query point
+    uint64_t class_bit;  // Bit that must be in a subtree's class mask (or 0)
+    uint64_t type_bit;   // Bit that must be in a subtree's type mask (or 0)
+    double best;         // Squared distance to the best match so far
+    int best_row;        // Record index of the best match, or -1
+};
+
+// Can the subtree at 'node' contain a record that matches the filter?
+static int may_match(const struct search *s, int node) {
+    const struct filtered_data *data = s->data;
+    return (s->filter->max_place_rank < 0 || data->min_rank[node] <= s->filter->max_place_rank)
+        && (data->class_mask[node] & s->class_bit) == s->class_bit
+        && (data->type_mask[node] & s->type_bit) == s->type_bit;
+}
+
+// Search the subtree for the range [lo,hi).
+static void search_node(struct search *s, int lo, int hi, int depth) {
+    if (lo >= hi) return;
+
+    int mid = lo + (hi - lo) / 2;
+    if (!may_match(s, mid)) return;
+
+    const struct filtered_data *data = s->data;
+    double dx = s->q[0] - data->lon[mid];
+    double dy = s->q[1] - data->lat[mid];
+    double d = dx * dx + dy * dy;
+    int row = data->row[mid];
+
+    // Ties go to the lower record index, as in a sequential scan.
+    if ((d < s->best || (d == s->best && row < s->best_row)) &&
+        coord_filter_matches(s->filter, &data->rs[row])) {
+        s->best = d;
+        s->best_row = row;
+    }
+
+    double diff = depth % 2 == 0 ? dx : dy;
+    if (diff < 0) {
+        search_node(s, lo, mid, depth + 1);
+        if (s->best_row < 0 || diff * diff <= s->best) {
+            search_node(s, mid + 1, hi, depth + 1);
+        }
+    } else {
+        search_node(s, mid + 1, hi, depth + 1);
+        if (s->best_row < 0 || diff * diff <= s->best) {
+            search_node(s, lo, mid, depth + 1);
+        }
+    }
+}
+
+// Function to find the closest record satisfying a filter
+// Input: Pointer to filtered_data, target longitude (lon) and latitude (lat), filter
+// Output: Pointer to the closest matching record, or NULL if none match
+const struct record* lookup_filtered(struct filtered_data *data, double lon, double lat,
+                                     const struct coord_filter *filter) {
+    struct search s;
+    s.data = data;
+    s.filter = filter;
+    s.q[0] = lon;
+    s.q[1] = lat;
+    s.class_bit = filter->class ? string_bit(filter->class) : 0;
+    s.type_bit = filter->type ? string_bit(filter->type) : 0;
+    s.best = DBL_MAX;
+    s.best_row = -1;
+
+    search_node(&s, 0, data->n, 0);
+
+    return s.best_row < 0 ? NULL : &data->rs[s.best_row];
+}
+
+// Main function to run the filtered coordinate query loop
+int main(int argc, char **argv) {
+    return coord_query_filtered_loop(argc, argv,
+                                     (mk_index_fn)mk_filtered,
+                                     (free_index_fn)free_filtered,
+                                     (lookup_filtered_fn)lookup_filtered,
+                                     (index_size_fn)index_size_filtered);
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+
+#include "coord_query.h"
+#include "record.h"
+
+// Filtered nearest-neighbour search by scanning every record.  This is
+// the baseline for coord_query_filtered.c, and the two should always
+// produce the same answers.
+
+// Structure to hold the dataset for naive querying
+struct naive_data {
+    const struct record *rs; // Pointer to the array of records
+    int n;                   // Number of records in the dataset
+};
+
+// Function to create and initialize the naive_data structure
+// Input: Pointer to the array of records (rs), number of records (n)
+// Output: Pointer to an initialized naive_data structure
+struct naive_data* mk_naive(const struct record *rs, int n) {
+    struct naive_data *data = malloc(sizeof(struct naive_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for naive_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    data->rs = rs;
+    data->n = n;
+    return data;
+}
+
+// Function to free the naive_data structure
+// Input: Pointer to the naive_data structure
+void free_naive(struct naive_data *data) {
+    free(data);
+}
+
+// Function to report the bytes allocated for the naive_data structure
+// Input: Pointer to the naive_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_naive(struct naive_data *data) {
+    (void)data;
+    return sizeof(struct naive_data);
+}
+
+// Function to find the closest record satisfying a filter
+// Input: Pointer to naive_data, target longitude (lon) and latitude (lat), filter
+// Output: Pointer to the closest matching record, or NULL if none match
+const struct record* lookup_naive(struct naive_data *data, double lon, double lat,
+                                  const struct coord_filter *filter) {
+    const struct record *closest = NULL;
+    double min_distance = DBL_MAX;
+
+    for (int i = 0; i < data->n; i++) {
+        const struct record *r = &data->rs[i];
+        // Squared distances order the records the same way as distances.
+        double dx = lon - r->lon;
+        double dy = lat - r->lat;
+        double distance = dx * dx + dy * dy;
+
+        if (distance < min_distance && coord_filter_matches(filter, r)) {
+            min_distance = distance;
+            closest = r;
+        }
+    }
+
+    return closest;
+}
+
+// Main function to run the filtered coordinate query loop
+int main(int argc, char **argv) {
+    return coord_query_filtered_loop(argc, argv,
+                                     (mk_index_fn)mk_naive,
+                                     (free_index_fn)free_naive,
+                                     (lookup_filtered_fn)lookup_naive,
+                                     (index_size_fn)index_size_naive);
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "coord_query.h"
+#include "record.h"
+#include "bigmem.h"
+
+// A brute-force coordinate index over fixed-point coordinates.  Each
+// longitude and latitude is stored as an int32 counting units of
+// 1e-7 degrees (about 1 cm), which halves the memory of the double
+// arrays used by coord_query_simd.c.
+//
+// Distances computed on the rounded coordinates are only approximate,
+// so the scan collects every record whose fixed-point distance is
+// within the rounding error of the best one, and these candidates are
+// then re-ranked with the original doubles, using the same formula as
+// coord_query_naive.c.  The result is therefore identical to the
+// naive implementation.
+
+// Fixed-point units per degree.
+#define UNITS_PER_DEGREE 1e7
+
+// Rounding both the point and the query to the nearest unit moves
+// each coordinate difference by at most one unit, so the Euclidean
+// distance moves by at most sqrt(2) units.  Two records whose
+// fixed-point distances differ by less than twice that may therefore
+// be in either order.  The slack is rounded up to cover the floating
+// point error of the conversions.
+#define CANDIDATE_SLACK 3.0
+
+// Structure to hold the fixed-point coordinates
+struct fixed_data {
+    const struct record *rs; // Pointer to the array of records (for re-ranking)
+    int32_t *lon;            // Longitudes in units of 1e-7 degrees
+    int32_t *lat;            // Latitudes in units of 1e-7 degrees
+    int n;                   // Number of records
+    int coords_capacity;     // Number of coordinates allocated
+    int *candidates;         // Scratch array of candidate indexes
+    int capacity;            // Capacity of 'candidates'
+};
+
+// Convert a coordinate to fixed-point units.
+static int64_t to_fixed(double degrees) {
+    return llround(degrees * UNITS_PER_DEGREE);
+}
+
+// Function to calculate the Euclidean distance between two points,
+// exactly as coord_query_naive.c does it
+static double euclidean_distance(double lon1, double lat1, double lon2, double lat2) {
+    return sqrt((lon1 - lon2) * (lon1 - lon2) + (lat1 - lat2) * (lat1 - lat2));
+}
+
+// Function to square a coordinate difference.  A difference of more
+// than about 304 degrees squares to more than INT64_MAX, so the square
+// is taken of the absolute value, as unsigned.
+// Input: Difference in fixed-point units
+// Output: Its square
+static uint64_t square(int64_t d) {
+    uint64_t a = d < 0 ? -(uint64_t)d : (uint64_t)d;
+    return a * a;
+}
+
+// Largest squared fixed-point distance that can still belong to the
+// true nearest neighbour, when the best squared distance seen is
+// 'best'.
+static uint64_t candidate_limit(uint64_t best) {
+    double limit = sqrt((double)best) + CANDIDATE_SLACK;
+    return (uint64_t)ceil(limit * limit);
+}
+
+// Function to create an empty fixed_data structure, for adding
+// records to in batches
+// Output: Pointer to an initialized fixed_data structure
+struct fixed_data* begin_fixed(void) {
+    struct fixed_data *data = calloc(1, sizeof(struct fixed_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for fixed_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    data->capacity = 16;
+    data->candidates = malloc(data->capacity * sizeof(int));
+    if (!data->candidates) {
+        fprintf(stderr, "Error: Failed to allocate memory for fixed-point coordinates.\n");
+        exit(EXIT_FAILURE);
+    }
+    return data;
+}
+
+// Function to change the number of coordinates allocated
+// Input: Pointer to the fixed_data structure, new capacity
+static void resize_coords(struct fixed_data *data, int capacity) {
+    int32_t *lon = bigmem_realloc(data->lon, (capacity > 0 ? capacity : 1) * sizeof(int32_t));
+    int32_t *lat = bigmem_realloc(data->lat, (capacity > 0 ? capacity : 1) * sizeof(int32_t));
+    if (!lon || !lat) {
+        fprintf(stderr, "Error: Failed to allocate memory for fixed-point coordinates.\n");
+        exit(EXIT_FAILURE);
+    }
+    data->lon = lon;
+    data->lat = lat;
+    data->coords_capacity = capacity;
+}
+
+// Function to add a batch of records
+// Input: Pointer to the fixed_data structure, array of records (rs),
+//        first and one past the last record to add (from, to)
+void add_fixed(struct fixed_data *data, const struct record *rs, int from, int to) {
+    if (to > data->coords_capacity) {
+        resize_coords(data, 2 * data->coords_capacity > to ? 2 * data->coords_capacity : to);
+    }
+
+    // Quantize the coordinates.  OSM coordinates are within
+    // [-180,180]x[-90,90], which fits in an int32 at this resolution.
+    for (int i = from; i < to; i++) {
+        data->lon[i] = (int32_t)to_fixed(rs[i].lon);
+        data->lat[i] = (int32_t)to_fixed(rs[i].lat);
+    }
+
+    data->rs = rs;
+    data->n = to;
+}
+
+// Function to complete the structure once all records are added
+// Input: Pointer to the fixed_data structure
+void finish_fixed(struct fixed_data *data) {
+    if (data->coords_capacity != data->n || !data->lon) {
+        resize_coords(data, data->n);
+    }
+}
+
+// Function to create and initialize the fixed_data structure
+// Input: Pointer to the array of records (rs), number of records (n)
+// Output: Pointer to an initialized fixed_data structure
+struct fixed_data* mk_fixed(const struct record *rs, int n) {
+    struct fixed_data *data = begin_fixed();
+    add_fixed(data, rs, 0, n);
+    finish_fixed(data);
+    return data;
+}
+
+// Function to free the fixed_data structure
+// Input: Pointer to the fixed_data structure
+void free_fixed(struct fixed_data *data) {
+    if (data) {
+        bigmem_free(data->lon);
+        bigmem_free(data->lat);
+        free(data->candidates);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the fixed_data structure
+// Input: Pointer to the fixed_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_fixed(struct fixed_data *data) {
+    return sizeof(struct fixed_data)
+        + 2 * (size_t)(data->n > 0 ? data->n : 1) * sizeof(int32_t)
+        + (size_t)data->capacity * sizeof(int);
+}
+
+// Plain scan with the original doubles, used for queries outside the
+// range where the fixed-point arithmetic is known not to overflow.
+static const struct record* lookup_exact(struct fixed_data *data, double lon, double lat) {
+    const struct record *closest = NULL;
+    double min_distance = DBL_MAX;
+    for (int i = 0; i < data->n; i++) {
+        double distance = euclidean_distance(lon, lat, data->rs[i].lon, data->rs[i].lat);
+        if (distance < min_distance) {
+            min_distance = distance;
+            closest = &data->rs[i];
+        }
+    }
+    return closest;
+}
+
+// Function to find the closest record to a given longitude and latitude
+// Input: Pointer to fixed_data, target longitude (lon), and target latitude (lat)
+// Output: Pointer to the closest record, or NULL if no records exist
+const struct record* lookup_fixed(struct fixed_data *data, double lon, double lat) {
+    // With both points inside [-180,180]x[-90,90] the differences are
+    // at most 3.6e9 and 1.8e9 units, so the squared distance is below
+    // 1.7e19, which fits in a uint64_t, though not in an int64_t.
+    if (!(fabs(lon) <= 180 && fabs(lat) <= 90)) {
+        return lookup_exact(data, lon, lat);
+    }
+
+    int64_t qlon = to_fixed(lon);
+    int64_t qlat = to_fixed(lat);
+
+    uint64_t best = UINT64_MAX;
+    uint64_t limit = UINT64_MAX;
+    int ncand = 0;
+
+    // Single pass: track the best fixed-point distance, and remember
+    // every record that is within the rounding error of it.
+    for (int i = 0; i < data->n; i++) {
+        int64_t dx = data->lon[i] - qlon;
+        int64_t dy = data->lat[i] - qlat;
+        uint64_t d = square(dx) + square(dy);
+
+        if (d <= limit) {
+            if (d < best) {
+                best = d;
+                limit = candidate_limit(best);
+            }
+            if (ncand == data->capacity) {
+                // Drop the candidates that the improved bound rules
+                // out before growing the array.
+                int kept = 0;
+                for (int j = 0; j < ncand; j++) {
+                    int c = data->candidates[j];
+                    int64_t cx = data->lon[c] - qlon;
+                    int64_t cy = data->lat[c] - qlat;
+                    if (square(cx) + square(cy) <= limit) {
+                        data->candidates[kept++] = c;
+                    }
+                }
+                ncand = kept;
+                if (ncand > data->capacity / 2) {
+                    data->capacity *= 2;
+                    data->candidates = realloc(data->candidates, data->capacity * sizeof(int));
+                    if (!data->candidates) {
+                        fprintf(stderr, "Error: Failed to grow candidate array.\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+            }
+            data->candidates[ncand++] = i;
+        }
+    }
+
+    // Re-rank the candidates with the original coordinates.  They are
+    // in increasing index order, so ties go to the first record, as in
+    // the naive scan.
+    const struct record *closest = NULL;
+    double min_distance = DBL_MAX;
+    for (int j = 0; j < ncand; j++) {
+        const struct record *r = &data->rs[data->candidates[j]];
+        double distance = euclidean_distance(lon, lat, r->lon, r->lat);
+        if (distance < min_distance) {
+            min_distance = distance;
+            closest = r;
+        }
+    }
+
+    return closest;
+}
+
+// Main function to run the coordinate query loop
+// Input: Command-line arguments
+// Output: Exit status
+int main(int argc, char **argv) {
+    struct index_builder builder = {
+        (begin_index_fn)begin_fixed,
+        (add_records_fn)add_fixed,
+        (finish_index_fn)finish_fixed
+    };
+    return coord_query_stream_loop(argc, argv, &builder,
+                                   (free_index_fn)free_fixed,
+                                   (lookup_fn)lookup_fixed,
+                                   (index_size_fn)index_size_fixed);
+}
@@ -40,6 +40,15 @@ void free_naive(struct naive_data *data) {
     // Note: The records are managed and freed elsewhere
 }
 
+// Function to report the bytes allocated for the naive_data structure
+// The records are scanned in place, so there is only the structure.
+// Input: Pointer to the naive_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_naive(struct naive_data *data) {
+    (void)data;
+    return sizeof(struct naive_data);
+}
+
 // Function to calculate the Euclidean distance between two points
 // Input: Coordinates (lon1, lat1) and (lon2, lat2)
 // Output: Euclidean distance between the two points
@@ -78,5 +87,6 @@ int main(int argc, char **argv) {
     return coord_query_loop(argc, argv,
                             (mk_index_fn)mk_naive,    // Function to create the index
                             (free_index_fn)free_naive, // Function to free the index
-                            (lookup_fn)lookup_naive);  // Function to perform a lookup
+                            (lookup_fn)lookup_naive,  // Function to perform a lookup
+                            (index_size_fn)index_size_naive); // Function to report the index size
 }
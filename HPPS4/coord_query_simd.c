@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "coord_query.h"
+#include "record.h"
+#include "bigmem.h"
+
+// A vectorised variant of coord_query_naive.c.  Instead of walking
+// the array of records, the coordinates are copied into two
+// contiguous arrays (structure of arrays), which are scanned with
+// AVX-512 or AVX2 when the CPU supports it, and with a plain scalar
+// loop otherwise.  The scan compares squared distances, so no sqrt()
+// is needed, and keeps a minimum per vector lane, so there is no
+// branch per record.  For large datasets the scan is split across
+// several threads, each producing a partial minimum.
+//
+// The kernel can be forced by setting the environment variable
+// COORD_SIMD to "scalar", "avx2" or "avx512".
+
+// Below this many records per thread, starting threads costs more
+// than it saves.
+#define RECORDS_PER_THREAD (1 << 18)
+
+// Upper bound on the number of scanning threads.
+#define MAX_THREADS 64
+
+// Result of scanning a range of the coordinate arrays.
+struct scan_result {
+    double dist; // Smallest squared distance seen
+    int index;   // Index of the (first) record with that distance, or -1
+};
+
+// Signature of a scan kernel: find the nearest point among
+// [from,to) in the lon/lat arrays.
+typedef struct scan_result (*scan_fn)(const double *lon, const double *lat,
+                                      int from, int to,
+                                      double qlon, double qlat);
+
+// Structure to hold the coordinate arrays and the chosen kernel
+struct simd_data {
+    const struct record *rs; // Pointer to the array of records
+    double *lon;             // Longitudes, 64-byte aligned
+    double *lat;             // Latitudes, 64-byte aligned
+    int n;                   // Number of records
+    int nthreads;            // Number of threads used per query
+    scan_fn scan;            // Scan kernel
+};
+
+// Pick the better of two partial results.  Ties are broken towards
+// the lower index, so the answer matches a sequential scan.
+static struct scan_result better(struct scan_result a, struct scan_result b) {
+    if (b.index < 0) return a;
+    if (a.index < 0) return b;
+    if (b.dist < a.dist || (b.dist == a.dist && b.index < a.index)) {
+        return b;
+    }
+    return a;
+}
+
+// Scalar kernel, used when no vector extension is available and for
+// the tails of the vector kernels.
+static struct scan_result scan_scalar(const double *lon, const double *lat,
+                                      int from, int to,
+                                      double qlon, double qlat) {
+    struct scan_result res = { DBL_MAX, -1 };
+    for (int i = from; i < to; i++) {
+        double dx = lon[i] - qlon;
+        double dy = lat[i] - qlat;
+        double d = dx * dx + dy * dy;
+        if (d < res.dist) {
+            res.dist = d;
+            res.index = i;
+        }
+    }
+    return res;
+}
+
+// AVX2 kernel: four lanes, each tracking its own minimum and the
+// index at which it was found.  Indexes are kept as doubles so they
+// can be blended with the same mask as the distances.
+__attribute__((target("avx2")))
+static struct scan_result scan_avx2(const double *lon, const double *lat,
+                                    int from, int to,
+                                    double qlon, double qlat) {
+    // Scalar prologue until the arrays are 32-byte aligned.
+    int start = from;
+    while (start < to && ((uintptr_t)&lon[start] & 31) != 0) {
+        start++;
+    }
+    struct scan_result res = scan_scalar(lon, lat, from, start, qlon, qlat);
+
+    int end = start + ((to - start) & ~3);
+
+    if (start < end) {
+        __m256d vqlon = _mm256_set1_pd(qlon);
+        __m256d vqlat = _mm256_set1_pd(qlat);
+        __m256d best = _mm256_set1_pd(DBL_MAX);
+        __m256d best_idx = _mm256_set1_pd(-1);
+        __m256d idx = _mm256_set_pd(start + 3, start + 2, start + 1, start);
+        __m256d four = _mm256_set1_pd(4);
+
+        for (int i = start; i < end; i += 4) {
+            __m256d dx = _mm256_sub_pd(_mm256_load_pd(&lon[i]), vqlon);
+            __m256d dy = _mm256_sub_pd(_mm256_load_pd(&lat[i]), vqlat);
+            __m256d d = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            __m256d lt = _mm256_cmp_pd(d, best, _CMP_LT_OQ);
+            best = _mm256_blendv_pd(best, d, lt);
+            best_idx = _mm256_blendv_pd(best_idx, idx, lt);
+            idx = _mm256_add_pd(idx, four);
+        }
+
+        double lane_dist[4], lane_idx[4];
+        _mm256_storeu_pd(lane_dist, best);
+        _mm256_storeu_pd(lane_idx, best_idx);
+        for (int l = 0; l < 4; l++) {
+            struct scan_result lane = { lane_dist[l], (int)lane_idx[l] };
+            res = better(res, lane);
+        }
+    }
+
+    return better(res, scan_scalar(lon, lat, end, to, qlon, qlat));
+}
+
+// AVX-512 kernel: as the AVX2 kernel, but with eight lanes and mask
+// registers instead of blend masks.
+__attribute__((target("avx512f")))
+static struct scan_result scan_avx512(const double *lon, const double *lat,
+                                      int from, int to,
+                                      double qlon, double qlat) {
+    int start = from;
+    while (start < to && ((uintptr_t)&lon[start] & 63) != 0) {
+        start++;
+    }
+    struct scan_result res = scan_scalar(lon, lat, from, start, qlon, qlat);
+
+    int end = start + ((to - start) & ~7);
+
+    if (start < end) {
+        __m512d vqlon = _mm512_set1_pd(qlon);
+        __m512d vqlat = _mm512_set1_pd(qlat);
+        __m512d best = _mm512_set1_pd(DBL_MAX);
+        __m512d best_idx = _mm512_set1_pd(-1);
+        __m512d idx = _mm512_set_pd(start + 7, start + 6, start + 5, start + 4,
+                                    start + 3, start + 2, start + 1, start);
+        __m512d eight = _mm512_set1_pd(8);
+
+        for (int i = start; i < end; i += 8) {
+            __m512d dx = _mm512_sub_pd(_mm512_load_pd(&lon[i]), vqlon);
+            __m512d dy = _mm512_sub_pd(_mm512_load_pd(&lat[i]), vqlat);
+            __m512d d = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+            __mmask8 lt = _mm512_cmp_pd_mask(d, best, _CMP_LT_OQ);
+            best = _mm512_mask_blend_pd(lt, best, d);
+            best_idx = _mm512_mask_blend_pd(lt, best_idx, idx);
+            idx = _mm512_add_pd(idx, eight);
+        }
+
+        double lane_dist[8], lane_idx[8];
+        _mm512_storeu_pd(lane_dist, best);
+        _mm512_storeu_pd(lane_idx, best_idx);
+        for (int l = 0; l < 8; l++) {
+            struct scan_result lane = { lane_dist[l], (int)lane_idx[l] };
+            res = better(res, lane);
+        }
+    }
+
+    return better(res, scan_scalar(lon, lat, end, to, qlon, qlat));
+}
+
+// Choose a scan kernel based on the COORD_SIMD environment variable,
+// or on what the CPU supports.
+static scan_fn choose_kernel(void) {
+    const char *forced = getenv("COORD_SIMD");
+    __builtin_cpu_init();
+
+    if (forced) {
+        if (strcmp(forced, "scalar") == 0) return scan_scalar;
+        if (strcmp(forced, "avx2") == 0 && __builtin_cpu_supports("avx2")) return scan_avx2;
+        if (strcmp(forced, "avx512") == 0 && __builtin_cpu_supports("avx512f")) return scan_avx512;
+        fprintf(stderr, "Warning: COORD_SIMD=%s not available, detecting automatically.\n", forced);
+    }
+
+    if (__builtin_cpu_supports("avx512f")) return scan_avx512;
+    if (__builtin_cpu_supports("avx2")) return scan_avx2;
+    return scan_scalar;
+}
+
+// Function to create and initialize the simd_data structure
+// Input: Pointer to the array of records (rs), number of records (n)
+// Output: Pointer to an initialized simd_data structure
+struct simd_data* mk_simd(const struct record *rs, int n) {
+    struct simd_data *data = malloc(sizeof(struct simd_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for simd_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // bigmem_alloc() aligns to 64 bytes, so the vector kernels can use
+    // aligned loads.
+    size_t bytes = (n > 0 ? n : 1) * sizeof(double);
+    data->lon = bigmem_alloc(bytes);
+    data->lat = bigmem_alloc(bytes);
+    if (!data->lon || !data->lat) {
+        fprintf(stderr, "Error: Failed to allocate memory for coordinate arrays.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Copy the coordinates out of the records
+    for (int i = 0; i < n; i++) {
+        data->lon[i] = rs[i].lon;
+        data->lat[i] = rs[i].lat;
+    }
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = n / RECORDS_PER_THREAD;
+    if (nthreads > ncpus) nthreads = ncpus;
+    if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+    if (nthreads < 1) nthreads = 1;
+
+    data->rs = rs;
+    data->n = n;
+    data->nthreads = nthreads;
+    data->scan = choose_kernel();
+    return data;
+}
+
+// Function to free the simd_data structure
+// Input: Pointer to the simd_data structure
+void free_simd(struct simd_data *data) {
+    if (data) {
+        bigmem_free(data->lon);
+        bigmem_free(data->lat);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the simd_data structure
+// Input: Pointer to the simd_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_simd(struct simd_data *data) {
+    return sizeof(struct simd_data) + 2 * (size_t)(data->n > 0 ? data->n : 1) * sizeof(double);
+}
+
+// Work item for one scanning thread
+struct scan_task {
+    const struct simd_data *data;
+    int from, to;
+    double lon, lat;
+    struct scan_result result;
+};
+
+// Thread entry point: scan one chunk of the arrays
+static void* scan_thread(void *arg) {
+    struct scan_task *task = arg;
+    task->result = task->data->scan(task->data->lon, task->data->lat,
+                                    task->from, task->to,
+                                    task->lon, task->lat);
+    return NULL;
+}
+
+// Function to find the closest record to a given longitude and latitude
+// Input: Pointer to simd_data, target longitude (lon), and target latitude (lat)
+// Output: Pointer to the closest record, or NULL if no records exist
+const struct record* lookup_simd(struct simd_data *data, double lon, double lat) {
+    struct scan_result res;
+
+    if (data->nthreads == 1) {
+        res = data->scan(data->lon, data->lat, 0, data->n, lon, lat);
+    } else {
+        struct scan_task tasks[MAX_THREADS];
+        pthread_t threads[MAX_THREADS];
+        int chunk = (data->n + data->nthreads - 1) / data->nthreads;
+
+        for (int t = 0; t < data->nthreads; t++) {
+            tasks[t].data = data;
+            tasks[t].from = t * chunk;
+            tasks[t].to = (t + 1) * chunk < data->n ? (t + 1) * chunk : data->n;
+            tasks[t].lon = lon;
+            tasks[t].lat = lat;
+        }
+
+        // The calling thread scans the first chunk itself.  Only that
+        // chunk shows up in the hardware counters (see perf_counters.h).
+        for (int t = 1; t < data->nthreads; t++) {
+            if (pthread_create(&threads[t], NULL, scan_thread, &tasks[t]) != 0) {
+                fprintf(stderr, "Error: Failed to create scan thread.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        scan_thread(&tasks[0]);
+
+        res = tasks[0].result;
+        for (int t = 1; t < data->nthreads; t++) {
+            pthread_join(threads[t], NULL);
+            res = better(res, tasks[t].result);
+        }
+    }
+
+    return res.index < 0 ? NULL : &data->rs[res.index];
+}
+
+// Main function to run the coordinate query loop
+// Input: Command-line arguments
+// Output: Exit status
+int main(int argc, char **argv) {
+    return coord_query_loop(argc, argv,
+                            (mk_index_fn)mk_simd,
+                            (free_index_fn)free_simd,
+                            (lookup_fn)lookup_simd,
+                            (index_size_fn)index_size_simd);
+}
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "coord_query.h"
+#include "record.h"
+#include "bigmem.h"
+
+// Viewport top-k search with a tile pyramid.  Level z of the pyramid
+// cuts the map into 2^z x 2^z tiles of equal size in longitude and
+// latitude, and each tile of the lowest level holds its records sorted
+// by importance.  Every other tile keeps only the TILE_TOP most
+// important records below it, which are found by merging the lists of
+// its (at most four) children, so the whole pyramid is built in one
+// pass from the bottom up.  Only tiles that contain records are
+// stored.
+//
+// A query walks down from the top.  Tiles outside the viewport are
+// skipped, and so are tiles whose most important record cannot make
+// it into the top-k found so far.  A tile that lies entirely inside
+// the viewport contributes the head of its list, and only tiles that
+// straddle the border of the viewport are opened up.  A viewport thus
+// costs a few list merges, rather than a scan of every record inside
+// it.  Tile bounds are the bounding boxes of the records actually in
+// the tile, so rounding in the tile computation cannot make a record
+// escape the viewport test.  Asking for more than TILE_TOP records is
+// still answered correctly, but needs the lowest level throughout.
+// The results are exactly those of coord_query_viewport_naive.c.
+
+// Number of records kept in every tile above the lowest level.
+#define TILE_TOP 64
+
+// The lowest level has about this many records per tile on average.
+#define LEAF_SIZE 32
+
+// Deepest possible level, which keeps the tile keys within 32 bits.
+#define MAX_LEVEL 15
+
+// A tile of the pyramid.  Tiles on each level are sorted by their
+// Morton key (x and y with their bits interleaved), so the children of
+// a tile are adjacent on the next level.
+struct tile {
+    uint32_t key;           // Morton key of the tile on its level
+    int first;              // List of the tile is list[first..first+count)
+    int count;
+    int child;              // Children are tiles[child..child+nchildren)
+    int nchildren;          //   on the next level
+    double west, south;     // Bounding box of the records in the tile
+    double east, north;
+};
+
+// A level of the pyramid.
+struct tile_level {
+    struct tile *tiles;
+    int ntiles;
+    int *list;              // Record indexes, most important first
+};
+
+// Structure to hold the tile pyramid
+struct tiles_data {
+    const struct record *rs;   // Pointer to the array of records
+    int n;                     // Number of records
+    int depth;                 // Index of the lowest level
+    struct tile_level *levels; // Levels 0..depth
+    int *rows;                 // Record indexes of the current top-k
+    int capacity;              // Capacity of 'rows'
+};
+
+// A record being placed in the lowest level.
+struct leaf_entry {
+    uint32_t key;
+    int row;
+    double importance;
+};
+
+// Is (importance_a, row_a) ranked before (importance_b, row_b)?
+static int ranks_before(double importance_a, int row_a, double importance_b, int row_b) {
+    return importance_a > importance_b || (importance_a == importance_b && row_a < row_b);
+}
+
+// Comparison function for qsort: by tile, then by rank
+static int compare_leaf(const void *a, const void *b) {
+    const struct leaf_entry *x = a;
+    const struct leaf_entry *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    if (ranks_before(x->importance, x->row, y->importance, y->row)) return -1;
+    return ranks_before(y->importance, y->row, x->importance, x->row);
+}
+
+// Column or row of the tile containing a coordinate on a level with
+// 'size' tiles per side.
+static uint32_t tile_coord(double v, double min, double range, uint32_t size) {
+    double t = (v - min) / range * size;
+    if (!(t >= 0)) return 0;
+    if (t >= size) return size - 1;
+    return (uint32_t)t;
+}
+
+// Interleave the bits of x and y.
+static uint32_t morton(uint32_t x, uint32_t y) {
+    uint32_t key = 0;
+    for (int b = 0; b < 16; b++) {
+        key |= ((x >> b) & 1) << (2 * b + 1);
+        key |= ((y >> b) & 1) << (2 * b);
+    }
+    return key;
+}
+
+static void* checked_malloc(size_t size) {
+    void *p = bigmem_alloc(size);
+    if (!p) {
+        fprintf(stderr, "Error: Failed to allocate memory for tile pyramid.\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Shrink an allocation to the size that turned out to be needed.
+static void* shrink(void *p, size_t size) {
+    void *q = bigmem_realloc(p, size);
+    return q ? q : p;
+}
+
+// Build the lowest level, where each tile holds all of its records.
+static void build_leaves(struct tiles_data *data) {
+    const struct record *rs = data->rs;
+    int n = data->n;
+    uint32_t size = 1u << data->depth;
+    struct leaf_entry *entries = checked_malloc(n * sizeof(struct leaf_entry));
+
+    for (int i = 0; i < n; i++) {
+        entries[i].key = morton(tile_coord(rs[i].lon, -180, 360, size),
+                                tile_coord(rs[i].lat, -90, 180, size));
+        entries[i].row = i;
+        entries[i].importance = rs[i].importance;
+    }
+    qsort(entries, n, sizeof(struct leaf_entry), compare_leaf);
+
+    struct tile_level *level = &data->levels[data->depth];
+    level->tiles = checked_malloc(n * sizeof(struct tile));
+    level->list = checked_malloc(n * sizeof(int));
+    level->ntiles = 0;
+
+    for (int i = 0; i < n; i++) {
+        const struct record *r = &rs[entries[i].row];
+        if (i == 0 || entries[i].key != entries[i - 1].key) {
+            struct tile *t = &level->tiles[level->ntiles++];
+            t->key = entries[i].key;
+            t->first = i;
+            t->count = 0;
+            t->child = 0;
+            t->nchildren = 0;
+            t->west = t->east = r->lon;
+            t->south = t->north = r->lat;
+        }
+        struct tile *t = &level->tiles[level->ntiles - 1];
+        t->count++;
+        t->west = fmin(t->west, r->lon);
+        t->east = fmax(t->east, r->lon);
+        t->south = fmin(t->south, r->lat);
+        t->north = fmax(t->north, r->lat);
+        level->list[i] = entries[i].row;
+    }
+    level->tiles = shrink(level->tiles, level->ntiles * sizeof(struct tile));
+
+    bigmem_free(entries);
+}
+
+// Build level z from level z+1 by merging the lists of the children of
+// every tile.
+static void build_level(struct tiles_data *data, int z) {
+    const struct tile_level *below = &data->levels[z + 1];
+    struct tile_level *level = &data->levels[z];
+
+    // A tile has at least one child, so this bounds both arrays.
+    level->tiles = checked_malloc(below->ntiles * sizeof(struct tile));
+    level->list = checked_malloc((size_t)below->ntiles * TILE_TOP * sizeof(int));
+    level->ntiles = 0;
+
+    int used = 0;
+    for (int c = 0; c < below->ntiles; ) {
+        struct tile *t = &level->tiles[level->ntiles++];
+        t->key = below->tiles[c].key >> 2;
+        t->child = c;
+        t->nchildren = 0;
+        t->west = below->tiles[c].west;
+        t->east = below->tiles[c].east;
+        t->south = below->tiles[c].south;
+        t->north = below->tiles[c].north;
+        while (c < below->ntiles && below->tiles[c].key >> 2 == t->key) {
+            const struct tile *child = &below->tiles[c];
+            t->west = fmin(t->west, child->west);
+            t->east = fmax(t->east, child->east);
+            t->south = fmin(t->south, child->south);
+            t->north = fmax(t->north, child->north);
+            t->nchildren++;
+            c++;
+        }
+
+        // Merge the heads of the children's lists, which are sorted.
+        int pos[4] = { 0, 0, 0, 0 };
+        t->first = used;
+        t->count = 0;
+        while (t->count < TILE_TOP) {
+            int best = -1, best_row = 0;
+            for (int i = 0; i < t->nchildren; i++) {
+                const struct tile *child = &below->tiles[t->child + i];
+                if (pos[i] == child->count) continue;
+                int row = below->list[child->first + pos[i]];
+                if (best < 0 || ranks_before(data->rs[row].importance, row,
+                                             data->rs[best_row].importance, best_row)) {
+                    best = i;
+                    best_row = row;
+                }
+            }
+            if (best < 0) break;
+            pos[best]++;
+            level->list[used++] = best_row;
+            t->count++;
+        }
+    }
+    level->tiles = shrink(level->tiles, level->ntiles * sizeof(struct tile));
+    level->list = shrink(level->list, used * sizeof(int));
+}
+
+// Function to create the tile pyramid
+// Input: Pointer to the array of records (rs), number of records (n)
+// Output: Pointer to an initialized tiles_data structure
+struct tiles_data* mk_tiles(const struct record *rs, int n) {
+    struct tiles_data *data = malloc(sizeof(struct tiles_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for tiles_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    data->rs = rs;
+    data->n = n;
+    data->depth = 0;
+    while (data->depth < MAX_LEVEL && (double)n / ((double)(1u << data->depth) * (1u << data->depth)) > LEAF_SIZE) {
+        data->depth++;
+    }
+    data->levels = checked_malloc((data->depth + 1) * sizeof(struct tile_level));
+    data->rows = NULL;
+    data->capacity = 0;
+
+    build_leaves(data);
+    for (int z = data->depth - 1; z >= 0; z--) {
+        build_level(data, z);
+    }
+
+    int ntiles = 0;
+    for (int z = 0; z <= data->depth; z++) {
+        ntiles += data->levels[z].ntiles;
+    }
+    fprintf(stderr, "Tile pyramid: %d levels, %d tiles\n", data->depth + 1, ntiles);
+
+    return data;
+}
+
+// Function to free the tile pyramid
+// Input: Pointer to the tiles_data structure
+void free_tiles(struct tiles_data *data) {
+    if (data) {
+        for (int z = 0; z <= data->depth; z++) {
+            bigmem_free(data->levels[z].tiles);
+            bigmem_free(data->levels[z].list);
+        }
+        bigmem_free(data->levels);
+        free(data->rows);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the tile pyramid
+// Input: Pointer to the tiles_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_tiles(struct tiles_data *data) {
+    size_t bytes = sizeof(struct tiles_data) + (data->depth + 1) * sizeof(struct tile_level)
+        + (size_t)data->capacity * sizeof(int);
+    for (int z = 0; z <= data->depth; z++) {
+        const struct tile_level *level = &data->levels[z];
+        int entries = level->ntiles > 0
+            ? level->tiles[level->ntiles - 1].first + level->tiles[level->ntiles - 1].count : 0;
+        bytes += level->ntiles * sizeof(struct tile) + entries * sizeof(int);
+    }
+    return bytes;
+}
+
+// State of a single search.  The viewport does not cross the
+// antimeridian.
+struct search {
+    struct tiles_data *data;
+    struct viewport v;
+    int k;        // Number of records wanted
+    int found;    // Number of records in the top-k so far
+};
+
+// Would the record make it into the current top-k?
+static int wanted(const struct search *s, int row) {
+    const struct tiles_data *data = s->data;
+    if (s->found < s->k) {
+        return 1;
+    }
+    int last = data->rows[s->k - 1];
+    return ranks_before(data->rs[row].importance, row, data->rs[last].importance, last);
+}
+
+// Add a record to the sorted top-k, which it must belong in.
+static void insert(struct search *s, int row) {
+    struct tiles_data *data = s->data;
+    double importance = data->rs[row].importance;
+    int j = s->found < s->k ? s->found++ : s->k - 1;
+    while (j > 0 && ranks_before(importance, row,
+                                 data->rs[data->rows[j - 1]].importance, data->rows[j - 1])) {
+        data->rows[j] = data->rows[j - 1];
+        j--;
+    }
+    data->rows[j] = row;
+}
+
+// Search a tile on level z.
+static void search_tile(struct search *s, int z, const struct tile *t) {
+    const struct tiles_data *data = s->data;
+    const struct tile_level *level = &data->levels[z];
+    const struct viewport *v = &s->v;
+
+    if (t->east < v->west || t->west > v->east || t->north < v->south || t->south > v->north) {
+        return;
+    }
+    if (!wanted(s, level->list[t->first])) {
+        // Not even the most important record of the tile is good
+        // enough.
+        return;
+    }
+
+    int inside = t->west >= v->west && t->east <= v->east &&
+                 t->south >= v->south && t->north <= v->north;
+
+    if (inside && (z == data->depth || s->k <= TILE_TOP)) {
+        // The list holds the most important records of the tile, and
+        // all of them are in the viewport.
+        for (int i = 0; i < t->count; i++) {
+            int row = level->list[t->first + i];
+            if (!wanted(s, row)) break;
+            insert(s, row);
+        }
+    } else if (z == data->depth) {
+        for (int i = 0; i < t->count; i++) {
+            int row = level->list[t->first + i];
+            if (!wanted(s, row)) break;
+            const struct record *r = &data->rs[row];
+            if (r->lon >= v->west && r->lon <= v->east && r->lat >= v->south && r->lat <= v->north) {
+                insert(s, row);
+            }
+        }
+    } else {
+        const struct tile *children = &data->levels[z + 1].tiles[t->child];
+        for (int i = 0; i < t->nchildren; i++) {
+            search_tile(s, z + 1, &children[i]);
+        }
+    }
+}
+
+// Function to find the k most important records inside a viewport
+// Input: Pointer to tiles_data, the viewport, number of records (k), output array
+// Output: Number of records stored in 'out'
+int lookup_tiles(struct tiles_data *data, const struct viewport *v, int k,
+                 const struct record **out) {
+    if (k <= 0) {
+        return 0;
+    }
+
+    if (k > data->capacity) {
+        data->capacity = k;
+        data->rows = realloc(data->rows, k * sizeof(int));
+        if (!data->rows) {
+            fprintf(stderr, "Error: Failed to allocate memory for top-k array.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // A viewport across the antimeridian is searched as two halves,
+    // which do not overlap.
+    struct search s = { data, *v, k, 0 };
+    if (v->west > v->east) {
+        s.v.east = INFINITY;
+    }
+    for (int half = 0; half < (v->west > v->east ? 2 : 1); half++) {
+        if (half == 1) {
+            s.v.west = -INFINITY;
+            s.v.east = v->east;
+        }
+        const struct tile_level *top = &data->levels[0];
+        for (int i = 0; i < top->ntiles; i++) {
+            search_tile(&s, 0, &top->tiles[i]);
+        }
+    }
+
+    for (int i = 0; i < s.found; i++) {
+        out[i] = &data->rs[data->rows[i]];
+    }
+    return s.found;
+}
+
+// Main function to run the viewport query loop with the tile pyramid
+int main(int argc, char **argv) {
+    return coord_query_viewport_loop(argc, argv,
+                                     (mk_index_fn)mk_tiles,
+                                     (free_index_fn)free_tiles,
+                                     (lookup_viewport_fn)lookup_tiles,
+                                     (index_size_fn)index_size_tiles);
+}
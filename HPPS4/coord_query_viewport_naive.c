@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "coord_query.h"
+#include "record.h"
+
+// Viewport top-k search by scanning every record.  This is the
+// baseline for coord_query_tiles.c.
+
+// Structure to hold the dataset for naive querying
+struct naive_data {
+    const struct record *rs; // Pointer to the array of records
+    int n;                   // Number of records in the dataset
+};
+
+// Function to create and initialize the naive_data structure
+// Input: Pointer to the array of records (rs), number of records (n)
+// Output: Pointer to an initialized naive_data structure
+struct naive_data* mk_naive(const struct record *rs, int n) {
+    struct naive_data *data = malloc(sizeof(struct naive_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for naive_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    data->rs = rs;
+    data->n = n;
+    return data;
+}
+
+// Function to free the naive_data structure
+// Input: Pointer to the naive_data structure
+void free_naive(struct naive_data *data) {
+    free(data);
+}
+
+// Function to report the bytes allocated for the naive_data structure
+// Input: Pointer to the naive_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_naive(struct naive_data *data) {
+    (void)data;
+    return sizeof(struct naive_data);
+}
+
+// Function to find the k most important records inside a viewport
+// Input: Pointer to naive_data, the viewport, number of records (k), output array
+// Output: Number of records stored in 'out'
+int lookup_naive(struct naive_data *data, const struct viewport *v, int k,
+                 const struct record **out) {
+    int found = 0;
+    if (k <= 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < data->n; i++) {
+        const struct record *r = &data->rs[i];
+        if (!viewport_contains(v, r->lon, r->lat)) {
+            continue;
+        }
+
+        // Records are visited in order, so a record must be strictly
+        // more important to displace an earlier one.
+        if (found == k && !(r->importance > out[k - 1]->importance)) {
+            continue;
+        }
+
+        int j = found < k ? found++ : k - 1;
+        while (j > 0 && r->importance > out[j - 1]->importance) {
+            out[j] = out[j - 1];
+            j--;
+        }
+        out[j] = r;
+    }
+
+    return found;
+}
+
+// Main function to run the viewport query loop
+int main(int argc, char **argv) {
+    return coord_query_viewport_loop(argc, argv,
+                                     (mk_index_fn)mk_naive,
+                                     (free_index_fn)free_naive,
+                                     (lookup_viewport_fn)lookup_naive,
+                                     (index_size_fn)index_size_naive);
+}
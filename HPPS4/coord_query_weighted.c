@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "coord_query.h"
+#include "record.h"
+#include "bigmem.h"
+
+// Importance-weighted top-k search with branch-and-bound over a k-d
+// tree.  Records are ranked by coord_weighted_score(), that is
+// distance / importance^alpha.  Each node of the tree stores the
+// largest importance in its subtree, and the search keeps track of
+// the bounding box of the subtree it is in.  The distance to the box
+// divided by the largest weight in the subtree is then a lower bound
+// on the score of every record below the node, and the subtree is
+// skipped when that bound is worse than the k'th best score found so
+// far.  The results are exactly those of coord_query_weighted_naive.c.
+//
+// The tree has the same implicit layout as in coord_query_filtered.c:
+// the node for the range [lo,hi) is at the middle position, with the
+// subtrees on either side of it.
+
+// A point being placed in the tree.
+struct kd_point {
+    double coord[2]; // Longitude and latitude
+    int row;         // Index of the record
+};
+
+// Structure to hold the k-d tree
+struct weighted_data {
+    const struct record *rs;  // Pointer to the array of records
+    int n;                    // Number of records
+    double *lon;              // Longitude of each node
+    double *lat;              // Latitude of each node
+    int *row;                 // Record index of each node
+    double *max_importance;   // Largest importance in each subtree
+    double *scores;           // Scores of the current top-k
+    int *rows;                // Record indexes of the current top-k
+    int capacity;             // Capacity of 'scores' and 'rows'
+};
+
+// Rearrange p[lo,hi) so that p[nth] holds the element that would be
+// there if the range was sorted on 'axis', with no larger elements
+// before it and no smaller ones after it.
+static void select_nth(struct kd_point *p, int lo, int hi, int nth, int axis) {
+    while (hi - lo > 1) {
+        double pivot = p[lo + (hi - lo) / 2].coord[axis];
+        int i = lo, j = hi - 1;
+        while (i <= j) {
+            while (p[i].coord[axis] < pivot) i++;
+            while (p[j].coord[axis] > pivot) j--;
+            if (i <= j) {
+                struct kd_point tmp = p[i];
+                p[i] = p[j];
+                p[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if (nth <= j) {
+            hi = j + 1;
+        } else if (nth >= i) {
+            lo = i;
+        } else {
+            return;
+        }
+    }
+}
+
+// Build the subtree for the range [lo,hi) and return its largest
+// importance.
+static double build_node(struct weighted_data *data, struct kd_point *p,
+                         int lo, int hi, int depth) {
+    if (lo >= hi) return 0;
+
+    int mid = lo + (hi - lo) / 2;
+    select_nth(p, lo, hi, mid, depth % 2);
+
+    double left = build_node(data, p, lo, mid, depth + 1);
+    double right = build_node(data, p, mid + 1, hi, depth + 1);
+
+    double importance = data->rs[p[mid].row].importance;
+    if (left > importance) importance = left;
+    if (right > importance) importance = right;
+
+    data->lon[mid] = p[mid].coord[0];
+    data->lat[mid] = p[mid].coord[1];
+    data->row[mid] = p[mid].row;
+    data->max_importance[mid] = importance;
+    return importance;
+}
+
+// Function to create the k-d tree
+// Input: Pointer to the array of records (rs), number of records (n)
+// Output: Pointer to an initialized weighted_data structure
+struct weighted_data* mk_weighted(const struct record *rs, int n) {
+    struct weighted_data *data = malloc(sizeof(struct weighted_data));
+    struct kd_point *points = bigmem_alloc((n > 0 ? n : 1) * sizeof(struct kd_point));
+    if (!data || !points) {
+        fprintf(stderr, "Error: Failed to allocate memory for weighted_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t m = n > 0 ? n : 1;
+    data->rs = rs;
+    data->n = n;
+    data->lon = bigmem_alloc(m * sizeof(double));
+    data->lat = bigmem_alloc(m * sizeof(double));
+    data->row = bigmem_alloc(m * sizeof(int));
+    data->max_importance = bigmem_alloc(m * sizeof(double));
+    data->scores = NULL;
+    data->rows = NULL;
+    data->capacity = 0;
+    if (!data->lon || !data->lat || !data->row || !data->max_importance) {
+        fprintf(stderr, "Error: Failed to allocate memory for k-d tree arrays.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+        points[i].coord[0] = rs[i].lon;
+        points[i].coord[1] = rs[i].lat;
+        points[i].row = i;
+    }
+
+    build_node(data, points, 0, n, 0);
+    bigmem_free(points);
+
+    return data;
+}
+
+// Function to free the k-d tree
+// Input: Pointer to the weighted_data structure
+void free_weighted(struct weighted_data *data) {
+    if (data) {
+        bigmem_free(data->lon);
+        bigmem_free(data->lat);
+        bigmem_free(data->row);
+        bigmem_free(data->max_importance);
+        free(data->scores);
+        free(data->rows);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the weighted_data structure
+// Input: Pointer to the weighted_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_weighted(struct weighted_data *data) {
+    size_t m = data->n > 0 ? data->n : 1;
+    return sizeof(struct weighted_data)
+        + m * (3 * sizeof(double) + sizeof(int))
+        + (size_t)data->capacity * (sizeof(double) + sizeof(int));
+}
+
+// State of a single search.
+struct search {
+    struct weighted_data *data;
+    double q[2];  // Query point
+    double alpha; // Importance exponent
+    int k;        // Number of records wanted
+    int found;    // Number of records in the top-k so far
+};
+
+// Is (score_a, row_a) ranked before (score_b, row_b)?
+static int ranks_before(double score_a, int row_a, double score_b, int row_b) {
+    return score_a < score_b || (score_a == score_b && row_a < row_b);
+}
+
+// Add a record to the sorted top-k if it ranks high enough.
+static void consider(struct search *s, int row) {
+    struct weighted_data *data = s->data;
+    double score = coord_weighted_score(&data->rs[row], s->q[0], s->q[1], s->alpha);
+
+    if (s->found == s->k &&
+        !ranks_before(score, row, data->scores[s->k - 1], data->rows[s->k - 1])) {
+        return;
+    }
+
+    int j = s->found < s->k ? s->found++ : s->k - 1;
+    while (j > 0 && ranks_before(score, row, data->scores[j - 1], data->rows[j - 1])) {
+        data->scores[j] = data->scores[j - 1];
+        data->rows[j] = data->rows[j - 1];
+        j--;
+    }
+    data->scores[j] = score;
+    data->rows[j] = row;
+}
+
+// Search the subtree for the range [lo,hi), whose points all lie in
+// the box [x0,x1]x[y0,y1].
+static void search_node(struct search *s, int lo, int hi, int depth,
+                        double x0, double x1, double y0, double y1) {
+    if (lo >= hi) return;
+
+    struct weighted_data *data = s->data;
+    int mid = lo + (hi - lo) / 2;
+
+    if (s->found == s->k) {
+        // Lower bound on the score of any record in the subtree.  A
+        // tie with the k'th best may still win on record index, so
+        // only strictly worse subtrees are skipped.
+        double bx = fmax(fmax(x0 - s->q[0], s->q[0] - x1), 0);
+        double by = fmax(fmax(y0 - s->q[1], s->q[1] - y1), 0);
+        double importance = data->max_importance[mid] > MIN_IMPORTANCE
+            ? data->max_importance[mid] : MIN_IMPORTANCE;
+        double bound = sqrt(bx * bx + by * by) / pow(importance, s->alpha);
+        if (bound > data->scores[s->k - 1]) {
+            return;
+        }
+    }
+
+    consider(s, data->row[mid]);
+
+    int axis = depth % 2;
+    double split = axis == 0 ? data->lon[mid] : data->lat[mid];
+
+    // Visit the side containing the query first, as it is the most
+    // likely to tighten the bound.
+    int near_left = s->q[axis] < split;
+    for (int side = 0; side < 2; side++) {
+        int left = side == 0 ? near_left : !near_left;
+        if (axis == 0) {
+            if (left) search_node(s, lo, mid, depth + 1, x0, split, y0, y1);
+            else      search_node(s, mid + 1, hi, depth + 1, split, x1, y0, y1);
+        } else {
+            if (left) search_node(s, lo, mid, depth + 1, x0, x1, y0, split);
+            else      search_node(s, mid + 1, hi, depth + 1, x0, x1, split, y1);
+        }
+    }
+}
+
+// Function to find the k records with the best weighted score
+// Input: Pointer to weighted_data, target longitude (lon) and latitude (lat),
+//        number of records (k), importance exponent (alpha), output array
+// Output: Number of records stored in 'out'
+int lookup_weighted(struct weighted_data *data, double lon, double lat, int k, double alpha,
+                    const struct record **out) {
+    if (k <= 0) {
+        return 0;
+    }
+
+    if (k > data->capacity) {
+        data->capacity = k;
+        data->scores = realloc(data->scores, k * sizeof(double));
+        data->rows = realloc(data->rows, k * sizeof(int));
+        if (!data->scores || !data->rows) {
+            fprintf(stderr, "Error: Failed to allocate memory for top-k arrays.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct search s = { data, { lon, lat }, alpha, k, 0 };
+    search_node(&s, 0, data->n, 0, -INFINITY, INFINITY, -INFINITY, INFINITY);
+
+    for (int i = 0; i < s.found; i++) {
+        out[i] = &data->rs[data->rows[i]];
+    }
+    return s.found;
+}
+
+// Main function to run the top-k coordinate query loop
+int main(int argc, char **argv) {
+    return coord_query_topk_loop(argc, argv,
+                                 (mk_index_fn)mk_weighted,
+                                 (free_index_fn)free_weighted,
+                                 (lookup_topk_fn)lookup_weighted,
+                                 (index_size_fn)index_size_weighted);
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "coord_query.h"
+#include "record.h"
+
+// Importance-weighted top-k search by scoring every record.  This is
+// the baseline for coord_query_weighted.c.
+
+// Structure to hold the dataset for naive querying
+struct naive_data {
+    const struct record *rs; // Pointer to the array of records
+    int n;                   // Number of records in the dataset
+    double *scores;          // Scores of the current top-k, parallel to the output array
+};
+
+// Function to create and initialize the naive_data structure
+// Input: Pointer to the array of records (rs), number of records (n)
+// Output: Pointer to an initialized naive_data structure
+struct naive_data* mk_naive(const struct record *rs, int n) {
+    struct naive_data *data = malloc(sizeof(struct naive_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for naive_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    data->rs = rs;
+    data->n = n;
+    data->scores = NULL;
+    return data;
+}
+
+// Function to free the naive_data structure
+// Input: Pointer to the naive_data structure
+void free_naive(struct naive_data *data) {
+    if (data) {
+        free(data->scores);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the naive_data structure
+// The scores are only allocated by the first query.
+// Input: Pointer to the naive_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_naive(struct naive_data *data) {
+    (void)data;
+    return sizeof(struct naive_data);
+}
+
+// Function to find the k records with the best weighted score
+// Input: Pointer to naive_data, target longitude (lon) and latitude (lat),
+//        number of records (k), importance exponent (alpha), output array
+// Output: Number of records stored in 'out'
+int lookup_naive(struct naive_data *data, double lon, double lat, int k, double alpha,
+                 const struct record **out) {
+    if (k <= 0) {
+        return 0;
+    }
+
+    data->scores = realloc(data->scores, k * sizeof(double));
+    if (!data->scores) {
+        fprintf(stderr, "Error: Failed to allocate memory for scores.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int found = 0;
+    for (int i = 0; i < data->n; i++) {
+        double score = coord_weighted_score(&data->rs[i], lon, lat, alpha);
+
+        // Records are visited in order, so a record must be strictly
+        // better to displace an earlier one.
+        if (found == k && !(score < data->scores[k - 1])) {
+            continue;
+        }
+
+        int j = found < k ? found++ : k - 1;
+        while (j > 0 && score < data->scores[j - 1]) {
+            data->scores[j] = data->scores[j - 1];
+            out[j] = out[j - 1];
+            j--;
+        }
+        data->scores[j] = score;
+        out[j] = &data->rs[i];
+    }
+
+    return found;
+}
+
+// Main function to run the top-k coordinate query loop
+int main(int argc, char **argv) {
+    return coord_query_topk_loop(argc, argv,
+                                 (mk_index_fn)mk_naive,
+                                 (free_index_fn)free_naive,
+                                 (lookup_topk_fn)lookup_naive,
+                                 (index_size_fn)index_size_naive);
+}
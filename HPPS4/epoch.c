@@ -0,0 +1,94 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+#define MAX_READERS 64
+
+// Each reader has a cache line of its own, so that readers do not slow
+// each other down.
+struct epoch_reader {
+  uint64_t epoch;         // The epoch its read started in, or 0 if idle
+  int used;
+  struct epoch_domain *domain;
+} __attribute__((aligned(64)));
+
+struct epoch_domain {
+  uint64_t epoch;         // Starts at 1, and only grows
+  pthread_mutex_t lock;   // For registering, and for synchronizing
+  struct epoch_reader readers[MAX_READERS];
+};
+
+struct epoch_domain* epoch_create(void) {
+  struct epoch_domain *d;
+  if (posix_memalign((void**)&d, 64, sizeof(struct epoch_domain)) != 0) {
+    return NULL;
+  }
+  d->epoch = 1;
+  pthread_mutex_init(&d->lock, NULL);
+  for (int i = 0; i < MAX_READERS; i++) {
+    d->readers[i].epoch = 0;
+    d->readers[i].used = 0;
+    d->readers[i].domain = d;
+  }
+  return d;
+}
+
+void epoch_free(struct epoch_domain *d) {
+  if (d) {
+    pthread_mutex_destroy(&d->lock);
+    free(d);
+  }
+}
+
+struct epoch_reader* epoch_register(struct epoch_domain *d) {
+  struct epoch_reader *r = NULL;
+  pthread_mutex_lock(&d->lock);
+  for (int i = 0; i < MAX_READERS && !r; i++) {
+    if (!d->readers[i].used) {
+      r = &d->readers[i];
+      r->used = 1;
+      __atomic_store_n(&r->epoch, 0, __ATOMIC_SEQ_CST);
+    }
+  }
+  pthread_mutex_unlock(&d->lock);
+  return r;
+}
+
+void epoch_unregister(struct epoch_reader *r) {
+  pthread_mutex_lock(&r->domain->lock);
+  r->used = 0;
+  pthread_mutex_unlock(&r->domain->lock);
+}
+
+// The store must be ordered before the reader's load of the shared
+// pointer, hence sequential consistency rather than release.
+void epoch_enter(struct epoch_reader *r) {
+  uint64_t epoch = __atomic_load_n(&r->domain->epoch, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&r->epoch, epoch, __ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(struct epoch_reader *r) {
+  __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_synchronize(struct epoch_domain *d) {
+  pthread_mutex_lock(&d->lock);
+  uint64_t next = __atomic_add_fetch(&d->epoch, 1, __ATOMIC_SEQ_CST);
+
+  // A reader in an earlier epoch may have loaded the old pointer, so
+  // wait for it to leave.  Reads are short, so poll.
+  for (int i = 0; i < MAX_READERS; i++) {
+    for (;;) {
+      uint64_t e = __atomic_load_n(&d->readers[i].epoch, __ATOMIC_SEQ_CST);
+      if (e == 0 || e >= next) {
+        break;
+      }
+      struct timespec pause = { 0, 100000 };
+      nanosleep(&pause, NULL);
+    }
+  }
+  pthread_mutex_unlock(&d->lock);
+}
@@ -0,0 +1,48 @@
+// Epoch-based reclamation, for data that threads read while another
+// thread replaces it, in the style of RCU.
+//
+// Readers bracket each use of the shared data with epoch_enter() and
+// epoch_exit(), which only write to their own cache line, so reading
+// stays as cheap as it was without any sharing.  A writer publishes a
+// new version with an atomic store, then calls epoch_synchronize(),
+// which waits until every reader that might still be using the old
+// version has left, after which the old version can be freed.
+//
+//   Reader:                          Writer:
+//     epoch_enter(reader);             old = swap(&shared, new);
+//     p = load(&shared);               epoch_synchronize(domain);
+//     ...use p...                      free(old);
+//     epoch_exit(reader);
+//
+// The loads and stores of the shared pointer must be atomic, as with
+// __atomic_load_n() and __atomic_exchange_n().
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+struct epoch_domain;
+struct epoch_reader;
+
+// Create a domain, with no readers.  Returns NULL on failure.
+struct epoch_domain* epoch_create(void);
+
+// Free a domain.  All its readers must have been unregistered.
+void epoch_free(struct epoch_domain *d);
+
+// Register a reader thread with the domain.  Returns NULL if there are
+// too many readers already.
+struct epoch_reader* epoch_register(struct epoch_domain *d);
+
+// Unregister a reader, which must not be inside a read.
+void epoch_unregister(struct epoch_reader *r);
+
+// Start and end a read of the shared data.  Reads do not nest.
+void epoch_enter(struct epoch_reader *r);
+void epoch_exit(struct epoch_reader *r);
+
+// Wait until every read that had started when this was called has
+// ended.  Reads that start later see whatever was published before the
+// call, so they do not delay it.
+void epoch_synchronize(struct epoch_domain *d);
+
+#endif
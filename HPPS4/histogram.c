@@ -0,0 +1,94 @@
+#include <stdlib.h>
+
+#include "histogram.h"
+
+// Values below 2*SUB_BUCKETS get a bucket each.  Above that, every
+// power-of-two range [2^e, 2^(e+1)) is split into SUB_BUCKETS buckets
+// of equal width.
+#define SUB_BITS 6
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS (2*SUB_BUCKETS + (64-SUB_BITS-1)*SUB_BUCKETS)
+
+struct histogram {
+  uint64_t count;
+  uint64_t max;
+  uint64_t buckets[NUM_BUCKETS];
+};
+
+static int bucket_of(uint64_t value) {
+  if (value < 2*SUB_BUCKETS) {
+    return (int)value;
+  }
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - SUB_BITS;
+  // value >> shift is in [SUB_BUCKETS, 2*SUB_BUCKETS).
+  return 2*SUB_BUCKETS + (shift-1)*SUB_BUCKETS + (int)((value >> shift) - SUB_BUCKETS);
+}
+
+// Largest value that falls in a bucket.
+static uint64_t bucket_end(int bucket) {
+  if (bucket < 2*SUB_BUCKETS) {
+    return bucket;
+  }
+  int shift = (bucket - 2*SUB_BUCKETS) / SUB_BUCKETS + 1;
+  uint64_t sub = (bucket - 2*SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+  return ((sub+1) << shift) - 1;
+}
+
+struct histogram* histogram_create(void) {
+  return calloc(1, sizeof(struct histogram));
+}
+
+void histogram_free(struct histogram *h) {
+  free(h);
+}
+
+void histogram_record(struct histogram *h, uint64_t value) {
+  h->buckets[bucket_of(value)]++;
+  h->count++;
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+uint64_t histogram_count(const struct histogram *h) {
+  return h->count;
+}
+
+uint64_t histogram_percentile(const struct histogram *h, double percentile) {
+  if (h->count == 0) {
+    return 0;
+  }
+
+  // The rank of the wanted value, counting from 1.
+  uint64_t rank = (uint64_t)(percentile / 100 * h->count + 0.5);
+  if (rank < 1) {
+    rank = 1;
+  }
+  if (rank > h->count) {
+    rank = h->count;
+  }
+
+  uint64_t seen = 0;
+  for (int b = 0; b < NUM_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen >= rank) {
+      uint64_t end = bucket_end(b);
+      return end < h->max ? end : h->max;
+    }
+  }
+  return h->max;
+}
+
+uint64_t histogram_max(const struct histogram *h) {
+  return h->max;
+}
+
+void histogram_print(const struct histogram *h, FILE *f, const char *label) {
+  fprintf(f, "%s: p50 %luns, p90 %luns, p99 %luns, p99.9 %luns, max %luns\n", label,
+          (unsigned long)histogram_percentile(h, 50),
+          (unsigned long)histogram_percentile(h, 90),
+          (unsigned long)histogram_percentile(h, 99),
+          (unsigned long)histogram_percentile(h, 99.9),
+          (unsigned long)histogram_max(h));
+}
@@ -0,0 +1,42 @@
+// A latency histogram in the style of HdrHistogram.  Values are
+// counted in buckets whose width grows with the value, so that every
+// recorded value is known to within 1/64 of itself (about 1.6%), while
+// the whole range of 64-bit values fits in a few thousand counters.
+// Recording a value is constant time and allocation free, so it can
+// be done for every query.
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// An opaque struct representing a histogram.
+struct histogram;
+
+// Create an empty histogram.  Returns NULL if out of memory.
+struct histogram* histogram_create(void);
+
+void histogram_free(struct histogram *h);
+
+// Record one value.
+void histogram_record(struct histogram *h, uint64_t value);
+
+// Number of values recorded.
+uint64_t histogram_count(const struct histogram *h);
+
+// The value below or at which the given percentage (0 to 100) of the
+// recorded values lie, rounded up to the end of its bucket but never
+// above the largest recorded value.  Returns 0 for an empty histogram.
+uint64_t histogram_percentile(const struct histogram *h, double percentile);
+
+// Largest value recorded.
+uint64_t histogram_max(const struct histogram *h);
+
+// Print the usual percentiles on one line, with 'label' in front and
+// the values in nanoseconds, as in
+//
+//   Query latency: p50 812ns, p90 1503ns, p99 4095ns, p99.9 9087ns, max 15204ns
+void histogram_print(const struct histogram *h, FILE *f, const char *label);
+
+#endif
@@ -1,63 +1,227 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "id_query.h"
 #include "timing.h"
+#include "histogram.h"
+#include "outbuf.h"
+#include "query_server.h"
+#include "perf_counters.h"
+#include "mem_stats.h"
+#include "build_pipeline.h"
+#include "live_index.h"
+#include "trace.h"
 
-int id_query_loop(int argc, char** argv, mk_index_fn mk_index, free_index_fn free_index, lookup_fn lookup) {
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s FILE\n", argv[0]);
-    exit(1);
+// What the query loop and the server need.
+struct id_loop {
+  struct live_index *live;
+  lookup_fn lookup;
+};
+
+static int answer_request(void *arg, const struct query_request *req, const struct record **r) {
+  struct id_loop *loop = arg;
+  if (req->type != QUERY_ID) {
+    return QUERY_BAD_REQUEST;
   }
 
-  uint64_t start, runtime;
-  int n;
+  // Stay in the read until the server has copied out the records.
+  struct generation *g = live_index_enter(loop->live);
+  *r = loop->lookup(g->index, req->id);
+  return *r ? QUERY_FOUND : QUERY_NOT_FOUND;
+}
 
-  start = microseconds();
-  struct record *rs = read_records(argv[1], &n);
-  runtime = microseconds()-start;
+static void release_records(void *arg) {
+  struct id_loop *loop = arg;
+  live_index_exit(loop->live);
+}
+
+// SIGHUP makes the server reload the file it was started with.
+static void reload_same_file(void *arg) {
+  struct id_loop *loop = arg;
+  live_index_reload(loop->live, NULL);
+}
+
+// Parse "[-q] ARG" or "--serve SOCKET ARG", and return ARG.
+static const char* parse_args(int argc, char** argv, const char *arg,
+                              int *quiet, const char **socket_path) {
+  *quiet = argc == 3 && strcmp(argv[1], "-q") == 0;
+  *socket_path = argc == 4 && strcmp(argv[1], "--serve") == 0 ? argv[2] : NULL;
+  if (argc != 2 && !*quiet && !*socket_path) {
+    fprintf(stderr, "Usage: %s [-q] %s\n       %s --serve SOCKET %s\n",
+            argv[0], arg, argv[0], arg);
+    exit(1);
+  }
+  return argv[argc-1];
+}
 
-  if (rs) {
-    printf("Reading records: %dms\n", (int)runtime/1000);
+// Answer queries with the index, from stdin or over the socket, and
+// print the measurements.  A line "reload" on stdin, or "reload FILE",
+// reloads the records in the background, as SIGHUP does for the
+// server.  Returns the exit status.
+static int run_queries(struct id_loop *loop, int quiet, const char *socket_path,
+                       struct perf_counters *counters) {
+  if (socket_path) {
+    struct query_service service = { answer_request, release_records, reload_same_file, loop };
+    return query_server_serve(socket_path, &service);
+  }
 
-    start = microseconds();
-    void *index = mk_index(rs, n);
-    runtime = microseconds()-start;
-    printf("Building index: %dms\n", (int)runtime/1000);
+  uint64_t start, runtime;
+  struct perf_sample before, after, counts;
+  char *line = NULL;
+  size_t line_len;
+  struct histogram *latency = histogram_create();
+  if (!latency) {
+    fprintf(stderr, "Error: Failed to allocate memory for latency histogram.\n");
+    exit(EXIT_FAILURE);
+  }
 
-    char *line = NULL;
-    size_t line_len;
+  // Results go through a buffer of our own, which must not be
+  // interleaved with the output still buffered by stdio.
+  fflush(stdout);
+  struct outbuf *out = outbuf_create(STDOUT_FILENO);
 
-    uint64_t runtime_sum = 0;
-    while (getline(&line, &line_len, stdin) != -1) {
-      int64_t needle = atol(line);
+  uint64_t runtime_sum = 0;
+  memset(&counts, 0, sizeof(counts));
+  while (getline(&line, &line_len, stdin) != -1) {
+    if (live_index_reload_line(loop->live, line)) {
+      continue;
+    }
+    int64_t needle = atol(line);
 
-      start = microseconds();
-      const struct record *r = lookup(index, needle);
-      runtime = microseconds()-start;
+    struct generation *g = live_index_enter(loop->live);
+    TRACE_BEGIN("lookup");
+    perf_counters_read(counters, &before);
+    start = nanoseconds();
+    const struct record *r = loop->lookup(g->index, needle);
+    runtime = nanoseconds()-start;
+    perf_counters_read(counters, &after);
+    TRACE_END();
+    perf_sample_accumulate(&counts, &before, &after);
+    histogram_record(latency, runtime);
 
+    if (!quiet) {
+      outbuf_long(out, (long)needle);
       if (r) {
-        printf("%ld: %s %f %f\n", (long)needle, r->name, r->lon, r->lat);
+        outbuf_str(out, ": ");
+        outbuf_str(out, record_name(r));
+        outbuf_char(out, ' ');
+        outbuf_double(out, r->lon);
+        outbuf_char(out, ' ');
+        outbuf_double(out, r->lat);
+        outbuf_char(out, '\n');
       } else {
-        printf("%ld: not found\n", (long)needle);
+        outbuf_str(out, ": not found\n");
       }
-
-      printf("Query time: %dus\n", (int)runtime);
-      runtime_sum += runtime;
+      outbuf_str(out, "Query time: ");
+      outbuf_long(out, (int)(runtime/1000));
+      outbuf_str(out, "us\n");
     }
+    live_index_exit(loop->live);
+    runtime_sum += runtime;
+  }
+  outbuf_free(out);
 
-    printf("Total query runtime: %dus\n", (int)runtime_sum);
+  printf("Total query runtime: %dus\n", (int)(runtime_sum/1000));
+  histogram_print(latency, stdout, "Query latency");
+  perf_counters_print(counters, stdout, "query", &counts, 1);
+  perf_counters_print(counters, stdout, "per query", &counts, histogram_count(latency));
 
-    free(line);
-    free_index(index);
-    free_records(rs, n);
-    return 0;
-  } else {
+  histogram_free(latency);
+  free(line);
+  return 0;
+}
+
+// Run the queries on the generation 'g', loaded from 'file', and free
+// whichever generation is current at the end.
+static int serve_generation(struct generation *g, const char *file,
+                            const struct index_source *source, lookup_fn lookup,
+                            int quiet, const char *socket_path,
+                            struct perf_counters *counters) {
+  struct id_loop loop = { live_index_create(g, file, source), lookup };
+  int ret = run_queries(&loop, quiet, socket_path, counters);
+  live_index_free(loop.live);
+  return ret;
+}
+
+static int load_and_run(int argc, char** argv, mk_index_fn mk_index,
+                        const struct index_builder *builder, free_index_fn free_index,
+                        lookup_fn lookup, index_size_fn index_size) {
+  int quiet;
+  const char *socket_path;
+  const char *file = parse_args(argc, argv, "FILE", &quiet, &socket_path);
+
+  struct index_source source = { mk_index, builder, free_index };
+  struct perf_counters *counters = perf_counters_open();
+  struct generation *g = load_generation(file, &source, index_size, counters, 1);
+  if (!g) {
     fprintf(stderr, "Failed to read input from %s (errno: %s)\n",
-            argv[1], strerror(errno));
+            file, strerror(errno));
+    perf_counters_close(counters);
     return 1;
   }
+
+  int ret = serve_generation(g, file, &source, lookup, quiet, socket_path, counters);
+  perf_counters_close(counters);
+  return ret;
+}
+
+int id_query_loop(int argc, char** argv, mk_index_fn mk_index, free_index_fn free_index,
+                  lookup_fn lookup, index_size_fn index_size) {
+  return load_and_run(argc, argv, mk_index, NULL, free_index, lookup, index_size);
+}
+
+int id_query_stream_loop(int argc, char** argv, const struct index_builder *builder,
+                         free_index_fn free_index, lookup_fn lookup, index_size_fn index_size) {
+  return load_and_run(argc, argv, NULL, builder, free_index, lookup, index_size);
+}
+
+int id_query_attach_loop(int argc, char** argv, attach_index_fn attach_index,
+                         free_index_fn free_index, lookup_fn lookup, index_size_fn index_size) {
+  int quiet;
+  const char *socket_path;
+  const char *name = parse_args(argc, argv, "NAME", &quiet, &socket_path);
+
+  uint64_t start, runtime;
+  struct perf_counters *counters = perf_counters_open();
+  struct perf_sample before, after, counts;
+  struct generation *g = malloc(sizeof(struct generation));
+  if (!g) {
+    fprintf(stderr, "Error: Failed to allocate memory for generation.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  perf_counters_read(counters, &before);
+  start = microseconds();
+  g->index = attach_index(name, &g->n);
+  runtime = microseconds()-start;
+  perf_counters_read(counters, &after);
+
+  if (!g->index) {
+    fprintf(stderr, "Failed to attach %s (errno: %s)\n", name, strerror(errno));
+    free(g);
+    perf_counters_close(counters);
+    return 1;
+  }
+  g->rs = NULL;
+  g->number = 1;
+
+  printf("Attaching index: %dms\n", (int)runtime/1000);
+  memset(&counts, 0, sizeof(counts));
+  perf_sample_accumulate(&counts, &before, &after);
+  perf_counters_print(counters, stdout, "attach", &counts, 1);
+  if (index_size) {
+    print_index_size(index_size(g->index), g->n);
+  }
+  print_peak_rss("attach", g->n);
+
+  // An attached index is not ours to rebuild.
+  struct index_source source = { NULL, NULL, free_index };
+  int ret = serve_generation(g, name, &source, lookup, quiet, socket_path, counters);
+  perf_counters_close(counters);
+  return ret;
 }
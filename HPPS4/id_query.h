@@ -20,6 +20,7 @@
 #define ID_QUERY_LOOP_H
 
 #include "record.h"
+#include "build_pipeline.h"
 
 // A pointer to a function that produces an index, when called with an
 // array of records and the size of the array.
@@ -31,8 +32,49 @@ typedef void (*free_index_fn)(void*);
 // Look up an ID in an index produced by mk_index_fn.
 typedef const struct record* (*lookup_fn)(void*, int64_t);
 
+// The number of bytes allocated for an index produced by mk_index_fn,
+// not counting the records themselves.
+typedef size_t (*index_size_fn)(void*);
+
 // Run a query loop, using the provided functions for managing the
-// index.
-int id_query_loop(int argc, char** argv, mk_index_fn, free_index_fn, lookup_fn);
+// index.  The program is run as "PROGRAM [-q] FILE".  Each query is
+// timed, and a histogram of the latencies is printed at the end; with
+// -q, the per-query output is skipped, so that printing does not
+// distort the measurements.  Run as "PROGRAM --serve SOCKET FILE",
+// the program instead answers requests over a Unix domain socket until
+// it is stopped; see query_server.h.  If the environment variable
+// PERF_COUNTERS is set, hardware counters for each phase are printed
+// as well; see perf_counters.h.
+//
+// A line "reload" among the queries, or "reload FILE", reads the file
+// again, or another one, and builds a new index in the background,
+// while queries go on being answered with the old one.  The new index
+// then replaces the old one, which is freed once no query uses it.
+// SIGHUP does the same for a server.  See live_index.h.
+//
+// The peak resident set size is printed after reading the records and
+// after building the index.  The index_size_fn is optional: if it is
+// not NULL, the size of the index is printed as well.
+int id_query_loop(int argc, char** argv, mk_index_fn, free_index_fn, lookup_fn, index_size_fn);
+
+// Like id_query_loop(), but the index is built by the index_builder
+// while the records are being read; see build_pipeline.h.  The build
+// time printed is the time spent waiting for the index after reading.
+int id_query_stream_loop(int argc, char** argv, const struct index_builder*, free_index_fn,
+                         lookup_fn, index_size_fn);
+
+// A pointer to a function that attaches an index that already exists
+// outside the process, such as one in shared memory, given its name.
+// Sets the int to the number of records, and returns NULL with errno
+// set on failure.
+typedef void* (*attach_index_fn)(const char*, int*);
+
+// Like id_query_loop(), but the program is run as "PROGRAM [-q] NAME"
+// or "PROGRAM --serve SOCKET NAME", and instead of reading records and
+// building an index, it attaches the index NAME, which cannot be
+// reloaded.  The free_index_fn is given the attached index when the
+// loop ends.
+int id_query_attach_loop(int argc, char** argv, attach_index_fn, free_index_fn, lookup_fn,
+                         index_size_fn);
 
 #endif
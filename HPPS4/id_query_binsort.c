@@ -7,6 +7,8 @@
 
 #include "record.h"
 #include "id_query.h"
+#include "bigmem.h"
+#include "trace.h"
 
 //the functions in this program are mostly based on the functions in id_query_indexed.c.
 //chatgbt was used to develop,verify syntax, and for handling errors
@@ -18,79 +20,201 @@ struct index_record {
     const struct record *record; // Pointer to the actual record
 };
 
+// The most sorted runs there can be at once while building.  Each run
+// is more than twice as long as the one after it, so this is enough
+// for any number of records.
+#define MAX_RUNS 64
+
 // Structure to hold the sorted index
 struct binsort_data {
     struct index_record *irs; // Array of sorted index records
     int n;                    // Number of records
+    int capacity;             // Number of index records allocated
+    struct index_record *scratch; // Buffer for merging runs, while building
+    int scratch_capacity;     // Number of index records in the buffer
+    int runs[MAX_RUNS];       // Start of each sorted run, while building
+    int nruns;                // Number of sorted runs
 };
 
-// Comparison function for qsort
+// Comparison function for qsort.  Records with the same ID are
+// ordered by their position in the file, as the records are in one
+// array, so that the sort does not need to be stable.
 // Input: Two pointers to index_record structures
 // Output: Comparison result for sorting
 int compare_index_record(const void *a, const void *b) {
-    int64_t id1 = ((struct index_record *)a)->osm_id;
-    int64_t id2 = ((struct index_record *)b)->osm_id;
-    return (id1 > id2) - (id1 < id2); // Returns -1, 0, or 1
+    const struct index_record *x = a;
+    const struct index_record *y = b;
+    if (x->osm_id != y->osm_id) {
+        return (x->osm_id > y->osm_id) - (x->osm_id < y->osm_id); // Returns -1 or 1
+    }
+    return (x->record > y->record) - (x->record < y->record);
 }
 
-// Function to create and sort the index
-// Input: Array of records (rs) and number of records (n)
+// Function to get the number of records in a sorted run
+// Input: Pointer to binsort_data structure, number of the run (k)
+// Output: Length of the run
+static int run_length(struct binsort_data *data, int k) {
+    return (k+1 < data->nruns ? data->runs[k+1] : data->n) - data->runs[k];
+}
+
+// Function to merge the last two sorted runs into one.  The left run
+// holds the earlier records, so taking from it on equal IDs keeps
+// records with the same ID in file order.
+// Input: Pointer to binsort_data structure
+static void merge_last_runs(struct binsort_data *data) {
+    int left = run_length(data, data->nruns-2);
+    struct index_record *out = data->irs + data->runs[data->nruns-2];
+    struct index_record *b = out + left;
+    struct index_record *b_end = data->irs + data->n;
+
+    // Move the left run aside, so the merged run can overwrite it
+    if (left > data->scratch_capacity) {
+        bigmem_free(data->scratch);
+        data->scratch = bigmem_alloc(left * sizeof(struct index_record));
+        if (!data->scratch) {
+            fprintf(stderr, "Error: Failed to allocate memory for merging runs.\n");
+            exit(EXIT_FAILURE);
+        }
+        data->scratch_capacity = left;
+    }
+    memcpy(data->scratch, out, left * sizeof(struct index_record));
+    struct index_record *a = data->scratch;
+    struct index_record *a_end = a + left;
+    TRACE_BEGIN("merge runs");
+
+    while (a < a_end && b < b_end) {
+        *out++ = b->osm_id < a->osm_id ? *b++ : *a++;
+    }
+    memcpy(out, a, (a_end - a) * sizeof(struct index_record));
+    TRACE_END();
+    data->nruns--;
+}
+
+// Function to create an empty index, for adding records to in batches
 // Output: Pointer to binsort_data structure
-struct binsort_data* mk_binsort(const struct record* rs, int n) {
-    struct binsort_data* data = malloc(sizeof(struct binsort_data));
+struct binsort_data* begin_binsort(void) {
+    struct binsort_data* data = calloc(1, sizeof(struct binsort_data));
     if (!data) {
         fprintf(stderr, "Error: Failed to allocate memory for binsort_data.\n");
         exit(EXIT_FAILURE);
     }
+    return data;
+}
 
-    // Allocate memory for index records
-    data->irs = malloc(n * sizeof(struct index_record));
-    if (!data->irs) {
-        fprintf(stderr, "Error: Failed to allocate memory for index_record array.\n");
-        free(data);
-        exit(EXIT_FAILURE);
+// Function to add a batch of records.  The batch is sorted as a run of
+// its own, and runs of similar length are merged as they build up, so
+// most of the sorting is done while the rest of the records are read.
+// Input: Pointer to binsort_data structure, array of records (rs),
+//        first and one past the last record to add (from, to)
+void add_binsort(struct binsort_data *data, const struct record *rs, int from, int to) {
+    int count = to - from;
+    if (data->n + count > data->capacity) {
+        int capacity = 2 * data->capacity > data->n + count ? 2 * data->capacity : data->n + count;
+        data->irs = bigmem_realloc(data->irs, capacity * sizeof(struct index_record));
+        if (!data->irs) {
+            fprintf(stderr, "Error: Failed to allocate memory for index_record array.\n");
+            exit(EXIT_FAILURE);
+        }
+        data->capacity = capacity;
     }
 
     // Populate the index with IDs and corresponding record pointers
-    for (int i = 0; i < n; i++) {
-        data->irs[i].osm_id = rs[i].osm_id;
-        data->irs[i].record = &rs[i];
+    struct index_record *run = data->irs + data->n;
+    for (int i = 0; i < count; i++) {
+        run[i].osm_id = rs[from+i].osm_id;
+        run[i].record = &rs[from+i];
     }
 
-    // Sort the index array using qsort
-    qsort(data->irs, n, sizeof(struct index_record), compare_index_record);
-    data->n = n;
+    // Sort the batch using qsort
+    TRACE_BEGIN("sort run");
+    qsort(run, count, sizeof(struct index_record), compare_index_record);
+    TRACE_END();
+    data->runs[data->nruns++] = data->n;
+    data->n += count;
 
+    while (data->nruns >= 2 &&
+           2 * run_length(data, data->nruns-1) >= run_length(data, data->nruns-2)) {
+        merge_last_runs(data);
+    }
+}
+
+// Function to merge the remaining runs once all records are added
+// Input: Pointer to binsort_data structure
+void finish_binsort(struct binsort_data *data) {
+    while (data->nruns >= 2) {
+        merge_last_runs(data);
+    }
+    bigmem_free(data->scratch);
+    data->scratch = NULL;
+    data->scratch_capacity = 0;
+
+    // Give back the room left from growing the array
+    if (data->n > 0 && data->n < data->capacity) {
+        struct index_record *irs = bigmem_realloc(data->irs, data->n * sizeof(struct index_record));
+        if (irs) {
+            data->irs = irs;
+            data->capacity = data->n;
+        }
+    }
+}
+
+// Function to create and sort the index
+// Input: Array of records (rs) and number of records (n)
+// Output: Pointer to binsort_data structure
+struct binsort_data* mk_binsort(const struct record* rs, int n) {
+    struct binsort_data* data = begin_binsort();
+    add_binsort(data, rs, 0, n);
+    finish_binsort(data);
     return data;
 }
 
 // Function to free the binsort_data structure
 void free_binsort(struct binsort_data* data) {
     if (data) {
-        free(data->irs); // Free the sorted index array
+        bigmem_free(data->irs); // Free the sorted index array
+        bigmem_free(data->scratch); // Free the merge buffer, if still building
         free(data);      // Free the binsort_data structure
     }
 }
 
-// Perform a binary search to find a record by ID
+// Function to report the bytes allocated for the binsort_data structure
+// Input: Pointer to the binsort_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_binsort(struct binsort_data* data) {
+    return sizeof(struct binsort_data) + (size_t)data->capacity * sizeof(struct index_record);
+}
+
+// Perform a binary search to find a record by ID.  With duplicate IDs,
+// the first in the file is found, as with id_query_naive.c.
 // Input: Pointer to binsort_data structure, ID to search for (needle)
 // Output: Pointer to the matching record, or NULL if not found
 const struct record* lookup_binsort(struct binsort_data *data, int64_t needle) {
-    struct index_record key = { .osm_id = needle, .record = NULL };
-
-    // Perform binary search on the sorted index
-    struct index_record *result = bsearch(&key, data->irs, data->n,
-                                          sizeof(struct index_record), compare_index_record);
-    if (result) {
-        return result->record; // Return the matching record
+    // Find the first index record with an ID of at least needle
+    int lo = 0, hi = data->n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (data->irs[mid].osm_id < needle) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < data->n && data->irs[lo].osm_id == needle) {
+        return data->irs[lo].record; // Return the matching record
     }
     return NULL; // Return NULL if no match is found
 }
 
-// Main function to run the query loop with the sorted index
+// Main function to run the query loop with the sorted index, which is
+// built while the records are read
 int main(int argc, char** argv) {
-    return id_query_loop(argc, argv,
-                        (mk_index_fn)mk_binsort,    // Create sorted index
-                        (free_index_fn)free_binsort, // Free index
-                        (lookup_fn)lookup_binsort); // Lookup function
+    struct index_builder builder = {
+        (begin_index_fn)begin_binsort,   // Create empty index
+        (add_records_fn)add_binsort,     // Add a batch of records
+        (finish_index_fn)finish_binsort  // Merge the sorted runs
+    };
+    return id_query_stream_loop(argc, argv, &builder,
+                                (free_index_fn)free_binsort, // Free index
+                                (lookup_fn)lookup_binsort, // Lookup function
+                                (index_size_fn)index_size_binsort); // Index size
 }
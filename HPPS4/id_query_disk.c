@@ -0,0 +1,509 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "record.h"
+#include "id_query.h"
+#include "bigmem.h"
+
+// Answers id queries without holding the records in memory, for hosts
+// where they do not fit:
+//
+//   MEMORY_BUDGET=256M ./id_query_disk planet-latest_geonames.tsv < ids.txt
+//
+// Only a sorted index of (osm_id, position of the line in the file)
+// is kept, at 16 bytes per record.  A lookup searches the index, and
+// reads and parses just the line of the record it finds, with a single
+// pread() unless the line is very long.  Recently used records are
+// kept in an LRU cache, so hot records cost no I/O.
+//
+// The index is saved next to the dataset, as FILE.idx, the first time
+// it is built, and later runs map that file instead of scanning the
+// dataset again, as long as the dataset has not changed since.
+// Building it takes about twice its final size in memory, for sorting.
+//
+// MEMORY_BUDGET (bytes, with an optional K, M or G suffix; 64M by
+// default) bounds the index and the cache together: the cache gets
+// whatever the index leaves over, if anything.  The record of the
+// last lookup is always kept, even if it does not fit.
+
+#define DEFAULT_BUDGET ((size_t)64 << 20)
+
+#define INDEX_MAGIC "HPPSIX01"
+
+// The length of a line is kept in the low bits of its position, and
+// its offset in the rest.  Longer lines are read in several pieces.
+#define LENGTH_BITS 16
+#define MAX_LENGTH ((1 << LENGTH_BITS) - 1)
+
+// Structure to store an index entry: an ID and where its line is
+struct disk_entry {
+    int64_t osm_id; // Record ID
+    uint64_t pos;   // Offset of the line << LENGTH_BITS | its length
+};
+
+// Header of the saved index file, which is followed by the entries
+struct index_header {
+    char magic[8];
+    uint64_t size;       // Size of the dataset when the index was built
+    int64_t mtime_sec;   // Modification time of the dataset then
+    int64_t mtime_nsec;
+    uint64_t n;          // Number of entries
+};
+
+// Structure to store a cached record
+struct cache_entry {
+    int slot;                      // Position of the entry in the index
+    struct record r;               // The record, pointing into 'line'
+    char *line;                    // The line read from the file
+    size_t bytes;                  // Memory used by this entry
+    struct cache_entry *older;     // Next entry in LRU order
+    struct cache_entry *newer;     // Previous entry in LRU order
+    struct cache_entry *next;      // Next entry in the same hash bucket
+};
+
+// Structure to hold the index and the cache
+struct disk_data {
+    int fd;                          // The dataset
+    const struct disk_entry *entries; // Sorted by ID, then position
+    int n;                           // Number of entries
+    struct disk_entry *owned;        // The entries, if built by us
+    void *mapped;                    // The saved index, if mapped
+    size_t mapped_len;               // Length of the mapping
+    size_t budget;                   // Bytes the cache may use
+    size_t cached;                   // Bytes the cache uses
+    struct cache_entry **buckets;    // Hash table of cached entries
+    size_t nbuckets;                 // Number of buckets, a power of 2
+    struct cache_entry *newest;      // Most recently used entry
+    struct cache_entry *oldest;      // Least recently used entry
+    uint64_t hits;                   // Lookups answered by the cache
+    uint64_t misses;                 // Lookups that read the file
+    uint64_t reads;                  // pread() calls made
+};
+
+// Function to parse a size such as "512M"
+// Input: String to parse, value to use if it is NULL or invalid
+// Output: Number of bytes
+static size_t parse_size(const char *s, size_t fallback) {
+    if (!s) {
+        return fallback;
+    }
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s) {
+        return fallback;
+    }
+    switch (*end) {
+    case 'G': case 'g': v <<= 10; // fall through
+    case 'M': case 'm': v <<= 10; // fall through
+    case 'K': case 'k': v <<= 10;
+    }
+    return v;
+}
+
+// Comparison function for qsort.  Records with the same ID stay in
+// their order in the file, so that a lookup finds the first, as a scan
+// would.
+// Input: Two pointers to disk_entry structures
+// Output: Comparison result for sorting
+static int compare_disk_entry(const void *a, const void *b) {
+    const struct disk_entry *x = a;
+    const struct disk_entry *y = b;
+    if (x->osm_id != y->osm_id) {
+        return (x->osm_id > y->osm_id) - (x->osm_id < y->osm_id);
+    }
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+// Function to scan the dataset for the ID and position of every line
+// Input: Name of the dataset, pointer to the number of entries (n)
+// Output: Sorted array of entries, or NULL with errno set
+static struct disk_entry* scan_dataset(const char *filename, int *n) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        return NULL;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t len = getline(&line, &line_size, f);
+    if (len == -1 || !record_is_header(line, len)) {
+        free(line);
+        fclose(f);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int capacity = 1 << 16;
+    int count = 0;
+    struct disk_entry *entries = bigmem_alloc(capacity * sizeof(struct disk_entry));
+    uint64_t offset = len;
+    while (entries && (len = getline(&line, &line_size, f)) != -1) {
+        uint64_t start = offset;
+        offset += len;
+        if (line[len-1] == '\n') {
+            len--;
+        }
+        if (len == 0) {
+            continue;
+        }
+
+        // The ID is the fourth field.
+        const char *p = line;
+        for (int field = 0; field < 3 && p; field++) {
+            p = memchr(p, '\t', len - (p - line));
+            p = p ? p+1 : NULL;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            entries = bigmem_realloc(entries, capacity * sizeof(struct disk_entry));
+            if (!entries) {
+                break;
+            }
+        }
+        entries[count].osm_id = p ? atol(p) : 0;
+        entries[count].pos = start << LENGTH_BITS | (len < MAX_LENGTH ? len : MAX_LENGTH);
+        count++;
+    }
+    free(line);
+    fclose(f);
+    if (!entries) {
+        fprintf(stderr, "Error: Failed to allocate memory for the disk index.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    qsort(entries, count, sizeof(struct disk_entry), compare_disk_entry);
+    *n = count;
+    return entries;
+}
+
+// Function to map the saved index, if it is there and up to date
+// Input: Pointer to disk_data structure, path of the index, the
+//        dataset's status
+// Output: 1 if the index was mapped, otherwise 0
+static int map_saved_index(struct disk_data *data, const char *path, const struct stat *st) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat ist;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &ist) == 0 && (size_t)ist.st_size >= sizeof(struct index_header)) {
+        p = mmap(NULL, ist.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+
+    const struct index_header *h = p;
+    if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+        h->size != (uint64_t)st->st_size ||
+        h->mtime_sec != (int64_t)st->st_mtim.tv_sec ||
+        h->mtime_nsec != (int64_t)st->st_mtim.tv_nsec ||
+        h->n > INT_MAX ||
+        h->n > (ist.st_size - sizeof(struct index_header)) / sizeof(struct disk_entry)) {
+        munmap(p, ist.st_size);
+        return 0;
+    }
+
+    data->mapped = p;
+    data->mapped_len = ist.st_size;
+    data->entries = (const struct disk_entry*)(h + 1);
+    data->n = h->n;
+    return 1;
+}
+
+// Function to save the index next to the dataset.  Failing to save it
+// only means that the next run scans the dataset again.
+// Input: Pointer to disk_data structure, path of the index, the
+//        dataset's status
+static void save_index(const struct disk_data *data, const char *path, const struct stat *st) {
+    char *tmp;
+    if (asprintf(&tmp, "%s.%ld", path, (long)getpid()) < 0) {
+        return;
+    }
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        free(tmp);
+        return;
+    }
+
+    struct index_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.size = st->st_size;
+    h.mtime_sec = st->st_mtim.tv_sec;
+    h.mtime_nsec = st->st_mtim.tv_nsec;
+    h.n = data->n;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(data->entries, sizeof(struct disk_entry), data->n, f) == (size_t)data->n;
+    ok = fclose(f) == 0 && ok;
+
+    // Only a complete index appears under its name.
+    if (!ok || rename(tmp, path) != 0) {
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+// Function to open the dataset and load or build its index
+// Input: Name of the dataset, pointer to the number of records (n)
+// Output: Pointer to disk_data structure, or NULL with errno set
+struct disk_data* open_disk(const char *filename, int *n) {
+    struct disk_data *data = calloc(1, sizeof(struct disk_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for disk_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    data->fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (data->fd < 0 || fstat(data->fd, &st) != 0) {
+        int saved = errno;
+        if (data->fd >= 0) {
+            close(data->fd);
+        }
+        free(data);
+        errno = saved;
+        return NULL;
+    }
+
+    char *path;
+    if (asprintf(&path, "%s.idx", filename) < 0) {
+        fprintf(stderr, "Error: Failed to allocate memory for the index path.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!map_saved_index(data, path, &st)) {
+        data->owned = scan_dataset(filename, &data->n);
+        if (!data->owned) {
+            int saved = errno;
+            close(data->fd);
+            free(path);
+            free(data);
+            errno = saved;
+            return NULL;
+        }
+        data->entries = data->owned;
+        save_index(data, path, &st);
+    }
+    free(path);
+
+    // The cache gets what is left of the budget after the index.
+    size_t budget = parse_size(getenv("MEMORY_BUDGET"), DEFAULT_BUDGET);
+    size_t index_bytes = (size_t)data->n * sizeof(struct disk_entry);
+    data->budget = budget > index_bytes ? budget - index_bytes : 0;
+    if (budget < index_bytes) {
+        fprintf(stderr, "Warning: The index takes %zu bytes, more than the memory budget.\n",
+                index_bytes);
+    }
+
+    // About one bucket for every entry that fits, assuming lines of a
+    // few hundred bytes.
+    data->nbuckets = 64;
+    while (data->nbuckets * 512 < data->budget) {
+        data->nbuckets *= 2;
+    }
+    data->buckets = calloc(data->nbuckets, sizeof(struct cache_entry*));
+    if (!data->buckets) {
+        fprintf(stderr, "Error: Failed to allocate memory for the record cache.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *n = data->n;
+    return data;
+}
+
+// Function to find a slot in the cache's hash table
+// Input: Pointer to disk_data structure, position in the index (slot)
+// Output: Pointer to the bucket
+static struct cache_entry** bucket(struct disk_data *data, int slot) {
+    return &data->buckets[((uint32_t)slot * 2654435761u) & (data->nbuckets - 1)];
+}
+
+// Function to unlink an entry from the LRU list
+static void unlink_lru(struct disk_data *data, struct cache_entry *e) {
+    if (e->newer) {
+        e->newer->older = e->older;
+    } else {
+        data->newest = e->older;
+    }
+    if (e->older) {
+        e->older->newer = e->newer;
+    } else {
+        data->oldest = e->newer;
+    }
+}
+
+// Function to make an entry the most recently used
+static void push_newest(struct disk_data *data, struct cache_entry *e) {
+    e->newer = NULL;
+    e->older = data->newest;
+    if (data->newest) {
+        data->newest->newer = e;
+    } else {
+        data->oldest = e;
+    }
+    data->newest = e;
+}
+
+// Function to remove the least recently used entry from the cache
+static void evict_oldest(struct disk_data *data) {
+    struct cache_entry *e = data->oldest;
+    struct cache_entry **p = bucket(data, e->slot);
+    while (*p != e) {
+        p = &(*p)->next;
+    }
+    *p = e->next;
+    unlink_lru(data, e);
+    data->cached -= e->bytes;
+    free(e->line);
+    free(e);
+}
+
+// Function to read the line of an index entry from the dataset
+// Input: Pointer to disk_data structure, position in the index (slot),
+//        pointer to the length of the line (len)
+// Output: The line, NUL-terminated and without its newline
+static char* read_line(struct disk_data *data, int slot, size_t *len) {
+    uint64_t pos = data->entries[slot].pos;
+    off_t offset = pos >> LENGTH_BITS;
+    size_t known = pos & MAX_LENGTH;
+    size_t want = known, have = 0, searched = 0;
+    char *line = NULL;
+
+    // A line of MAX_LENGTH may be longer, so read on until its newline.
+    for (;;) {
+        line = realloc(line, want + 1);
+        if (!line) {
+            fprintf(stderr, "Error: Failed to allocate memory for a record.\n");
+            exit(EXIT_FAILURE);
+        }
+        int eof = 0;
+        while (have < want && !eof) {
+            ssize_t got = pread(data->fd, line + have, want - have, offset + have);
+            data->reads++;
+            if (got < 0 || (got == 0 && have < known)) {
+                fprintf(stderr, "Error: Failed to read a record (errno: %s)\n",
+                        got < 0 ? strerror(errno) : "end of file");
+                exit(EXIT_FAILURE);
+            }
+            eof = got == 0;
+            have += got;
+        }
+        if (known < MAX_LENGTH) {
+            break;
+        }
+        char *newline = memchr(line + searched, '\n', have - searched);
+        if (newline || eof) {
+            have = newline ? (size_t)(newline - line) : have;
+            break;
+        }
+        searched = have;
+        want *= 2;
+    }
+    line[have] = 0;
+    *len = have;
+    return line;
+}
+
+// Function to report the bytes allocated for the disk_data structure
+// Input: Pointer to disk_data structure
+// Output: Number of bytes of the index and the cache
+size_t index_size_disk(struct disk_data *data) {
+    return sizeof(struct disk_data)
+        + (size_t)data->n * sizeof(struct disk_entry)
+        + data->nbuckets * sizeof(struct cache_entry*)
+        + data->cached;
+}
+
+// Function to look up an ID, reading its record if it is not cached
+// Input: Pointer to disk_data structure, ID to search for (needle)
+// Output: Pointer to the matching record, valid until the next lookup,
+//         or NULL if not found
+const struct record* lookup_disk(struct disk_data *data, int64_t needle) {
+    // Binary search for the first entry with the ID
+    int lo = 0, hi = data->n;
+    while (lo < hi) {
+        int mid = lo + (hi-lo)/2;
+        if (data->entries[mid].osm_id < needle) {
+            lo = mid+1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == data->n || data->entries[lo].osm_id != needle) {
+        return NULL;
+    }
+
+    struct cache_entry **b = bucket(data, lo);
+    for (struct cache_entry *e = *b; e; e = e->next) {
+        if (e->slot == lo) {
+            data->hits++;
+            unlink_lru(data, e);
+            push_newest(data, e);
+            return &e->r;
+        }
+    }
+
+    data->misses++;
+    struct cache_entry *e = malloc(sizeof(struct cache_entry));
+    if (!e) {
+        fprintf(stderr, "Error: Failed to allocate memory for a record.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t len;
+    e->slot = lo;
+    e->line = read_line(data, lo, &len);
+    e->bytes = sizeof(struct cache_entry) + len + 1;
+    record_parse_line(&e->r, e->line);
+
+    // Make room, but always keep the new entry.
+    while (data->oldest && data->cached + e->bytes > data->budget) {
+        evict_oldest(data);
+    }
+    e->next = *b;
+    *b = e;
+    push_newest(data, e);
+    data->cached += e->bytes;
+    return &e->r;
+}
+
+// Function to free the disk_data structure, and print how often the
+// cache was used
+// Input: Pointer to disk_data structure
+void free_disk(struct disk_data *data) {
+    if (data) {
+        printf("Record cache: %lu hits, %lu misses, %lu reads\n",
+               (unsigned long)data->hits, (unsigned long)data->misses,
+               (unsigned long)data->reads);
+        while (data->oldest) {
+            evict_oldest(data);
+        }
+        free(data->buckets);
+        if (data->mapped) {
+            munmap(data->mapped, data->mapped_len);
+        }
+        bigmem_free(data->owned);
+        close(data->fd);
+        free(data);
+    }
+}
+
+// Main function to run the query loop on the dataset on disk
+int main(int argc, char** argv) {
+    return id_query_attach_loop(argc, argv,
+                                (attach_index_fn)open_disk,       // Open dataset and index
+                                (free_index_fn)free_disk,         // Close them
+                                (lookup_fn)lookup_disk,           // Lookup function
+                                (index_size_fn)index_size_disk);  // Index size
+}
@@ -7,6 +7,7 @@
 
 #include "record.h"
 #include "id_query.h"
+#include "bigmem.h"
 
 //the functions in this program are mostly based on the functions in id_query_naive.c.
 //chatgbt was also used to verify syntax and for error handling
@@ -34,7 +35,7 @@ struct indexed_data* mk_indexed(const struct record* rs, int n) {
     }
 
     // Allocate memory for the index array
-    data->irs = malloc(n * sizeof(struct index_record));
+    data->irs = bigmem_alloc(n * sizeof(struct index_record));
     if (!data->irs) {
         fprintf(stderr, "Error: Failed to allocate memory for index_record array.\n");
         free(data);
@@ -55,11 +56,18 @@ struct indexed_data* mk_indexed(const struct record* rs, int n) {
 // Input: Pointer to indexed_data structure
 void free_indexed(struct indexed_data* data) {
     if (data) {
-        free(data->irs); // Free the index array
+        bigmem_free(data->irs); // Free the index array
         free(data);      // Free the indexed_data structure
     }
 }
 
+// Function to report the bytes allocated for the indexed_data structure
+// Input: Pointer to the indexed_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_indexed(struct indexed_data* data) {
+    return sizeof(struct indexed_data) + (size_t)data->n * sizeof(struct index_record);
+}
+
 // Perform a linear search on the index to find a record by ID
 // Input: Pointer to indexed_data structure, ID to search for (needle)
 // Output: Pointer to the matching record, or NULL if not found
@@ -77,5 +85,6 @@ int main(int argc, char** argv) {
     return id_query_loop(argc, argv,
                         (mk_index_fn)mk_indexed,    // Create index
                         (free_index_fn)free_indexed, // Free index
-                        (lookup_fn)lookup_indexed); // Lookup function
+                        (lookup_fn)lookup_indexed, // Lookup function
+                        (index_size_fn)index_size_indexed); // Index size
 }
@@ -8,6 +8,7 @@
 
 #include "record.h"
 #include "id_query.h"
+#include "bigmem.h"
 
 // Structure to hold the dataset for naive searching
 struct naive_data {
@@ -29,7 +30,7 @@ struct naive_data* mk_naive(const struct record* rs, int n) {
     }
 
     // Allocate memory for the records array and copy the input records
-    data->rs = malloc(n * sizeof(struct record));
+    data->rs = bigmem_alloc(n * sizeof(struct record));
     if (!data->rs) {
         fprintf(stderr, "Error: Failed to allocate memory for records.\n");
         free(data); // Free the structure on failure
@@ -45,11 +46,19 @@ struct naive_data* mk_naive(const struct record* rs, int n) {
 // Input: Pointer to naive_data structure
 void free_naive(struct naive_data* data) {
     if (data) {
-        free(data->rs); // Free the records array
+        bigmem_free(data->rs); // Free the records array
         free(data);     // Free the data structure
     }
 }
 
+// Function to report the bytes allocated for the naive_data structure
+// Input: Pointer to the naive_data structure
+// Output: Number of bytes, including the copy of the records (but not
+//         the names, which are shared with the originals)
+size_t index_size_naive(struct naive_data* data) {
+    return sizeof(struct naive_data) + (size_t)data->n * sizeof(struct record);
+}
+
 // Perform a linear search to find a record with the specified ID
 // Input: Pointer to naive_data structure, ID to search for (needle)
 // Output: Pointer to the matching record, or NULL if not found
@@ -67,5 +76,6 @@ int main(int argc, char** argv) {
     return id_query_loop(argc, argv,
                         (mk_index_fn)mk_naive,    // Create index
                         (free_index_fn)free_naive, // Free index
-                        (lookup_fn)lookup_naive); // Lookup function
+                        (lookup_fn)lookup_naive, // Lookup function
+                        (index_size_fn)index_size_naive); // Index size
 }
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "record.h"
+#include "id_query.h"
+#include "shared_dataset.h"
+
+// Answers id queries from a dataset image in shared memory (see
+// shared_dataset.h), which must first be created with shared_load:
+//
+//   ./shared_load planet planet-latest_geonames.tsv
+//   ./id_query_shared planet < ids.txt
+//
+// Any number of these processes can run on the same image, and they
+// all use the one copy of the records and the id index in it.  Each
+// starts answering as soon as the image is mapped, as nothing is read
+// or built.
+
+// Structure to hold the attached image
+struct shared_data {
+    struct shared_dataset *ds; // The attached image
+    struct record result;      // The record of the last successful lookup
+};
+
+// Function to attach the shared image
+// Input: Name of the image, pointer to the number of records (n)
+// Output: Pointer to shared_data structure, or NULL with errno set
+struct shared_data* attach_shared(const char *name, int *n) {
+    struct shared_dataset *ds = shared_dataset_attach(name);
+    if (!ds) {
+        return NULL;
+    }
+
+    struct shared_data *data = malloc(sizeof(struct shared_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for shared_data.\n");
+        exit(EXIT_FAILURE);
+    }
+    data->ds = ds;
+    *n = shared_dataset_count(ds);
+    return data;
+}
+
+// Function to detach the shared image
+// Input: Pointer to shared_data structure
+void free_shared(struct shared_data *data) {
+    if (data) {
+        shared_dataset_detach(data->ds);
+        free(data);
+    }
+}
+
+// Function to report the size of the shared image, which is shared by
+// all the processes that attach it
+// Input: Pointer to shared_data structure
+// Output: Number of bytes in the image
+size_t index_size_shared(struct shared_data *data) {
+    return shared_dataset_size(data->ds);
+}
+
+// Function to look up an ID in the image's id index
+// Input: Pointer to shared_data structure, ID to search for (needle)
+// Output: Pointer to the matching record, valid until the next lookup,
+//         or NULL if not found
+const struct record* lookup_shared(struct shared_data *data, int64_t needle) {
+    int row = shared_dataset_find_id(data->ds, needle);
+    if (row < 0) {
+        return NULL;
+    }
+    shared_dataset_record(data->ds, row, &data->result);
+    return &data->result;
+}
+
+// Main function to run the query loop on the shared image
+int main(int argc, char** argv) {
+    return id_query_attach_loop(argc, argv,
+                                (attach_index_fn)attach_shared,    // Attach image
+                                (free_index_fn)free_shared,        // Detach image
+                                (lookup_fn)lookup_shared,          // Lookup function
+                                (index_size_fn)index_size_shared); // Index size
+}
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "live_index.h"
+#include "timing.h"
+#include "mem_stats.h"
+#include "epoch.h"
+#include "trace.h"
+
+// Reloading runs at this nice value, so that queries come first.
+#define RELOAD_NICE 10
+
+// The index that queries go to.  Queries read 'current' inside an
+// epoch, and the reload thread frees the generation it replaced once
+// they have all moved on.
+struct live_index {
+  struct generation *current;
+  struct epoch_domain *epochs;
+  struct epoch_reader *reader;       // The query thread
+  int in_read;                       // Is the query thread in a read?
+  struct index_source source;
+
+  pthread_t reloader;
+  int reloader_started;              // Has the thread ever been started?
+  int reloading;                     // Is the thread still running?
+  char *reload_file;
+};
+
+static void free_generation(const struct live_index *live, struct generation *g) {
+  live->source.free_index(g->index);
+  if (g->rs) {
+    free_records(g->rs, g->n);
+  }
+  free(g);
+}
+
+struct generation* load_generation(const char *file, const struct index_source *source,
+                                   size_t (*index_size)(void*),
+                                   struct perf_counters *counters, int verbose) {
+  uint64_t start, runtime;
+  struct perf_sample before, after, counts;
+  struct generation *g = malloc(sizeof(struct generation));
+  if (!g) {
+    fprintf(stderr, "Error: Failed to allocate memory for generation.\n");
+    exit(EXIT_FAILURE);
+  }
+  const struct index_builder *builder = source->builder;
+  struct build_pipeline *pipeline = builder ? build_pipeline_start(builder) : NULL;
+
+  perf_counters_read(counters, &before);
+  start = microseconds();
+  g->rs = pipeline
+    ? read_records_streaming(file, &g->n, build_pipeline_ready, pipeline)
+    : read_records(file, &g->n);
+  runtime = microseconds()-start;
+  perf_counters_read(counters, &after);
+
+  if (!g->rs) {
+    int saved = errno;
+    if (pipeline) {
+      source->free_index(build_pipeline_finish(pipeline));
+    }
+    free(g);
+    errno = saved;
+    return NULL;
+  }
+
+  if (verbose) {
+    printf("Reading records: %dms\n", (int)runtime/1000);
+    memset(&counts, 0, sizeof(counts));
+    perf_sample_accumulate(&counts, &before, &after);
+    perf_counters_print(counters, stdout, "load", &counts, 1);
+    print_peak_rss("load", g->n);
+  }
+
+  perf_counters_read(counters, &before);
+  start = microseconds();
+  TRACE_BEGIN(pipeline ? "wait for index" : "mk_index");
+  g->index = pipeline ? build_pipeline_finish(pipeline) : source->mk_index(g->rs, g->n);
+  TRACE_END();
+  runtime = microseconds()-start;
+  perf_counters_read(counters, &after);
+
+  if (verbose) {
+    printf("Building index: %dms\n", (int)runtime/1000);
+    if (!pipeline) {
+      memset(&counts, 0, sizeof(counts));
+      perf_sample_accumulate(&counts, &before, &after);
+      perf_counters_print(counters, stdout, "build", &counts, 1);
+    }
+    if (index_size) {
+      print_index_size(index_size(g->index), g->n);
+    }
+    print_peak_rss("build", g->n);
+  }
+
+  g->number = 1;
+  return g;
+}
+
+struct live_index* live_index_create(struct generation *g, const char *file,
+                                     const struct index_source *source) {
+  struct live_index *live = calloc(1, sizeof(struct live_index));
+  if (live) {
+    live->current = g;
+    live->epochs = epoch_create();
+    live->reader = live->epochs ? epoch_register(live->epochs) : NULL;
+    live->reload_file = strdup(file);
+    live->source = *source;
+  }
+  if (!live || !live->reader || !live->reload_file) {
+    fprintf(stderr, "Error: Failed to allocate memory for the live index.\n");
+    exit(EXIT_FAILURE);
+  }
+  return live;
+}
+
+void live_index_free(struct live_index *live) {
+  // A reload that is still running finishes first.
+  if (live->reloader_started) {
+    pthread_join(live->reloader, NULL);
+  }
+  live_index_exit(live);
+  free_generation(live, live->current);
+  epoch_unregister(live->reader);
+  epoch_free(live->epochs);
+  free(live->reload_file);
+  free(live);
+}
+
+struct generation* live_index_enter(struct live_index *live) {
+  if (!live->in_read) {
+    epoch_enter(live->reader);
+    live->in_read = 1;
+  }
+  return __atomic_load_n(&live->current, __ATOMIC_SEQ_CST);
+}
+
+void live_index_exit(struct live_index *live) {
+  if (live->in_read) {
+    epoch_exit(live->reader);
+    live->in_read = 0;
+  }
+}
+
+// Build a new generation from live->reload_file, swap it in, and free
+// the old one once no query uses it.  Runs on a thread of its own, at
+// a lower priority than the queries.
+static void* reload_thread(void *arg) {
+  struct live_index *live = arg;
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), RELOAD_NICE);
+  TRACE_THREAD("reload");
+
+  uint64_t start = microseconds();
+  struct generation *g = load_generation(live->reload_file, &live->source, NULL, NULL, 0);
+  if (!g) {
+    fprintf(stderr, "Failed to reload from %s (errno: %s)\n",
+            live->reload_file, strerror(errno));
+  } else {
+    struct generation *old = live->current;
+    g->number = old->number+1;
+    __atomic_store_n(&live->current, g, __ATOMIC_SEQ_CST);
+    TRACE_BEGIN("wait for readers");
+    epoch_synchronize(live->epochs);
+    TRACE_END();
+    free_generation(live, old);
+    fprintf(stderr, "Reloaded %s: %d records, generation %d, %dms\n",
+            live->reload_file, g->n, g->number, (int)((microseconds()-start)/1000));
+  }
+
+  __atomic_store_n(&live->reloading, 0, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+void live_index_reload(struct live_index *live, const char *file) {
+  if (!live->source.mk_index && !live->source.builder) {
+    fprintf(stderr, "This index cannot be reloaded\n");
+    return;
+  }
+  if (__atomic_load_n(&live->reloading, __ATOMIC_ACQUIRE)) {
+    fprintf(stderr, "A reload is already running\n");
+    return;
+  }
+  if (live->reloader_started) {
+    pthread_join(live->reloader, NULL);
+  }
+
+  if (file) {
+    char *copy = strdup(file);
+    if (!copy) {
+      fprintf(stderr, "Error: Failed to allocate memory for reload.\n");
+      exit(EXIT_FAILURE);
+    }
+    free(live->reload_file);
+    live->reload_file = copy;
+  }
+  live->reloading = 1;
+  if (pthread_create(&live->reloader, NULL, reload_thread, live) != 0) {
+    fprintf(stderr, "Failed to start reloading\n");
+    live->reloading = 0;
+    live->reloader_started = 0;
+    return;
+  }
+  live->reloader_started = 1;
+}
+
+int live_index_reload_line(struct live_index *live, char *line) {
+  if (strncmp(line, "reload", 6) != 0) {
+    return 0;
+  }
+  char *file = line+6;
+  file += strspn(file, " \t");
+  file[strcspn(file, "\n")] = 0;
+  live_index_reload(live, *file ? file : NULL);
+  return 1;
+}
@@ -0,0 +1,74 @@
+// An index that can be replaced while queries go on, shared by the
+// query loops of id_query.c and coord_query.c.
+//
+// Queries go to the current generation, a set of records and the
+// index on them.  A reload reads the records again, or from another
+// file, and builds a new index on a thread of its own, at a lower
+// priority than the queries.  The new generation then replaces the old
+// one, which is freed once no query uses it (see epoch.h).  Only one
+// thread, the query thread, may look up generations.
+
+#ifndef LIVE_INDEX_H
+#define LIVE_INDEX_H
+
+#include <stddef.h>
+
+#include "record.h"
+#include "build_pipeline.h"
+#include "perf_counters.h"
+
+// A set of records and the index on them.
+struct generation {
+  struct record *rs;    // NULL if the index was attached
+  int n;
+  void *index;
+  int number;           // 1 for the first, counting up with each reload
+};
+
+// How to build and free the index of a generation.  The index is built
+// either by mk_index after reading, or by the builder while reading.
+// If both are NULL, as for an attached index, it cannot be reloaded.
+struct index_source {
+  void* (*mk_index)(const struct record*, int);
+  const struct index_builder *builder;
+  void (*free_index)(void*);
+};
+
+// Read the records and build an index on them.  With a builder, the
+// build time is only the part that did not overlap with reading, and
+// there are no counters for the build, as it runs on another thread.
+// If 'verbose' is set, the time and memory taken by each are printed,
+// and the size of the index too if 'index_size' is not NULL.  Returns
+// NULL with errno set if the records could not be read.
+struct generation* load_generation(const char *file, const struct index_source *source,
+                                   size_t (*index_size)(void*),
+                                   struct perf_counters *counters, int verbose);
+
+struct live_index;
+
+// Start serving queries from the generation 'g', which was loaded
+// from 'file'.  Exits the program if out of memory.
+struct live_index* live_index_create(struct generation *g, const char *file,
+                                     const struct index_source *source);
+
+// Wait for a reload that is still running, and free the index and
+// whichever generation is current.
+void live_index_free(struct live_index *live);
+
+// Start a read, if one is not already open, and return the current
+// generation, which stays valid until live_index_exit().
+struct generation* live_index_enter(struct live_index *live);
+
+// End the read, if one is open.
+void live_index_exit(struct live_index *live);
+
+// Start reloading from 'file', or from the file loaded last if it is
+// NULL, unless the index cannot be reloaded or a reload is already
+// running.  Problems are reported on stderr.
+void live_index_reload(struct live_index *live, const char *file);
+
+// If 'line' is a query line "reload" or "reload FILE", start the
+// reload and return 1; otherwise return 0.  The line is modified.
+int live_index_reload_line(struct live_index *live, char *line);
+
+#endif
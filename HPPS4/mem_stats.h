@@ -0,0 +1,32 @@
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/resource.h>
+
+// The largest resident set size of the process so far, in kilobytes.
+// This includes the program and its libraries, not just the data.
+static inline long peak_rss_kb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  return usage.ru_maxrss;
+}
+
+// Print the peak resident set size after a phase of a query program,
+// and what it comes to per record.
+static inline void print_peak_rss(const char *phase, int n) {
+  long kb = peak_rss_kb();
+  printf("Peak RSS after %s: %ld kB (%.1f bytes per record)\n",
+         phase, kb, n > 0 ? kb * 1024.0 / n : 0.0);
+}
+
+// Print the size of an index, as reported by its index_size_fn.
+static inline void print_index_size(size_t bytes, int n) {
+  printf("Index size: %zu bytes (%.1f bytes per record)\n",
+         bytes, n > 0 ? (double)bytes / n : 0.0);
+}
+
+#endif
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "name_query.h"
+#include "timing.h"
+#include "histogram.h"
+#include "outbuf.h"
+#include "mem_stats.h"
+#include "trace.h"
+
+size_t normalise_name(char *dst, const char *src, size_t size) {
+  size_t i = 0;
+  for (; src[i] && i+1 < size; i++) {
+    unsigned char c = src[i];
+    dst[i] = c < 128 ? tolower(c) : c;
+  }
+  if (size > 0) {
+    dst[i] = 0;
+  }
+  return i;
+}
+
+void keep_most_important(const struct record *r, int k, const struct record **out, int *found) {
+  if (k <= 0) {
+    return;
+  }
+  if (*found == k &&
+      !(r->importance > out[k-1]->importance ||
+        (r->importance == out[k-1]->importance && r < out[k-1]))) {
+    return;
+  }
+
+  int j = *found < k ? (*found)++ : k-1;
+  while (j > 0 &&
+         (r->importance > out[j-1]->importance ||
+          (r->importance == out[j-1]->importance && r < out[j-1]))) {
+    out[j] = out[j-1];
+    j--;
+  }
+  out[j] = r;
+}
+
+int bounded_edit_distance(const char *a, const char *b, int max) {
+  size_t la = strlen(a), lb = strlen(b);
+  if (la > lb + max || lb > la + max) {
+    return max+1;
+  }
+
+  // Two rows of the usual dynamic programming table, on the stack
+  // for the common case of short names.
+  int rows[2*64];
+  int *buf = NULL;
+  if (lb+1 > 64) {
+    buf = malloc(2*(lb+1) * sizeof(int));
+    if (!buf) {
+      fprintf(stderr, "Error: Failed to allocate memory for edit distance.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  int *prev = buf ? buf : rows;
+  int *cur = prev+lb+1;
+
+  for (size_t j = 0; j <= lb; j++) {
+    prev[j] = j;
+  }
+
+  int result = max+1;
+  for (size_t i = 1; i <= la; i++) {
+    cur[0] = i;
+    int row_min = cur[0];
+    for (size_t j = 1; j <= lb; j++) {
+      int best = prev[j-1] + (a[i-1] != b[j-1]);
+      if (prev[j]+1 < best) best = prev[j]+1;
+      if (cur[j-1]+1 < best) best = cur[j-1]+1;
+      cur[j] = best;
+      if (best < row_min) row_min = best;
+    }
+    // Distances never shrink from one row to the next.
+    if (row_min > max) {
+      goto done;
+    }
+    int *tmp = prev; prev = cur; cur = tmp;
+  }
+
+  if (prev[lb] <= max) {
+    result = prev[lb];
+  }
+
+done:
+  free(buf);
+  return result;
+}
+
+int name_query_loop(int argc, char** argv, mk_index_fn mk_index, free_index_fn free_index,
+                    lookup_fn lookup, index_size_fn index_size) {
+  int quiet = argc == 3 && strcmp(argv[1], "-q") == 0;
+  if (argc != 2 && !quiet) {
+    fprintf(stderr, "Usage: %s [-q] FILE\n", argv[0]);
+    exit(1);
+  }
+  const char *file = argv[argc-1];
+
+  uint64_t start, runtime;
+  int n;
+
+  start = microseconds();
+  struct record *rs = read_records(file, &n);
+  runtime = microseconds()-start;
+
+  if (rs) {
+    printf("Reading records: %dms\n", (int)runtime/1000);
+    print_peak_rss("load", n);
+
+    start = microseconds();
+    TRACE_BEGIN("mk_index");
+    void *index = mk_index(rs, n);
+    TRACE_END();
+    runtime = microseconds()-start;
+    printf("Building index: %dms\n", (int)runtime/1000);
+    if (index_size) {
+      print_index_size(index_size(index), n);
+    }
+    print_peak_rss("build", n);
+
+    char *line = NULL;
+    size_t line_len;
+    const struct record *results[NAME_QUERY_RESULTS];
+    struct histogram *latency = histogram_create();
+    if (!latency) {
+      fprintf(stderr, "Error: Failed to allocate memory for latency histogram.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    // Results go through a buffer of our own, which must not be
+    // interleaved with the output still buffered by stdio.
+    fflush(stdout);
+    struct outbuf *out = outbuf_create(STDOUT_FILENO);
+
+    uint64_t runtime_sum = 0;
+    while (getline(&line, &line_len, stdin) != -1) {
+      line[strcspn(line, "\n")] = 0;
+
+      TRACE_BEGIN("lookup");
+      start = nanoseconds();
+      int found = lookup(index, line, NAME_QUERY_RESULTS, results);
+      runtime = nanoseconds()-start;
+      TRACE_END();
+      histogram_record(latency, runtime);
+
+      if (!quiet) {
+        for (int i = 0; i < found; i++) {
+          outbuf_str(out, line);
+          outbuf_str(out, ": ");
+          outbuf_str(out, record_name(results[i]));
+          outbuf_char(out, ' ');
+          outbuf_double(out, results[i]->lon);
+          outbuf_char(out, ' ');
+          outbuf_double(out, results[i]->lat);
+          outbuf_char(out, '\n');
+        }
+        if (found == 0) {
+          outbuf_str(out, line);
+          outbuf_str(out, ": not found\n");
+        }
+        outbuf_str(out, "Query time: ");
+        outbuf_long(out, (int)(runtime/1000));
+        outbuf_str(out, "us\n");
+      }
+      runtime_sum += runtime;
+    }
+    outbuf_free(out);
+
+    printf("Total query runtime: %dus\n", (int)(runtime_sum/1000));
+    histogram_print(latency, stdout, "Query latency");
+
+    histogram_free(latency);
+    free(line);
+    free_index(index);
+    free_records(rs, n);
+    return 0;
+  } else {
+    fprintf(stderr, "Failed to read input from %s (errno: %s)\n",
+            file, strerror(errno));
+    return 1;
+  }
+}
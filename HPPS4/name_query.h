@@ -0,0 +1,44 @@
+// Similar to id_query.h, but for queries on place names.  Each line of
+// input is a query string, and the index may return several records
+// for it.  See the comments in id_query.h.
+
+#ifndef NAME_QUERY_LOOP_H
+#define NAME_QUERY_LOOP_H
+
+#include "record.h"
+
+// The largest number of records printed for a single query.
+#define NAME_QUERY_RESULTS 10
+
+typedef void* (*mk_index_fn)(const struct record*, int);
+
+typedef void (*free_index_fn)(void*);
+
+// Look up a query string in an index produced by mk_index_fn.  Stores
+// at most 'k' records in the array, best first, and returns how many
+// were stored.
+typedef int (*lookup_fn)(void*, const char*, int, const struct record**);
+
+typedef size_t (*index_size_fn)(void*);
+
+// Run a query loop, using the provided functions for managing the
+// index.  The index_size_fn may be NULL.
+int name_query_loop(int argc, char** argv, mk_index_fn, free_index_fn, lookup_fn, index_size_fn);
+
+// Normalise a place name for indexing and matching: ASCII letters are
+// lowercased, everything else is left alone.  Writes at most 'size'
+// bytes including the terminating NUL, and returns the length of the
+// normalised name.
+size_t normalise_name(char *dst, const char *src, size_t size);
+
+// Keep the 'k' most important records seen so far in 'out', sorted
+// with the most important first.  '*found' is the number of records
+// currently in 'out'.  Ties go to the record that comes first in the
+// dataset, so every record must come from the same array.
+void keep_most_important(const struct record *r, int k, const struct record **out, int *found);
+
+// The Levenshtein distance between two strings, counting bytes, if it
+// is at most 'max'.  Otherwise returns max+1.
+int bounded_edit_distance(const char *a, const char *b, int max);
+
+#endif
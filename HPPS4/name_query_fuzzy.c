@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "record.h"
+#include "name_query.h"
+#include "bigmem.h"
+
+// Typo-tolerant name lookup with a symmetric deletion dictionary (as
+// in SymSpell).  If two strings are within edit distance d of each
+// other, then deleting at most d bytes from each of them yields a
+// common string.  The index therefore stores, for every distinct
+// normalised name, the strings obtained by deleting up to MAX_DISTANCE
+// bytes, and a query looks up its own deletions to find candidate
+// names, which are then checked with bounded_edit_distance().
+//
+// To bound memory, only the first PREFIX bytes of a name are used, so
+// every name contributes at most 1 + PREFIX + PREFIX*(PREFIX-1)/2
+// deletions however long it is.  An alignment of the query with a
+// name maps the name's prefix onto a prefix of the query whose length
+// differs by at most MAX_DISTANCE, so the query looks up the deletions
+// of each of those prefixes, as well as of the whole query for names
+// shorter than PREFIX.  Deletions are stored as 64-bit hashes; a hash
+// collision only produces an extra candidate, which the verification
+// rejects.
+
+// The largest edit distance at which a name still matches.
+#define MAX_DISTANCE 2
+
+// Number of leading bytes of a name that are indexed.
+#define PREFIX 7
+
+// A deletion of a name, while building.
+struct deletion {
+    uint64_t hash; // Hash of the string left after deleting
+    uint32_t name; // Index of the distinct name
+};
+
+// A name of a record, while building.
+struct name_entry {
+    const char *key; // Normalised name
+    int row;         // Index of the record
+};
+
+// Structure to hold the deletion dictionary
+struct fuzzy_data {
+    const struct record *rs; // Pointer to array of records
+    char *pool;              // Storage for the normalised names
+    const char **names;      // Distinct normalised names, sorted
+    int nnames;              // Number of distinct names
+    int *first;              // Rows of name i are rows[first[i]..first[i+1])
+    int *rows;               // Record indexes, grouped by name
+    uint64_t *hashes;        // Sorted deletion hashes
+    uint32_t *owners;        // Name of each deletion hash
+    size_t ndeletions;       // Number of deletions
+    uint32_t *stamp;         // Query number that last saw each name
+    uint32_t query;          // Number of the current query
+    size_t size;             // Bytes allocated for the index
+};
+
+// Hash of the bytes of s[0,len), skipping positions 'skip1' and
+// 'skip2' (pass len or more to skip nothing).
+static uint64_t hash_without(const char *s, size_t len, size_t skip1, size_t skip2) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        if (i != skip1 && i != skip2) {
+            h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+// Call 'fn' with the hash of every string obtained by deleting up to
+// MAX_DISTANCE bytes from s[0,len).  Some strings may be reported more
+// than once.
+static void for_each_deletion(const char *s, size_t len,
+                              void (*fn)(uint64_t, void*), void *ctx) {
+    fn(hash_without(s, len, len, len), ctx);
+    for (size_t i = 0; i < len; i++) {
+        fn(hash_without(s, len, i, len), ctx);
+        for (size_t j = i + 1; j < len; j++) {
+            fn(hash_without(s, len, i, j), ctx);
+        }
+    }
+}
+
+// Comparison function for qsort: by name, then by record
+static int compare_name(const void *a, const void *b) {
+    const struct name_entry *x = a;
+    const struct name_entry *y = b;
+    int c = strcmp(x->key, y->key);
+    if (c != 0) return c;
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+// Comparison function for qsort: by hash, then by name
+static int compare_deletion(const void *a, const void *b) {
+    const struct deletion *x = a;
+    const struct deletion *y = b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return (x->name > y->name) - (x->name < y->name);
+}
+
+// Context for collecting the deletions of a name while building.
+struct collect {
+    struct deletion *deletions;
+    size_t n;
+    uint32_t name;
+};
+
+static void collect_deletion(uint64_t hash, void *arg) {
+    struct collect *c = arg;
+    c->deletions[c->n].hash = hash;
+    c->deletions[c->n].name = c->name;
+    c->n++;
+}
+
+// Function to create the deletion dictionary
+// Input: Array of records (rs) and number of records (n)
+// Output: Pointer to fuzzy_data structure
+struct fuzzy_data* mk_fuzzy(const struct record *rs, int n) {
+    struct fuzzy_data *data = malloc(sizeof(struct fuzzy_data));
+    struct name_entry *entries = bigmem_alloc((n > 0 ? n : 1) * sizeof(struct name_entry));
+    if (!data || !entries) {
+        fprintf(stderr, "Error: Failed to allocate memory for fuzzy_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Normalise all names.
+    size_t bytes = 1;
+    for (int i = 0; i < n; i++) {
+        bytes += strlen(record_name(&rs[i])) + 1;
+    }
+    data->rs = rs;
+    data->pool = bigmem_alloc(bytes);
+    if (!data->pool) {
+        fprintf(stderr, "Error: Failed to allocate memory for names.\n");
+        exit(EXIT_FAILURE);
+    }
+    char *pool = data->pool;
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(record_name(&rs[i]));
+        normalise_name(pool, record_name(&rs[i]), len + 1);
+        entries[i].key = pool;
+        entries[i].row = i;
+        pool += len + 1;
+    }
+    qsort(entries, n, sizeof(struct name_entry), compare_name);
+
+    // Group the records by distinct name.
+    data->names = bigmem_alloc((n > 0 ? n : 1) * sizeof(const char*));
+    data->first = bigmem_alloc((n + 1) * sizeof(int));
+    data->rows = bigmem_alloc((n > 0 ? n : 1) * sizeof(int));
+    if (!data->names || !data->first || !data->rows) {
+        fprintf(stderr, "Error: Failed to allocate memory for name groups.\n");
+        exit(EXIT_FAILURE);
+    }
+    data->nnames = 0;
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || strcmp(entries[i].key, entries[i - 1].key) != 0) {
+            data->names[data->nnames] = entries[i].key;
+            data->first[data->nnames] = i;
+            data->nnames++;
+        }
+        data->rows[i] = entries[i].row;
+    }
+    data->first[data->nnames] = n;
+    bigmem_free(entries);
+
+    // Generate the deletions of every name prefix.
+    size_t per_name = 1 + PREFIX + PREFIX * (PREFIX - 1) / 2;
+    struct collect c = { bigmem_alloc((data->nnames * per_name + 1) * sizeof(struct deletion)), 0, 0 };
+    if (!c.deletions) {
+        fprintf(stderr, "Error: Failed to allocate memory for deletions.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < data->nnames; i++) {
+        size_t len = strlen(data->names[i]);
+        c.name = i;
+        for_each_deletion(data->names[i], len < PREFIX ? len : PREFIX, collect_deletion, &c);
+    }
+    qsort(c.deletions, c.n, sizeof(struct deletion), compare_deletion);
+
+    // Drop duplicates and split into two arrays, which avoids the
+    // padding of struct deletion.
+    data->hashes = bigmem_alloc((c.n + 1) * sizeof(uint64_t));
+    data->owners = bigmem_alloc((c.n + 1) * sizeof(uint32_t));
+    if (!data->hashes || !data->owners) {
+        fprintf(stderr, "Error: Failed to allocate memory for deletion dictionary.\n");
+        exit(EXIT_FAILURE);
+    }
+    data->ndeletions = 0;
+    for (size_t i = 0; i < c.n; i++) {
+        if (i > 0 && compare_deletion(&c.deletions[i], &c.deletions[i - 1]) == 0) continue;
+        data->hashes[data->ndeletions] = c.deletions[i].hash;
+        data->owners[data->ndeletions] = c.deletions[i].name;
+        data->ndeletions++;
+    }
+    bigmem_free(c.deletions);
+
+    data->stamp = calloc(data->nnames + 1, sizeof(uint32_t));
+    if (!data->stamp) {
+        fprintf(stderr, "Error: Failed to allocate memory for query stamps.\n");
+        exit(EXIT_FAILURE);
+    }
+    data->query = 0;
+
+    size_t m = n > 0 ? n : 1;
+    data->size = sizeof(struct fuzzy_data) + bytes
+        + m * (sizeof(const char*) + sizeof(int)) + (n + 1) * sizeof(int)
+        + (c.n + 1) * (sizeof(uint64_t) + sizeof(uint32_t))
+        + (data->nnames + 1) * sizeof(uint32_t);
+    fprintf(stderr, "Deletion index: %d names, %zu deletions\n", data->nnames, data->ndeletions);
+
+    return data;
+}
+
+// Function to free the deletion dictionary
+void free_fuzzy(struct fuzzy_data *data) {
+    if (data) {
+        bigmem_free(data->pool);
+        bigmem_free(data->names);
+        bigmem_free(data->first);
+        bigmem_free(data->rows);
+        bigmem_free(data->hashes);
+        bigmem_free(data->owners);
+        free(data->stamp);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the fuzzy_data structure
+// Input: Pointer to the fuzzy_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_fuzzy(struct fuzzy_data *data) {
+    return data->size;
+}
+
+// Context for looking up the deletions of a query.
+struct probe {
+    struct fuzzy_data *data;
+    const char *query;      // Normalised query
+    int k;
+    const struct record **out;
+    int found;
+};
+
+// Check every name that has a deletion with the given hash.
+static void probe_deletion(uint64_t hash, void *arg) {
+    struct probe *p = arg;
+    struct fuzzy_data *data = p->data;
+
+    // First deletion with this hash.
+    size_t lo = 0, hi = data->ndeletions;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (data->hashes[mid] < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (; lo < data->ndeletions && data->hashes[lo] == hash; lo++) {
+        uint32_t name = data->owners[lo];
+        if (data->stamp[name] == data->query) continue;
+        data->stamp[name] = data->query;
+
+        if (bounded_edit_distance(p->query, data->names[name], MAX_DISTANCE) <= MAX_DISTANCE) {
+            for (int i = data->first[name]; i < data->first[name + 1]; i++) {
+                keep_most_important(&data->rs[data->rows[i]], p->k, p->out, &p->found);
+            }
+        }
+    }
+}
+
+// Find the most important records whose name is close to the query
+// Input: Pointer to fuzzy_data, the query, maximum number of results, output array
+// Output: Number of records stored in 'out'
+int lookup_fuzzy(struct fuzzy_data *data, const char *query, int k, const struct record **out) {
+    size_t size = strlen(query) + 1;
+    char *norm = malloc(size);
+    if (!norm) {
+        fprintf(stderr, "Error: Failed to allocate memory for query.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = normalise_name(norm, query, size);
+
+    // A new query number invalidates all stamps; on wraparound they
+    // must be cleared for real.
+    if (++data->query == 0) {
+        memset(data->stamp, 0, (data->nnames + 1) * sizeof(uint32_t));
+        data->query = 1;
+    }
+
+    struct probe p = { data, norm, k, out, 0 };
+
+    // The prefix lengths of the query that an indexed name prefix can
+    // align with, plus the whole query.
+    for (int l = PREFIX - MAX_DISTANCE; l <= PREFIX + MAX_DISTANCE + 1; l++) {
+        size_t plen = l <= PREFIX + MAX_DISTANCE ? (size_t)l : len;
+        if (plen > len || (l == PREFIX + MAX_DISTANCE + 1 && len >= PREFIX - MAX_DISTANCE)) {
+            // Longer than the query, or the whole query, which is only
+            // needed when it is shorter than all the prefixes: up to
+            // PREFIX + MAX_DISTANCE, one of them covered it, and a
+            // longer query cannot be within MAX_DISTANCE of a name
+            // shorter than PREFIX.
+            continue;
+        }
+        for_each_deletion(norm, plen, probe_deletion, &p);
+    }
+
+    free(norm);
+    return p.found;
+}
+
+// Main function to run the query loop with the deletion dictionary
+int main(int argc, char** argv) {
+    return name_query_loop(argc, argv,
+                           (mk_index_fn)mk_fuzzy,
+                           (free_index_fn)free_fuzzy,
+                           (lookup_fn)lookup_fuzzy,
+                           (index_size_fn)index_size_fuzzy);
+}
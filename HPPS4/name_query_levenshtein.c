@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "record.h"
+#include "name_query.h"
+
+// Typo-tolerant name lookup by computing the edit distance between
+// the query and the name of every record.  This is the baseline for
+// name_query_fuzzy.c, and the two should always produce the same
+// answers.
+
+// The largest edit distance at which a name still matches.
+#define MAX_DISTANCE 2
+
+// Structure to hold the dataset for naive searching
+struct levenshtein_data {
+    const struct record *rs; // Pointer to array of records
+    int n;                   // Number of records
+};
+
+// Function to create and initialize the levenshtein_data structure
+// Input: Array of records (rs) and the number of records (n)
+// Output: Pointer to initialized levenshtein_data structure
+struct levenshtein_data* mk_levenshtein(const struct record *rs, int n) {
+    struct levenshtein_data *data = malloc(sizeof(struct levenshtein_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for levenshtein_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    data->rs = rs;
+    data->n = n;
+    return data;
+}
+
+// Function to free the levenshtein_data structure
+void free_levenshtein(struct levenshtein_data *data) {
+    free(data);
+}
+
+// Function to report the bytes allocated for the levenshtein_data structure
+// Input: Pointer to the levenshtein_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_levenshtein(struct levenshtein_data *data) {
+    (void)data;
+    return sizeof(struct levenshtein_data);
+}
+
+// Find the most important records whose name is close to the query
+// Input: Pointer to levenshtein_data, the query, maximum number of results, output array
+// Output: Number of records stored in 'out'
+int lookup_levenshtein(struct levenshtein_data *data, const char *query, int k,
+                       const struct record **out) {
+    size_t size = strlen(query) + 1;
+    char *norm = malloc(size);
+    char *name = NULL;
+    size_t name_size = 0;
+    if (!norm) {
+        fprintf(stderr, "Error: Failed to allocate memory for query.\n");
+        exit(EXIT_FAILURE);
+    }
+    normalise_name(norm, query, size);
+
+    int found = 0;
+    for (int i = 0; i < data->n; i++) {
+        size_t len = strlen(record_name(&data->rs[i]));
+        if (len + 1 > name_size) {
+            name_size = 2 * (len + 1);
+            name = realloc(name, name_size);
+            if (!name) {
+                fprintf(stderr, "Error: Failed to allocate memory for name.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        normalise_name(name, record_name(&data->rs[i]), len + 1);
+
+        if (bounded_edit_distance(norm, name, MAX_DISTANCE) <= MAX_DISTANCE) {
+            keep_most_important(&data->rs[i], k, out, &found);
+        }
+    }
+
+    free(name);
+    free(norm);
+    return found;
+}
+
+// Main function to run the query loop with the naive implementation
+int main(int argc, char** argv) {
+    return name_query_loop(argc, argv,
+                           (mk_index_fn)mk_levenshtein,
+                           (free_index_fn)free_levenshtein,
+                           (lookup_fn)lookup_levenshtein,
+                           (index_size_fn)index_size_levenshtein);
+}
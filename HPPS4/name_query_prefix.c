@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "record.h"
+#include "name_query.h"
+#include "bigmem.h"
+
+// Autocompletion of place names.  Every name and alternative name of
+// every record is normalised (see normalise_name()) and stored in one
+// sorted array, so the names starting with a given prefix form a
+// contiguous range that two binary searches can find.
+//
+// To return the most important completions without looking at the
+// whole range, the index keeps a range-maximum structure over the
+// importance of the sorted names: the array is cut into blocks of
+// BLOCK entries, and a sparse table holds the most important entry of
+// every run of 2^j blocks.  The best entry of any range is then found
+// by scanning at most two partial blocks plus two table lookups.  The
+// query repeatedly takes the best remaining range from a heap, reports
+// its best entry, and puts the two pieces on either side of it back on
+// the heap.
+
+#define BLOCK 64
+
+// Structure to store an index entry: a normalised name and its record
+struct prefix_entry {
+    const char *key; // Normalised name, stored in the pool
+    int row;         // Index of the record
+};
+
+// A range of entries [lo,hi) whose most important entry is 'best'.
+struct range {
+    int lo, hi;
+    int best;
+};
+
+// Structure to hold the sorted names
+struct prefix_data {
+    const struct record *rs;       // Pointer to the array of records
+    struct prefix_entry *entries;  // Sorted names
+    int n;                         // Number of entries
+    double *importance;            // Importance of each entry
+    char *pool;                    // Storage for the normalised names
+    int nblocks;                   // Number of blocks
+    int levels;                    // Number of levels in the sparse table
+    int *table;                    // Sparse table: levels x nblocks entry indexes
+    struct range *heap;            // Scratch heap used by queries
+    int heap_capacity;             // Capacity of 'heap'
+    size_t size;                   // Bytes allocated for the index, except 'heap'
+};
+
+// Comparison function for qsort: by name, then by record
+static int compare_entry(const void *a, const void *b) {
+    const struct prefix_entry *x = a;
+    const struct prefix_entry *y = b;
+    int c = strcmp(x->key, y->key);
+    if (c != 0) return c;
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+// The more important of two entries, preferring the first in sorted
+// order on ties.
+static int better(const struct prefix_data *data, int a, int b) {
+    if (data->importance[b] > data->importance[a] ||
+        (data->importance[b] == data->importance[a] && b < a)) {
+        return b;
+    }
+    return a;
+}
+
+// Most important entry in [lo,hi), which must be non-empty.
+static int range_best(const struct prefix_data *data, int lo, int hi) {
+    int best = lo;
+    int first_block = (lo + BLOCK - 1) / BLOCK;
+    int last_block = hi / BLOCK;
+
+    if (first_block >= last_block) {
+        // No complete block in the range, so just scan it.
+        for (int i = lo + 1; i < hi; i++) {
+            best = better(data, best, i);
+        }
+        return best;
+    }
+
+    for (int i = lo; i < first_block * BLOCK; i++) {
+        best = better(data, best, i);
+    }
+    for (int i = last_block * BLOCK; i < hi; i++) {
+        best = better(data, best, i);
+    }
+
+    // Two overlapping power-of-two runs of blocks cover the rest.
+    int span = last_block - first_block;
+    int j = 0;
+    while ((2 << j) <= span) j++;
+    const int *level = &data->table[j * data->nblocks];
+    best = better(data, best, level[first_block]);
+    best = better(data, best, level[last_block - (1 << j)]);
+    return best;
+}
+
+// Add the non-empty names of a record to the index.  The
+// alternative names are separated by commas.
+static void add_names(struct prefix_data *data, char **pool, int row) {
+    const struct record *r = &data->rs[row];
+    const char *names[2] = { record_name(r), record_string(r, RECORD_ALTERNATIVE_NAMES) };
+
+    for (int f = 0; f < 2; f++) {
+        const char *s = names[f];
+        while (s && *s) {
+            size_t len = f == 0 ? strlen(s) : strcspn(s, ",");
+            if (len > 0) {
+                char *key = *pool;
+                // normalise_name() stops at the NUL, so copy the
+                // piece first.
+                memcpy(key, s, len);
+                key[len] = 0;
+                normalise_name(key, key, len + 1);
+                data->entries[data->n].key = key;
+                data->entries[data->n].row = row;
+                data->n++;
+                *pool += len + 1;
+            }
+            s += len;
+            if (*s == ',') s++;
+        }
+    }
+}
+
+// Function to create the prefix index
+// Input: Array of records (rs) and number of records (n)
+// Output: Pointer to prefix_data structure
+struct prefix_data* mk_prefix(const struct record *rs, int n) {
+    struct prefix_data *data = malloc(sizeof(struct prefix_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for prefix_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Count the names and the bytes needed to store them.
+    size_t bytes = 1;
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        bytes += strlen(record_name(&rs[i])) + 1;
+        count++;
+        const char *alt = record_string(&rs[i], RECORD_ALTERNATIVE_NAMES);
+        if (alt && *alt) {
+            bytes += strlen(alt) + 1;
+            for (const char *c = alt; *c; c++) {
+                count += *c == ',';
+            }
+            count++;
+        }
+    }
+
+    data->rs = rs;
+    data->n = 0;
+    data->pool = bigmem_alloc(bytes);
+    data->entries = bigmem_alloc((count > 0 ? count : 1) * sizeof(struct prefix_entry));
+    if (!data->pool || !data->entries) {
+        fprintf(stderr, "Error: Failed to allocate memory for name entries.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *pool = data->pool;
+    for (int i = 0; i < n; i++) {
+        add_names(data, &pool, i);
+    }
+
+    qsort(data->entries, data->n, sizeof(struct prefix_entry), compare_entry);
+
+    data->importance = bigmem_alloc((data->n > 0 ? data->n : 1) * sizeof(double));
+    if (!data->importance) {
+        fprintf(stderr, "Error: Failed to allocate memory for importance array.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < data->n; i++) {
+        data->importance[i] = rs[data->entries[i].row].importance;
+    }
+
+    // Build the sparse table over the complete blocks.
+    data->nblocks = data->n / BLOCK;
+    data->levels = 1;
+    while ((1 << data->levels) <= data->nblocks) data->levels++;
+    data->table = bigmem_alloc(((size_t)data->levels * data->nblocks + 1) * sizeof(int));
+    if (!data->table) {
+        fprintf(stderr, "Error: Failed to allocate memory for sparse table.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int b = 0; b < data->nblocks; b++) {
+        int best = b * BLOCK;
+        for (int i = b * BLOCK + 1; i < (b + 1) * BLOCK; i++) {
+            best = better(data, best, i);
+        }
+        data->table[b] = best;
+    }
+    for (int j = 1; j < data->levels; j++) {
+        int *level = &data->table[j * data->nblocks];
+        const int *prev = &data->table[(j - 1) * data->nblocks];
+        for (int b = 0; b + (1 << j) <= data->nblocks; b++) {
+            level[b] = better(data, prev[b], prev[b + (1 << (j - 1))]);
+        }
+    }
+
+    data->size = sizeof(struct prefix_data) + bytes
+        + (count > 0 ? count : 1) * sizeof(struct prefix_entry)
+        + (data->n > 0 ? data->n : 1) * sizeof(double)
+        + ((size_t)data->levels * data->nblocks + 1) * sizeof(int);
+
+    data->heap_capacity = 64;
+    data->heap = malloc(data->heap_capacity * sizeof(struct range));
+    if (!data->heap) {
+        fprintf(stderr, "Error: Failed to allocate memory for query heap.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return data;
+}
+
+// Function to free the prefix index
+void free_prefix(struct prefix_data *data) {
+    if (data) {
+        bigmem_free(data->entries);
+        bigmem_free(data->importance);
+        bigmem_free(data->pool);
+        bigmem_free(data->table);
+        free(data->heap);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the prefix_data structure
+// The query heap may have grown since the index was built.
+// Input: Pointer to the prefix_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_prefix(struct prefix_data *data) {
+    return data->size + (size_t)data->heap_capacity * sizeof(struct range);
+}
+
+// Push a non-empty range onto the query heap, which is ordered with
+// the most important range first.
+static void heap_push(struct prefix_data *data, int *size, int lo, int hi) {
+    if (lo >= hi) return;
+
+    if (*size == data->heap_capacity) {
+        data->heap_capacity *= 2;
+        data->heap = realloc(data->heap, data->heap_capacity * sizeof(struct range));
+        if (!data->heap) {
+            fprintf(stderr, "Error: Failed to grow query heap.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct range r = { lo, hi, range_best(data, lo, hi) };
+    int i = (*size)++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (better(data, data->heap[parent].best, r.best) == data->heap[parent].best) break;
+        data->heap[i] = data->heap[parent];
+        i = parent;
+    }
+    data->heap[i] = r;
+}
+
+// Remove and return the most important range from the query heap.
+static struct range heap_pop(struct prefix_data *data, int *size) {
+    struct range top = data->heap[0];
+    struct range last = data->heap[--(*size)];
+    int i = 0;
+    while (2 * i + 1 < *size) {
+        int child = 2 * i + 1;
+        if (child + 1 < *size &&
+            better(data, data->heap[child].best, data->heap[child + 1].best) != data->heap[child].best) {
+            child++;
+        }
+        if (better(data, last.best, data->heap[child].best) == last.best) break;
+        data->heap[i] = data->heap[child];
+        i = child;
+    }
+    data->heap[i] = last;
+    return top;
+}
+
+// First entry whose key, compared to the first 'len' bytes of the
+// prefix with strncmp(), gives a result greater than 'above'.
+static int search(const struct prefix_data *data, const char *prefix, size_t len, int above) {
+    int lo = 0, hi = data->n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(data->entries[mid].key, prefix, len) > above) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// Find the most important records with a name starting with a prefix
+// Input: Pointer to prefix_data, the prefix, maximum number of results, output array
+// Output: Number of records stored in 'out'
+int lookup_prefix(struct prefix_data *data, const char *query, int k, const struct record **out) {
+    size_t size = strlen(query) + 1;
+    char *prefix = malloc(size);
+    if (!prefix) {
+        fprintf(stderr, "Error: Failed to allocate memory for query.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = normalise_name(prefix, query, size);
+
+    int lo = search(data, prefix, len, -1);
+    int hi = search(data, prefix, len, 0);
+    free(prefix);
+
+    int size_heap = 0;
+    int found = 0;
+    heap_push(data, &size_heap, lo, hi);
+
+    while (found < k && size_heap > 0) {
+        struct range r = heap_pop(data, &size_heap);
+        const struct record *rec = &data->rs[data->entries[r.best].row];
+
+        // A record may match through several of its names.
+        int seen = 0;
+        for (int i = 0; i < found && !seen; i++) {
+            seen = out[i] == rec;
+        }
+        if (!seen) {
+            out[found++] = rec;
+        }
+
+        heap_push(data, &size_heap, r.lo, r.best);
+        heap_push(data, &size_heap, r.best + 1, r.hi);
+    }
+
+    return found;
+}
+
+// Main function to run the query loop with the prefix index
+int main(int argc, char** argv) {
+    return name_query_loop(argc, argv,
+                           (mk_index_fn)mk_prefix,
+                           (free_index_fn)free_prefix,
+                           (lookup_fn)lookup_prefix,
+                           (index_size_fn)index_size_prefix);
+}
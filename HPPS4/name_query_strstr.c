@@ -0,0 +1,70 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "record.h"
+#include "name_query.h"
+
+// Substring search over display_name by scanning every record.  This
+// is the baseline for name_query_trigram.c, and the two should always
+// produce the same answers.
+
+// Structure to hold the dataset for naive searching
+struct strstr_data {
+    const struct record *rs; // Pointer to array of records
+    int n;                   // Number of records
+};
+
+// Function to create and initialize the strstr_data structure
+// Input: Array of records (rs) and the number of records (n)
+// Output: Pointer to initialized strstr_data structure
+struct strstr_data* mk_strstr(const struct record *rs, int n) {
+    struct strstr_data *data = malloc(sizeof(struct strstr_data));
+    if (!data) {
+        fprintf(stderr, "Error: Failed to allocate memory for strstr_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    data->rs = rs;
+    data->n = n;
+    return data;
+}
+
+// Function to free the strstr_data structure
+void free_strstr(struct strstr_data *data) {
+    free(data);
+}
+
+// Function to report the bytes allocated for the strstr_data structure
+// Input: Pointer to the strstr_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_strstr(struct strstr_data *data) {
+    (void)data;
+    return sizeof(struct strstr_data);
+}
+
+// Find the most important records whose display_name contains a string
+// Input: Pointer to strstr_data, the string, maximum number of results, output array
+// Output: Number of records stored in 'out'
+int lookup_strstr(struct strstr_data *data, const char *query, int k, const struct record **out) {
+    int found = 0;
+
+    for (int i = 0; i < data->n; i++) {
+        if (strcasestr(record_string(&data->rs[i], RECORD_DISPLAY_NAME), query)) {
+            keep_most_important(&data->rs[i], k, out, &found);
+        }
+    }
+
+    return found;
+}
+
+// Main function to run the query loop with the naive implementation
+int main(int argc, char** argv) {
+    return name_query_loop(argc, argv,
+                           (mk_index_fn)mk_strstr,
+                           (free_index_fn)free_strstr,
+                           (lookup_fn)lookup_strstr,
+                           (index_size_fn)index_size_strstr);
+}
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "record.h"
+#include "name_query.h"
+#include "bigmem.h"
+
+// Substring search over display_name with a trigram inverted index.
+// For every three-byte sequence (trigram) occurring in a normalised
+// display_name, the index stores the sorted list of records
+// containing it.  The lists are compressed by storing the differences
+// between consecutive record numbers as variable-length integers
+// (seven bits per byte, high bit set on all but the last byte).
+//
+// A query is normalised, split into its distinct trigrams, and the
+// lists of those trigrams are intersected, starting with the shortest.
+// Intersections use AVX2 when available.  Every surviving record is
+// then verified against its display_name, since containing all the
+// trigrams of a string does not imply containing the string, and the
+// matches are ranked by importance.  Queries shorter than a trigram
+// are answered by scanning all records.
+
+// Structure to store the posting list of one trigram
+struct trigram_entry {
+    uint32_t trigram;   // The three bytes, packed into the low 24 bits
+    uint32_t count;     // Number of records in the list
+    size_t offset;      // Start of the list in the postings array
+};
+
+// Signature of an intersection kernel: store the elements common to
+// the sorted arrays a and b in out, and return how many there are.
+typedef int (*intersect_fn)(const uint32_t *a, int na, const uint32_t *b, int nb, uint32_t *out);
+
+// Structure to hold the trigram index
+struct trigram_data {
+    const struct record *rs;         // Pointer to the array of records
+    int n;                           // Number of records
+    struct trigram_entry *trigrams;  // Posting list directory, sorted by trigram
+    int ntrigrams;                   // Number of distinct trigrams
+    unsigned char *postings;         // All compressed posting lists
+    size_t postings_size;            // Size of 'postings' in bytes
+    uint32_t *candidates;            // Scratch: records matching so far
+    uint32_t *decoded;               // Scratch: a decoded posting list
+    intersect_fn intersect;          // Intersection kernel
+};
+
+// Entry of the hash table used while building.  Each trigram gets a
+// growing buffer that its compressed list is appended to.
+struct build_slot {
+    uint32_t trigram;     // Trigram + 1, or 0 for an empty slot
+    uint32_t count;       // Records in the list so far
+    uint32_t last;        // Last record added
+    unsigned char *bytes; // Compressed list
+    size_t size, capacity;
+};
+
+struct build_table {
+    struct build_slot *slots;
+    size_t capacity;      // A power of two
+    size_t used;
+};
+
+// Pack the three bytes at 's' into a trigram.
+static uint32_t trigram_at(const char *s) {
+    return ((uint32_t)(unsigned char)s[0] << 16) |
+           ((uint32_t)(unsigned char)s[1] << 8) |
+           (uint32_t)(unsigned char)s[2];
+}
+
+// Find (or insert) the slot for a trigram.
+static struct build_slot* build_slot(struct build_table *t, uint32_t trigram) {
+    if (2 * (t->used + 1) > t->capacity) {
+        // Grow and rehash.
+        struct build_table bigger = { calloc(2 * t->capacity, sizeof(struct build_slot)),
+                                      2 * t->capacity, 0 };
+        if (!bigger.slots) {
+            fprintf(stderr, "Error: Failed to grow trigram table.\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < t->capacity; i++) {
+            if (t->slots[i].trigram) {
+                *build_slot(&bigger, t->slots[i].trigram - 1) = t->slots[i];
+            }
+        }
+        bigger.used = t->used;
+        free(t->slots);
+        *t = bigger;
+    }
+
+    size_t i = (trigram * 2654435761u) & (t->capacity - 1);
+    while (t->slots[i].trigram && t->slots[i].trigram != trigram + 1) {
+        i = (i + 1) & (t->capacity - 1);
+    }
+    if (!t->slots[i].trigram) {
+        t->slots[i].trigram = trigram + 1;
+        t->used++;
+    }
+    return &t->slots[i];
+}
+
+// Append a record to the list of a trigram, unless it is already the
+// last record in it.
+static void build_add(struct build_slot *s, uint32_t row) {
+    if (s->count > 0 && s->last == row) return;
+
+    uint32_t delta = s->count > 0 ? row - s->last : row;
+    if (s->size + 5 > s->capacity) {
+        s->capacity = s->capacity ? 2 * s->capacity : 8;
+        s->bytes = realloc(s->bytes, s->capacity);
+        if (!s->bytes) {
+            fprintf(stderr, "Error: Failed to grow posting list.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    while (delta >= 0x80) {
+        s->bytes[s->size++] = (delta & 0x7f) | 0x80;
+        delta >>= 7;
+    }
+    s->bytes[s->size++] = delta;
+    s->count++;
+    s->last = row;
+}
+
+// Decode a posting list into 'out'.
+static void decode(const struct trigram_data *data, const struct trigram_entry *e, uint32_t *out) {
+    const unsigned char *p = &data->postings[e->offset];
+    uint32_t row = 0;
+    for (uint32_t i = 0; i < e->count; i++) {
+        uint32_t delta = 0;
+        int shift = 0;
+        while (*p & 0x80) {
+            delta |= (uint32_t)(*p++ & 0x7f) << shift;
+            shift += 7;
+        }
+        delta |= (uint32_t)*p++ << shift;
+        row = i == 0 ? delta : row + delta;
+        out[i] = row;
+    }
+}
+
+// Scalar intersection by merging.
+static int intersect_scalar(const uint32_t *a, int na, const uint32_t *b, int nb, uint32_t *out) {
+    int i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            out[k++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return k;
+}
+
+// AVX2 intersection, for 'a' no longer than 'b'.  For each element of
+// 'a', whole blocks of eight elements of 'b' are skipped while they
+// are all smaller, and the element is then compared against a block
+// in a single instruction.
+__attribute__((target("avx2")))
+static int intersect_avx2(const uint32_t *a, int na, const uint32_t *b, int nb, uint32_t *out) {
+    int i = 0, j = 0, k = 0;
+    for (; i < na && j + 8 <= nb; i++) {
+        while (j + 8 <= nb && b[j + 7] < a[i]) {
+            j += 8;
+        }
+        if (j + 8 > nb) break;
+        __m256i block = _mm256_loadu_si256((const __m256i*)&b[j]);
+        __m256i eq = _mm256_cmpeq_epi32(block, _mm256_set1_epi32((int)a[i]));
+        if (!_mm256_testz_si256(eq, eq)) {
+            out[k++] = a[i];
+        }
+    }
+    return k + intersect_scalar(&a[i], na - i, &b[j], nb - j, &out[k]);
+}
+
+// Comparison function for qsort and bsearch on trigram entries
+static int compare_trigram(const void *a, const void *b) {
+    uint32_t x = ((const struct trigram_entry*)a)->trigram;
+    uint32_t y = ((const struct trigram_entry*)b)->trigram;
+    return (x > y) - (x < y);
+}
+
+// Function to create the trigram index
+// Input: Array of records (rs) and number of records (n)
+// Output: Pointer to trigram_data structure
+struct trigram_data* mk_trigram(const struct record *rs, int n) {
+    struct trigram_data *data = malloc(sizeof(struct trigram_data));
+    struct build_table table = { calloc(1024, sizeof(struct build_slot)), 1024, 0 };
+    if (!data || !table.slots) {
+        fprintf(stderr, "Error: Failed to allocate memory for trigram_data.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *buf = NULL;
+    size_t buf_size = 0;
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(record_string(&rs[i], RECORD_DISPLAY_NAME));
+        if (len + 1 > buf_size) {
+            buf_size = 2 * (len + 1);
+            buf = realloc(buf, buf_size);
+            if (!buf) {
+                fprintf(stderr, "Error: Failed to allocate name buffer.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        normalise_name(buf, record_string(&rs[i], RECORD_DISPLAY_NAME), len + 1);
+        for (size_t j = 0; j + 3 <= len; j++) {
+            build_add(build_slot(&table, trigram_at(&buf[j])), i);
+        }
+    }
+    free(buf);
+
+    // Move the lists into one array, in trigram order.
+    data->rs = rs;
+    data->n = n;
+    data->ntrigrams = table.used;
+    data->trigrams = bigmem_alloc((table.used + 1) * sizeof(struct trigram_entry));
+    data->postings_size = 0;
+    for (size_t i = 0; i < table.capacity; i++) {
+        data->postings_size += table.slots[i].size;
+    }
+    data->postings = bigmem_alloc(data->postings_size + 1);
+    if (!data->trigrams || !data->postings) {
+        fprintf(stderr, "Error: Failed to allocate memory for posting lists.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int t = 0;
+    for (size_t i = 0; i < table.capacity; i++) {
+        struct build_slot *s = &table.slots[i];
+        if (s->trigram) {
+            data->trigrams[t].trigram = s->trigram - 1;
+            data->trigrams[t].count = s->count;
+            data->trigrams[t].offset = 0;
+            t++;
+        }
+    }
+    qsort(data->trigrams, data->ntrigrams, sizeof(struct trigram_entry), compare_trigram);
+
+    size_t offset = 0;
+    for (int i = 0; i < data->ntrigrams; i++) {
+        struct build_slot *s = build_slot(&table, data->trigrams[i].trigram);
+        memcpy(&data->postings[offset], s->bytes, s->size);
+        data->trigrams[i].offset = offset;
+        offset += s->size;
+        free(s->bytes);
+    }
+    free(table.slots);
+
+    data->candidates = bigmem_alloc((n > 0 ? n : 1) * sizeof(uint32_t));
+    data->decoded = bigmem_alloc((n > 0 ? n : 1) * sizeof(uint32_t));
+    if (!data->candidates || !data->decoded) {
+        fprintf(stderr, "Error: Failed to allocate memory for query buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    __builtin_cpu_init();
+    data->intersect = __builtin_cpu_supports("avx2") ? intersect_avx2 : intersect_scalar;
+
+    fprintf(stderr, "Trigram index: %d trigrams, %zu bytes of postings\n",
+            data->ntrigrams, data->postings_size);
+
+    return data;
+}
+
+// Function to free the trigram index
+void free_trigram(struct trigram_data *data) {
+    if (data) {
+        bigmem_free(data->trigrams);
+        bigmem_free(data->postings);
+        bigmem_free(data->candidates);
+        bigmem_free(data->decoded);
+        free(data);
+    }
+}
+
+// Function to report the bytes allocated for the trigram_data structure
+// Input: Pointer to the trigram_data structure
+// Output: Number of bytes, not counting the records
+size_t index_size_trigram(struct trigram_data *data) {
+    return sizeof(struct trigram_data)
+        + ((size_t)data->ntrigrams + 1) * sizeof(struct trigram_entry)
+        + data->postings_size + 1
+        + 2 * (size_t)(data->n > 0 ? data->n : 1) * sizeof(uint32_t);
+}
+
+// Comparison function for ordering trigram entries by list length
+static int compare_count(const void *a, const void *b) {
+    uint32_t x = (*(const struct trigram_entry* const*)a)->count;
+    uint32_t y = (*(const struct trigram_entry* const*)b)->count;
+    return (x > y) - (x < y);
+}
+
+// Find the most important records whose display_name contains a string
+// Input: Pointer to trigram_data, the string, maximum number of results, output array
+// Output: Number of records stored in 'out'
+int lookup_trigram(struct trigram_data *data, const char *query, int k, const struct record **out) {
+    size_t size = strlen(query) + 1;
+    if (k <= 0) return 0;
+
+    int found = 0;
+    if (size - 1 < 3) {
+        for (int i = 0; i < data->n; i++) {
+            if (strcasestr(record_string(&data->rs[i], RECORD_DISPLAY_NAME), query)) {
+                keep_most_important(&data->rs[i], k, out, &found);
+            }
+        }
+        return found;
+    }
+
+    char *norm = malloc(size);
+    const struct trigram_entry **lists = malloc(size * sizeof(struct trigram_entry*));
+    if (!norm || !lists) {
+        fprintf(stderr, "Error: Failed to allocate memory for query.\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = normalise_name(norm, query, size);
+
+    // Look up the posting list of every trigram in the query.
+    int nlists = 0;
+    for (size_t j = 0; j + 3 <= len; j++) {
+        struct trigram_entry key = { trigram_at(&norm[j]), 0, 0 };
+        const struct trigram_entry *e = bsearch(&key, data->trigrams, data->ntrigrams,
+                                                sizeof(struct trigram_entry), compare_trigram);
+        if (!e) {
+            nlists = -1;
+            break;
+        }
+        lists[nlists++] = e;
+    }
+    free(norm);
+
+    int ncand = 0;
+    if (nlists > 0) {
+        // Start from the shortest list, so the candidate set is
+        // small from the beginning.
+        qsort(lists, nlists, sizeof(struct trigram_entry*), compare_count);
+        decode(data, lists[0], data->candidates);
+        ncand = lists[0]->count;
+
+        for (int l = 1; l < nlists && ncand > 0; l++) {
+            if (lists[l] == lists[l - 1]) continue;
+            decode(data, lists[l], data->decoded);
+            ncand = data->intersect(data->candidates, ncand, data->decoded, lists[l]->count,
+                                    data->candidates);
+        }
+    }
+    free(lists);
+
+    for (int i = 0; i < ncand; i++) {
+        const struct record *r = &data->rs[data->candidates[i]];
+        if (strcasestr(record_string(r, RECORD_DISPLAY_NAME), query)) {
+            keep_most_important(r, k, out, &found);
+        }
+    }
+
+    return found;
+}
+
+// Main function to run the query loop with the trigram index
+int main(int argc, char** argv) {
+    return name_query_loop(argc, argv,
+                           (mk_index_fn)mk_trigram,
+                           (free_index_fn)free_trigram,
+                           (lookup_fn)lookup_trigram,
+                           (index_size_fn)index_size_trigram);
+}
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+
+#define OUTBUF_SIZE (1 << 20)
+
+// Longest text appended in one go by the number routines, except for
+// the printf() fallback of outbuf_double(), which goes through
+// outbuf_str().
+#define MAX_NUMBER 32
+
+struct outbuf {
+  int fd;
+  size_t len;
+  char buf[OUTBUF_SIZE];
+};
+
+struct outbuf* outbuf_create(int fd) {
+  struct outbuf *b = malloc(sizeof(struct outbuf));
+  if (!b) {
+    fprintf(stderr, "Error: Failed to allocate memory for output buffer.\n");
+    exit(EXIT_FAILURE);
+  }
+  b->fd = fd;
+  b->len = 0;
+  return b;
+}
+
+void outbuf_free(struct outbuf *b) {
+  if (b) {
+    outbuf_flush(b);
+    free(b);
+  }
+}
+
+void outbuf_flush(struct outbuf *b) {
+  size_t done = 0;
+  while (done < b->len) {
+    ssize_t n = write(b->fd, b->buf+done, b->len-done);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Error: Failed to write output (errno: %s)\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    done += n;
+  }
+  b->len = 0;
+}
+
+// Make room for at least 'n' more bytes, which must be at most
+// OUTBUF_SIZE.
+static void reserve(struct outbuf *b, size_t n) {
+  if (b->len+n > OUTBUF_SIZE) {
+    outbuf_flush(b);
+  }
+}
+
+void outbuf_str(struct outbuf *b, const char *s) {
+  size_t n = strlen(s);
+  while (n > 0) {
+    if (b->len == OUTBUF_SIZE) {
+      outbuf_flush(b);
+    }
+    size_t chunk = OUTBUF_SIZE-b->len < n ? OUTBUF_SIZE-b->len : n;
+    memcpy(b->buf+b->len, s, chunk);
+    b->len += chunk;
+    s += chunk;
+    n -= chunk;
+  }
+}
+
+void outbuf_char(struct outbuf *b, char c) {
+  reserve(b, 1);
+  b->buf[b->len++] = c;
+}
+
+// Append the decimal digits of x, padded with zeroes to at least
+// 'width' digits.
+static void append_digits(struct outbuf *b, uint64_t x, int width) {
+  char digits[MAX_NUMBER];
+  int n = 0;
+  do {
+    digits[n++] = '0' + x % 10;
+    x /= 10;
+  } while (x > 0);
+  while (n < width) {
+    digits[n++] = '0';
+  }
+
+  reserve(b, n);
+  while (n > 0) {
+    b->buf[b->len++] = digits[--n];
+  }
+}
+
+void outbuf_long(struct outbuf *b, long x) {
+  if (x < 0) {
+    outbuf_char(b, '-');
+    // Negate in unsigned arithmetic, so that LONG_MIN works too.
+    append_digits(b, -(uint64_t)x, 1);
+  } else {
+    append_digits(b, x, 1);
+  }
+}
+
+void outbuf_double(struct outbuf *b, double x) {
+  // x*1e6 rounded to the nearest integer gives the digits to print.
+  // The multiplication itself may be off by half a unit in the last
+  // place, which only matters when the exact product is that close to
+  // halfway between two integers.  Those cases, and numbers too large
+  // for the integer arithmetic, NaNs and infinities, are left to
+  // printf(), which always rounds correctly.
+  double y = fabs(x) * 1e6;
+  if (y < 4503599627370496.0) { // 2^52
+    uint64_t digits = (uint64_t)y;
+    double frac = y - (double)digits;
+    if (fabs(frac - 0.5) > y * 0x1p-50) {
+      if (frac > 0.5) {
+        digits++;
+      }
+      if (signbit(x)) {
+        outbuf_char(b, '-');
+      }
+      append_digits(b, digits / 1000000, 1);
+      outbuf_char(b, '.');
+      append_digits(b, digits % 1000000, 6);
+      return;
+    }
+  }
+
+  char text[512];
+  snprintf(text, sizeof(text), "%f", x);
+  outbuf_str(b, text);
+}
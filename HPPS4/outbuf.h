@@ -0,0 +1,43 @@
+// Buffered output for the query loops.  Writing a result with printf()
+// can cost more than looking it up, so the loops instead append their
+// output to a large buffer, with dedicated routines for formatting
+// numbers, and hand it to the kernel in a few big write() calls.  The
+// text produced is exactly what the corresponding printf() conversions
+// would produce.
+//
+// The buffer writes straight to a file descriptor, bypassing stdio, so
+// anything printed to the same file with stdio must be flushed with
+// fflush() before the buffer is used, and the buffer must be flushed
+// before stdio is used again.
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdint.h>
+
+// An opaque struct representing an output buffer.
+struct outbuf;
+
+// Create a buffer that writes to the file descriptor 'fd'.  Exits the
+// program if out of memory.
+struct outbuf* outbuf_create(int fd);
+
+// Flush and free the buffer.  The file descriptor is not closed.
+void outbuf_free(struct outbuf *b);
+
+// Write out the buffered text.  Exits the program if writing fails.
+void outbuf_flush(struct outbuf *b);
+
+// Append a NUL-terminated string, like printf("%s").
+void outbuf_str(struct outbuf *b, const char *s);
+
+// Append a single character.
+void outbuf_char(struct outbuf *b, char c);
+
+// Append an integer in decimal, like printf("%ld").
+void outbuf_long(struct outbuf *b, long x);
+
+// Append a double with six decimals, like printf("%f").
+void outbuf_double(struct outbuf *b, double x);
+
+#endif
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf_counters.h"
+
+// The counters are opened as one group, so that they are scheduled
+// onto the hardware together and can all be read with a single read()
+// of the group leader.  A counter that cannot be opened is left out of
+// the group.
+struct perf_counters {
+  int leader;                       // File descriptor of the group leader
+  int fds[PERF_NUM_COUNTERS];       // -1 for counters that are not open
+  int slot[PERF_NUM_COUNTERS];      // Position of each counter in a group read
+  int nopen;
+};
+
+static const char *counter_names[PERF_NUM_COUNTERS] = {
+  "cycles", "instructions", "LLC misses", "branch misses", "dTLB misses"
+};
+
+static void describe(enum perf_counter c, struct perf_event_attr *attr) {
+  memset(attr, 0, sizeof(*attr));
+  attr->size = sizeof(*attr);
+  attr->exclude_kernel = 1;
+  attr->exclude_hv = 1;
+  attr->read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+    | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  switch (c) {
+  case PERF_CYCLES:
+    attr->type = PERF_TYPE_HARDWARE;
+    attr->config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case PERF_INSTRUCTIONS:
+    attr->type = PERF_TYPE_HARDWARE;
+    attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case PERF_LLC_MISSES:
+    attr->type = PERF_TYPE_HARDWARE;
+    attr->config = PERF_COUNT_HW_CACHE_MISSES;
+    break;
+  case PERF_BRANCH_MISSES:
+    attr->type = PERF_TYPE_HARDWARE;
+    attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+    break;
+  default:
+    attr->type = PERF_TYPE_HW_CACHE;
+    attr->config = PERF_COUNT_HW_CACHE_DTLB
+      | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  }
+}
+
+struct perf_counters* perf_counters_open(void) {
+  const char *env = getenv("PERF_COUNTERS");
+  if (!env || !*env || strcmp(env, "0") == 0) {
+    return NULL;
+  }
+
+  struct perf_counters *pc = malloc(sizeof(struct perf_counters));
+  if (!pc) {
+    return NULL;
+  }
+  pc->leader = -1;
+  pc->nopen = 0;
+
+  for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+    struct perf_event_attr attr;
+    describe(c, &attr);
+    // The leader starts disabled, so that the whole group starts
+    // counting at once below.
+    attr.disabled = pc->leader < 0;
+    pc->fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, pc->leader, 0);
+    pc->slot[c] = -1;
+    if (pc->fds[c] >= 0) {
+      if (pc->leader < 0) {
+        pc->leader = pc->fds[c];
+      }
+      pc->slot[c] = pc->nopen++;
+    }
+  }
+
+  if (pc->nopen == 0) {
+    fprintf(stderr, "Performance counters are unavailable; see perf_event_paranoid\n");
+    free(pc);
+    return NULL;
+  }
+
+  ioctl(pc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return pc;
+}
+
+void perf_counters_close(struct perf_counters *pc) {
+  if (pc) {
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+      if (pc->fds[c] >= 0) {
+        close(pc->fds[c]);
+      }
+    }
+    free(pc);
+  }
+}
+
+void perf_counters_read(const struct perf_counters *pc, struct perf_sample *s) {
+  memset(s, 0, sizeof(*s));
+  if (!pc) {
+    return;
+  }
+
+  // nr, time_enabled, time_running, then one value per counter.
+  uint64_t buf[3+PERF_NUM_COUNTERS];
+  if (read(pc->leader, buf, sizeof(buf)) < (ssize_t)((3+pc->nopen)*sizeof(uint64_t))) {
+    return;
+  }
+
+  // The counts are scaled only once they are differences, as the
+  // share of time the group ran may change between readings, and
+  // scaling each total by its own share would not subtract.
+  s->time_enabled = buf[1];
+  s->time_running = buf[2];
+  for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+    if (pc->slot[c] >= 0) {
+      s->value[c] = buf[3+pc->slot[c]];
+    }
+  }
+}
+
+void perf_sample_accumulate(struct perf_sample *sum, const struct perf_sample *before,
+                            const struct perf_sample *after) {
+  uint64_t enabled = after->time_enabled - before->time_enabled;
+  uint64_t running = after->time_running - before->time_running;
+  double scale = running > 0 ? (double)enabled / running : 1;
+  for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+    sum->value[c] += (uint64_t)((after->value[c] - before->value[c]) * scale);
+  }
+  sum->time_enabled += enabled;
+  sum->time_running += running;
+}
+
+void perf_counters_print(const struct perf_counters *pc, FILE *f, const char *label,
+                         const struct perf_sample *sample, uint64_t divisor) {
+  if (!pc) {
+    return;
+  }
+  if (divisor == 0) {
+    divisor = 1;
+  }
+
+  fprintf(f, "Counters (%s, this thread):", label);
+  for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+    fprintf(f, "%s %s ", c == 0 ? "" : ",", counter_names[c]);
+    if (pc->slot[c] < 0) {
+      fprintf(f, "n/a");
+    } else if (divisor == 1) {
+      fprintf(f, "%lu", (unsigned long)sample->value[c]);
+    } else {
+      fprintf(f, "%.1f", (double)sample->value[c] / divisor);
+    }
+  }
+  fprintf(f, "\n");
+}
@@ -0,0 +1,68 @@
+// Hardware performance counters for the phases of a program, read
+// with perf_event_open(2).  This tells whether a slow phase is
+// spending its time on cache misses, branch mispredictions or TLB
+// misses, which wall-clock time cannot.
+//
+// Counting is off unless the environment variable PERF_COUNTERS is
+// set to a non-empty value other than 0, as reading the counters
+// around every query adds a system call to each.  Counters that the
+// machine or the kernel's perf_event_paranoid setting does not allow
+// are reported as "n/a", and if none are allowed, nothing is reported
+// at all.  Only user-space events are counted.
+//
+// Only the thread that opened the counters is counted.  Work it hands
+// to other threads, such as the scan threads of coord_query_simd.c or
+// the thread of a build pipeline, is missing from the counts, which is
+// why the printed lines say "this thread".
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum perf_counter {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_DTLB_MISSES,
+  PERF_NUM_COUNTERS
+};
+
+// Counter values, either at a point in time or accumulated over some
+// intervals.  A reading holds the raw counts, and the time the counters
+// were enabled and actually running; sums of the differences between
+// readings hold counts that have been scaled up to the time enabled.
+struct perf_sample {
+  uint64_t value[PERF_NUM_COUNTERS];
+  uint64_t time_enabled, time_running;
+};
+
+// An opaque struct representing a set of open counters.
+struct perf_counters;
+
+// Open the counters for the calling thread, if PERF_COUNTERS asks for
+// them.  Returns NULL if counting is off or no counter could be
+// opened; the other functions accept NULL and then do nothing.
+struct perf_counters* perf_counters_open(void);
+
+void perf_counters_close(struct perf_counters *pc);
+
+// Read the current values.
+void perf_counters_read(const struct perf_counters *pc, struct perf_sample *s);
+
+// Add the difference between two readings to 'sum'.  If the counters
+// had to share the hardware with other events in between, the
+// difference is scaled up to the whole time they were enabled.
+void perf_sample_accumulate(struct perf_sample *sum, const struct perf_sample *before,
+                            const struct perf_sample *after);
+
+// Print one line with the counts in 'sample' divided by 'divisor',
+// for example
+//
+//   Counters (build, this thread): cycles 81251, instructions 90712, LLC misses 12, branch misses 410, dTLB misses n/a
+void perf_counters_print(const struct perf_counters *pc, FILE *f, const char *label,
+                         const struct perf_sample *sample, uint64_t divisor);
+
+#endif
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "query_server.h"
+#include "histogram.h"
+#include "timing.h"
+
+// Load generator and client for the query servers (see
+// query_server.h), for example
+//
+//   ./id_query_binsort --serve /tmp/ids.sock planet-latest_geonames.tsv &
+//   ./workload -t id planet-latest_geonames.tsv | ./query_client -c 4 -d 64 /tmp/ids.sock id
+//
+// The queries are read from stdin, in the same format as for the
+// query loops, and sent over several connections (-c), each with up to
+// a given number of requests in flight (-d).  The results are printed
+// in the order of the queries, in the format of the query loops,
+// followed by the throughput and a histogram of the time from sending
+// each request to receiving its response.  With -q, only the
+// measurements are printed.
+
+// Largest response: the fixed part plus a name.
+#define MAX_NAME 65536
+
+struct connection {
+  int fd;
+  int in_flight;     // Requests sent but not answered
+  char *in;          // Received bytes not yet handled
+  size_t in_len;
+  char *out;         // Requests not yet sent are out[out_sent..out_len)
+  size_t out_len, out_sent;
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-c CONNECTIONS] [-d DEPTH] [-q] SOCKET id|coord\n", prog);
+  exit(1);
+}
+
+static void* checked_malloc(size_t size) {
+  void *p = malloc(size > 0 ? size : 1);
+  if (!p) {
+    fprintf(stderr, "Error: Failed to allocate memory for client.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static int connect_to(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Failed to connect to %s (errno: %s)\n", path, strerror(errno));
+    exit(1);
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+// Read all queries from stdin.
+static struct query_request* read_queries(int coords, long *count) {
+  long n = 0, capacity = 1024;
+  struct query_request *reqs = checked_malloc(capacity * sizeof(struct query_request));
+  char *line = NULL;
+  size_t line_len;
+
+  while (getline(&line, &line_len, stdin) != -1) {
+    if (n == capacity) {
+      capacity *= 2;
+      reqs = realloc(reqs, capacity * sizeof(struct query_request));
+      if (!reqs) {
+        fprintf(stderr, "Error: Failed to allocate memory for queries.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    struct query_request *req = &reqs[n];
+    memset(req, 0, sizeof(*req));
+    req->tag = (uint32_t)n;
+    if (coords) {
+      req->type = QUERY_COORD;
+      sscanf(line, "%lf %lf", &req->lon, &req->lat);
+    } else {
+      req->type = QUERY_ID;
+      req->id = atol(line);
+    }
+    n++;
+  }
+
+  free(line);
+  *count = n;
+  return reqs;
+}
+
+// Format a result as the query loops would print it.
+static char* format_result(const struct query_request *req, const struct query_response *resp,
+                           const char *name) {
+  char *text = NULL;
+  int ok;
+  if (req->type == QUERY_ID && resp->status == QUERY_FOUND) {
+    ok = asprintf(&text, "%ld: %.*s %f %f\n", (long)req->id, (int)resp->name_len, name,
+                  resp->lon, resp->lat);
+  } else if (req->type == QUERY_ID) {
+    ok = asprintf(&text, "%ld: not found\n", (long)req->id);
+  } else if (resp->status == QUERY_FOUND) {
+    ok = asprintf(&text, "(%f,%f): %.*s (%f,%f)\n", req->lon, req->lat,
+                  (int)resp->name_len, name, resp->lon, resp->lat);
+  } else {
+    ok = asprintf(&text, "(%f,%f): not found\n", req->lon, req->lat);
+  }
+  if (ok < 0) {
+    fprintf(stderr, "Error: Failed to allocate memory for result.\n");
+    exit(EXIT_FAILURE);
+  }
+  return text;
+}
+
+int main(int argc, char** argv) {
+  int nconns = 1, depth = 1, quiet = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:d:q")) != -1) {
+    switch (opt) {
+    case 'c':
+      nconns = atoi(optarg);
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc-2 || nconns < 1 || depth < 1 ||
+      (strcmp(argv[optind+1], "id") != 0 && strcmp(argv[optind+1], "coord") != 0)) {
+    usage(argv[0]);
+  }
+  const char *path = argv[optind];
+  int coords = strcmp(argv[optind+1], "coord") == 0;
+
+  long n;
+  struct query_request *reqs = read_queries(coords, &n);
+  uint64_t *sent_at = checked_malloc(n * sizeof(uint64_t));
+  char **results = quiet ? NULL : calloc(n > 0 ? n : 1, sizeof(char*));
+  struct histogram *latency = histogram_create();
+  if ((!quiet && !results) || !latency) {
+    fprintf(stderr, "Error: Failed to allocate memory for results.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t in_size = sizeof(struct query_response) + MAX_NAME;
+  struct connection *conns = checked_malloc(nconns * sizeof(struct connection));
+  struct pollfd *fds = checked_malloc(nconns * sizeof(struct pollfd));
+  for (int i = 0; i < nconns; i++) {
+    conns[i].fd = connect_to(path);
+    conns[i].in_flight = 0;
+    conns[i].in = checked_malloc(in_size);
+    conns[i].in_len = 0;
+    conns[i].out = checked_malloc(depth * sizeof(struct query_request));
+    conns[i].out_len = conns[i].out_sent = 0;
+  }
+
+  long next = 0, done = 0;
+  int failed = 0;
+  uint64_t start = nanoseconds();
+  while (done < n && !failed) {
+    for (int i = 0; i < nconns; i++) {
+      struct connection *c = &conns[i];
+
+      // Top up the requests in flight, once the previous ones are sent.
+      if (c->out_sent == c->out_len) {
+        c->out_len = c->out_sent = 0;
+        uint64_t now = nanoseconds();
+        while (c->in_flight < depth && next < n) {
+          memcpy(c->out+c->out_len, &reqs[next], sizeof(struct query_request));
+          c->out_len += sizeof(struct query_request);
+          sent_at[next] = now;
+          next++;
+          c->in_flight++;
+        }
+      }
+
+      fds[i].fd = c->fd;
+      fds[i].events = (c->in_flight > 0 ? POLLIN : 0) | (c->out_sent < c->out_len ? POLLOUT : 0);
+      fds[i].revents = 0;
+    }
+
+    if (poll(fds, nconns, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "poll failed (errno: %s)\n", strerror(errno));
+      exit(1);
+    }
+
+    for (int i = 0; i < nconns && !failed; i++) {
+      struct connection *c = &conns[i];
+
+      if (fds[i].revents & POLLOUT) {
+        ssize_t k = send(c->fd, c->out+c->out_sent, c->out_len-c->out_sent, MSG_NOSIGNAL);
+        if (k > 0) {
+          c->out_sent += k;
+        } else if (k < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          failed = 1;
+        }
+      }
+
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+        ssize_t k = recv(c->fd, c->in+c->in_len, in_size-c->in_len, 0);
+        if (k > 0) {
+          c->in_len += k;
+        } else if (k == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+          failed = 1;
+        }
+      }
+
+      // Handle the complete responses.
+      size_t pos = 0;
+      uint64_t now = nanoseconds();
+      while (c->in_len-pos >= sizeof(struct query_response)) {
+        struct query_response resp;
+        memcpy(&resp, c->in+pos, sizeof(resp));
+        if (resp.name_len > MAX_NAME || resp.tag >= (uint64_t)n) {
+          fprintf(stderr, "Malformed response from server\n");
+          exit(1);
+        }
+        if (c->in_len-pos < sizeof(resp)+resp.name_len) {
+          break;
+        }
+        const char *name = c->in+pos+sizeof(resp);
+        histogram_record(latency, now-sent_at[resp.tag]);
+        if (!quiet) {
+          results[resp.tag] = format_result(&reqs[resp.tag], &resp, name);
+        }
+        pos += sizeof(resp)+resp.name_len;
+        c->in_flight--;
+        done++;
+      }
+      memmove(c->in, c->in+pos, c->in_len-pos);
+      c->in_len -= pos;
+    }
+  }
+  uint64_t runtime = nanoseconds()-start;
+
+  if (failed) {
+    fprintf(stderr, "Connection to %s lost\n", path);
+  }
+
+  if (!quiet) {
+    for (long i = 0; i < n; i++) {
+      if (results[i]) {
+        fputs(results[i], stdout);
+        free(results[i]);
+      }
+    }
+  }
+  printf("Queries: %ld\n", done);
+  printf("Total time: %dms\n", (int)(runtime/1000000));
+  printf("Throughput: %.0f queries/s\n", runtime > 0 ? done * 1e9 / runtime : 0);
+  histogram_print(latency, stdout, "Query latency");
+
+  for (int i = 0; i < nconns; i++) {
+    close(conns[i].fd);
+    free(conns[i].in);
+    free(conns[i].out);
+  }
+  free(conns);
+  free(fds);
+  free(results);
+  free(sent_at);
+  free(reqs);
+  histogram_free(latency);
+  return failed;
+}
@@ -0,0 +1,450 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#include "query_server.h"
+#include "histogram.h"
+#include "timing.h"
+
+// Answers queries on a dataset split by shard.c, with a query server
+// (see query_server.h) for each shard, for example
+//
+//   ./shard -t region -n 8 planet-latest_geonames.tsv planet
+//   ./query_router -s ./coord_query_fixed planet.shards coord < coords.txt
+//
+// With -s, the router starts PROGRAM --serve for every shard at once,
+// so the shards are read and indexed in parallel, and stops them when
+// it is done; otherwise the servers must already be running.  The
+// server of shard FILE.tsv listens on FILE.sock.
+//
+// The queries are read from stdin and the results printed in the
+// format of the query loops.  An id is looked up in the one shard
+// whose range of ids holds it, so ids can only be routed when the
+// ranges do not overlap, as when the dataset was split by id.  With a
+// dataset split by region, an id may be in several shards, and which
+// of its records comes first in the dataset is not known.
+//
+// A point is first looked up in the shard whose bounding box is
+// nearest to it, and then in every other shard whose bounding box is
+// nearer than the record found, or as near and lower numbered, as the
+// nearest record may be across a boundary.  Those lookups are sent
+// together, and the nearest of their records wins, with ties going to
+// the lower numbered shard.
+
+// Largest response: the fixed part plus a name.
+#define MAX_NAME 65536
+
+struct shard {
+  int records;
+  int64_t min_id, max_id;
+  double west, south, east, north;
+  char *file;
+  char *socket;
+  pid_t pid;          // The server, if the router started it, or 0
+  int fd;
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-s PROGRAM] [-q] MANIFEST id|coord\n", prog);
+  exit(1);
+}
+
+static void* checked_malloc(size_t size) {
+  void *p = malloc(size > 0 ? size : 1);
+  if (!p) {
+    fprintf(stderr, "Error: Failed to allocate memory for router.\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+// Read the manifest written by shard.c.  The files are named relative
+// to the manifest.
+static struct shard* read_manifest(const char *path, int *count) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "Failed to open %s (errno: %s)\n", path, strerror(errno));
+    exit(1);
+  }
+  const char *slash = strrchr(path, '/');
+  int dir_len = slash ? (int)(slash - path + 1) : 0;
+
+  int n = 0, capacity = 16;
+  struct shard *shards = checked_malloc(capacity * sizeof(struct shard));
+  char *line = NULL;
+  size_t line_len;
+  while (getline(&line, &line_len, f) != -1) {
+    if (line[0] == '#' || line[strspn(line, " \t\n")] == 0) {
+      continue;
+    }
+    if (n == capacity) {
+      capacity *= 2;
+      shards = realloc(shards, capacity * sizeof(struct shard));
+      if (!shards) {
+        fprintf(stderr, "Error: Failed to allocate memory for router.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    struct shard *s = &shards[n];
+    int number, name_at = 0;
+    long min_id, max_id;
+    if (sscanf(line, "%d %d %ld %ld %lf %lf %lf %lf %n", &number, &s->records, &min_id, &max_id,
+               &s->west, &s->south, &s->east, &s->north, &name_at) != 8 || name_at == 0) {
+      fprintf(stderr, "Malformed shard in %s: %s", path, line);
+      exit(1);
+    }
+    s->min_id = min_id;
+    s->max_id = max_id;
+    char *name = line + name_at;
+    name[strcspn(name, "\n")] = 0;
+
+    // FILE.tsv is served on FILE.sock.
+    size_t stem = strlen(name);
+    if (stem > 4 && strcmp(name+stem-4, ".tsv") == 0) {
+      stem -= 4;
+    }
+    int dir = name[0] == '/' ? 0 : dir_len;
+    if (asprintf(&s->file, "%.*s%s", dir, path, name) < 0 ||
+        asprintf(&s->socket, "%.*s%.*s.sock", dir, path, (int)stem, name) < 0) {
+      fprintf(stderr, "Error: Failed to allocate memory for router.\n");
+      exit(EXIT_FAILURE);
+    }
+    s->pid = 0;
+    s->fd = -1;
+    n++;
+  }
+  free(line);
+  fclose(f);
+  *count = n;
+  return shards;
+}
+
+static int try_connect(const char *path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path)-1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+// Start the server of every shard, without waiting for any of them.
+// Their output goes to stderr, to keep it apart from the results, and
+// they are stopped if the router exits without stopping them.
+static void start_servers(struct shard *shards, int n, const char *program) {
+  fflush(stdout);
+  for (int i = 0; i < n; i++) {
+    if (shards[i].records == 0) {
+      continue;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "Failed to start a server (errno: %s)\n", strerror(errno));
+      exit(1);
+    }
+    if (pid == 0) {
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      execlp(program, program, "--serve", shards[i].socket, shards[i].file, (char*)NULL);
+      fprintf(stderr, "Failed to run %s (errno: %s)\n", program, strerror(errno));
+      _exit(127);
+    }
+    shards[i].pid = pid;
+  }
+}
+
+// Connect to the server of every shard.  A server that the router
+// started is waited for, as it only listens once its index is built.
+static int connect_servers(struct shard *shards, int n) {
+  for (int i = 0; i < n; i++) {
+    struct shard *s = &shards[i];
+    if (s->records == 0) {
+      continue;
+    }
+    while ((s->fd = try_connect(s->socket)) < 0) {
+      if (s->pid == 0 || waitpid(s->pid, NULL, WNOHANG) != 0) {
+        fprintf(stderr, "Failed to connect to %s (errno: %s)\n", s->socket, strerror(errno));
+        s->pid = 0;
+        return -1;
+      }
+      struct timespec pause = { 0, 10000000 };
+      nanosleep(&pause, NULL);
+    }
+  }
+  return 0;
+}
+
+static void stop_servers(struct shard *shards, int n) {
+  for (int i = 0; i < n; i++) {
+    if (shards[i].fd >= 0) {
+      close(shards[i].fd);
+    }
+    if (shards[i].pid > 0) {
+      kill(shards[i].pid, SIGTERM);
+      waitpid(shards[i].pid, NULL, 0);
+    }
+  }
+}
+
+static void send_request(struct shard *s, const struct query_request *req) {
+  const char *p = (const char*)req;
+  size_t sent = 0;
+  while (sent < sizeof(*req)) {
+    ssize_t k = send(s->fd, p+sent, sizeof(*req)-sent, MSG_NOSIGNAL);
+    if (k < 0 && errno == EINTR) {
+      continue;
+    }
+    if (k <= 0) {
+      fprintf(stderr, "Connection to %s lost\n", s->socket);
+      exit(1);
+    }
+    sent += k;
+  }
+}
+
+static void receive(struct shard *s, void *buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t k = recv(s->fd, (char*)buf+got, len-got, 0);
+    if (k < 0 && errno == EINTR) {
+      continue;
+    }
+    if (k <= 0) {
+      fprintf(stderr, "Connection to %s lost\n", s->socket);
+      exit(1);
+    }
+    got += k;
+  }
+}
+
+// Receive a response, with its name NUL-terminated in 'name'.
+static void receive_response(struct shard *s, struct query_response *resp, char *name) {
+  receive(s, resp, sizeof(*resp));
+  if (resp->name_len > MAX_NAME) {
+    fprintf(stderr, "Malformed response from %s\n", s->socket);
+    exit(1);
+  }
+  receive(s, name, resp->name_len);
+  name[resp->name_len] = 0;
+}
+
+// The distance the coordinate query programs use.
+static double point_distance(double lon1, double lat1, double lon2, double lat2) {
+  return sqrt((lon1 - lon2) * (lon1 - lon2) + (lat1 - lat2) * (lat1 - lat2));
+}
+
+// Distance from a point to the bounding box of a shard, which is zero
+// inside it.
+static double shard_distance(const struct shard *s, double lon, double lat) {
+  double dx = lon < s->west ? s->west - lon : lon > s->east ? lon - s->east : 0;
+  double dy = lat < s->south ? s->south - lat : lat > s->north ? lat - s->north : 0;
+  return sqrt(dx*dx + dy*dy);
+}
+
+// Whether the ranges of ids of any two shards overlap.
+static int id_ranges_overlap(const struct shard *shards, int n) {
+  for (int i = 0; i < n; i++) {
+    for (int j = i+1; j < n; j++) {
+      if (shards[i].records > 0 && shards[j].records > 0 &&
+          shards[i].min_id <= shards[j].max_id && shards[j].min_id <= shards[i].max_id) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Look up an id in the shard whose range holds it, if any.  Returns the
+// number of shards asked.
+static int route_id(struct shard *shards, int n, const struct query_request *req,
+                    struct query_response *resp, char *name) {
+  resp->status = QUERY_NOT_FOUND;
+  for (int i = 0; i < n; i++) {
+    struct shard *s = &shards[i];
+    if (s->records > 0 && s->min_id <= req->id && req->id <= s->max_id) {
+      send_request(s, req);
+      receive_response(s, resp, name);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Look up the nearest record to a point, in the nearest shard and then
+// in the shards that may have a nearer one.  Returns the number of
+// shards asked.
+static int route_coord(struct shard *shards, int n, const struct query_request *req,
+                       struct query_response *resp, char *name, double *distances,
+                       int *candidates) {
+  int nearest = -1;
+  for (int i = 0; i < n; i++) {
+    distances[i] = shards[i].records > 0 ? shard_distance(&shards[i], req->lon, req->lat) : INFINITY;
+    if (distances[i] < INFINITY && (nearest < 0 || distances[i] < distances[nearest])) {
+      nearest = i;
+    }
+  }
+  resp->status = QUERY_NOT_FOUND;
+  if (nearest < 0) {
+    return 0;
+  }
+
+  send_request(&shards[nearest], req);
+  receive_response(&shards[nearest], resp, name);
+  int best = nearest;
+  double best_distance = resp->status == QUERY_FOUND ?
+    point_distance(resp->lon, resp->lat, req->lon, req->lat) : INFINITY;
+
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    // A lower numbered shard as near as the record found may hold a
+    // record that ties with it and wins.
+    if (i != nearest && (distances[i] < best_distance ||
+                         (distances[i] == best_distance && i < nearest))) {
+      send_request(&shards[i], req);
+      candidates[m++] = i;
+    }
+  }
+
+  struct query_response other;
+  char *other_name = name + MAX_NAME + 1;
+  for (int k = 0; k < m; k++) {
+    int i = candidates[k];
+    receive_response(&shards[i], &other, other_name);
+    if (other.status != QUERY_FOUND) {
+      continue;
+    }
+    double d = point_distance(other.lon, other.lat, req->lon, req->lat);
+    if (d < best_distance || (d == best_distance && i < best)) {
+      best = i;
+      best_distance = d;
+      *resp = other;
+      memcpy(name, other_name, other.name_len+1);
+    }
+  }
+  return 1 + m;
+}
+
+int main(int argc, char** argv) {
+  const char *program = NULL;
+  int quiet = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:q")) != -1) {
+    switch (opt) {
+    case 's':
+      program = optarg;
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc-2 ||
+      (strcmp(argv[optind+1], "id") != 0 && strcmp(argv[optind+1], "coord") != 0)) {
+    usage(argv[0]);
+  }
+  int coords = strcmp(argv[optind+1], "coord") == 0;
+
+  int n;
+  struct shard *shards = read_manifest(argv[optind], &n);
+  if (!coords && id_ranges_overlap(shards, n)) {
+    fprintf(stderr, "The shards in %s have overlapping ids, so ids cannot be routed; "
+            "split the dataset with -t id\n", argv[optind]);
+    return 1;
+  }
+
+  uint64_t start = microseconds();
+  if (program) {
+    start_servers(shards, n, program);
+  }
+  if (connect_servers(shards, n) != 0) {
+    stop_servers(shards, n);
+    return 1;
+  }
+  if (program) {
+    printf("Starting shards: %dms\n", (int)((microseconds()-start)/1000));
+  }
+
+  char *name = checked_malloc(2 * (MAX_NAME+1));
+  double *distances = checked_malloc(n * sizeof(double));
+  int *candidates = checked_malloc(n * sizeof(int));
+  struct histogram *latency = histogram_create();
+  if (!latency) {
+    fprintf(stderr, "Error: Failed to allocate memory for latency histogram.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  char *line = NULL;
+  size_t line_len;
+  uint64_t runtime_sum = 0;
+  long queries = 0, requests = 0;
+  while (getline(&line, &line_len, stdin) != -1) {
+    struct query_request req;
+    struct query_response resp;
+    memset(&req, 0, sizeof(req));
+    if (coords) {
+      req.type = QUERY_COORD;
+      sscanf(line, "%lf %lf", &req.lon, &req.lat);
+    } else {
+      req.type = QUERY_ID;
+      req.id = atol(line);
+    }
+
+    uint64_t t = nanoseconds();
+    requests += coords ?
+      route_coord(shards, n, &req, &resp, name, distances, candidates) :
+      route_id(shards, n, &req, &resp, name);
+    uint64_t runtime = nanoseconds()-t;
+    histogram_record(latency, runtime);
+    runtime_sum += runtime;
+    queries++;
+
+    if (!quiet) {
+      if (!coords && resp.status == QUERY_FOUND) {
+        printf("%ld: %s %f %f\n", (long)req.id, name, resp.lon, resp.lat);
+      } else if (!coords) {
+        printf("%ld: not found\n", (long)req.id);
+      } else if (resp.status == QUERY_FOUND) {
+        printf("(%f,%f): %s (%f,%f)\n", req.lon, req.lat, name, resp.lon, resp.lat);
+      } else {
+        printf("(%f,%f): not found\n", req.lon, req.lat);
+      }
+      printf("Query time: %dus\n", (int)(runtime/1000));
+    }
+  }
+
+  printf("Total query runtime: %dus\n", (int)(runtime_sum/1000));
+  printf("Shard requests: %ld (%.2f per query)\n", requests,
+         queries > 0 ? (double)requests / queries : 0);
+  histogram_print(latency, stdout, "Query latency");
+
+  stop_servers(shards, n);
+  for (int i = 0; i < n; i++) {
+    free(shards[i].file);
+    free(shards[i].socket);
+  }
+  free(shards);
+  free(line);
+  free(name);
+  free(distances);
+  free(candidates);
+  histogram_free(latency);
+  return 0;
+}
@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+
+#include "query_server.h"
+#include "trace.h"
+
+// Bytes of requests read from a connection at a time.
+#define IN_SIZE (64 * sizeof(struct query_request))
+
+// A connection stops reading requests while it has this many bytes of
+// responses that the client has not taken yet, so a client that sends
+// without reading cannot make the server buffer without bound.
+#define OUT_LIMIT (1 << 20)
+
+#define MAX_EVENTS 64
+
+struct connection {
+  int fd;
+  uint32_t events;     // Events currently asked of epoll
+  int eof;             // Has the client finished sending?
+  struct connection *prev, *next;  // All open connections
+  char in[IN_SIZE];    // Received bytes not yet handled
+  size_t in_len;
+  char *out;           // Responses not yet sent are out[out_sent..out_len)
+  size_t out_len, out_sent, out_cap;
+};
+
+static volatile sig_atomic_t stopping = 0;
+static volatile sig_atomic_t reload_requested = 0;
+
+static void stop(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static void request_reload(int sig) {
+  (void)sig;
+  reload_requested = 1;
+}
+
+static void append(struct connection *c, const void *data, size_t n) {
+  if (c->out_len+n > c->out_cap) {
+    size_t cap = c->out_cap ? c->out_cap : 4096;
+    while (cap < c->out_len+n) {
+      cap *= 2;
+    }
+    c->out = realloc(c->out, cap);
+    if (!c->out) {
+      fprintf(stderr, "Error: Failed to allocate memory for responses.\n");
+      exit(EXIT_FAILURE);
+    }
+    c->out_cap = cap;
+  }
+  memcpy(c->out+c->out_len, data, n);
+  c->out_len += n;
+}
+
+// Answer the complete requests in the input buffer, as long as the
+// output is not backed up.  Returns the number answered.
+static int handle_requests(struct connection *c, query_handler_fn handler, void *ctx) {
+  size_t pos = 0;
+  int answered = 0;
+  TRACE_BEGIN("handle requests");
+  while (c->in_len-pos >= sizeof(struct query_request) &&
+         c->out_len-c->out_sent < OUT_LIMIT) {
+    struct query_request req;
+    memcpy(&req, c->in+pos, sizeof(req));
+    pos += sizeof(req);
+
+    const struct record *r = NULL;
+    struct query_response resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.tag = req.tag;
+    resp.status = handler(ctx, &req, &r);
+    if (resp.status == QUERY_FOUND && r) {
+      resp.osm_id = r->osm_id;
+      resp.lon = r->lon;
+      resp.lat = r->lat;
+      resp.name_len = strlen(record_name(r));
+    } else if (resp.status == QUERY_FOUND) {
+      resp.status = QUERY_NOT_FOUND;
+    }
+    append(c, &resp, sizeof(resp));
+    append(c, resp.status == QUERY_FOUND ? record_name(r) : "", resp.name_len);
+    answered++;
+  }
+
+  TRACE_END();
+
+  memmove(c->in, c->in+pos, c->in_len-pos);
+  c->in_len -= pos;
+  return answered;
+}
+
+// Send as much of the pending output as the socket takes.  Returns -1
+// if the connection is broken.
+static int send_responses(struct connection *c) {
+  while (c->out_sent < c->out_len) {
+    ssize_t n = send(c->fd, c->out+c->out_sent, c->out_len-c->out_sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    c->out_sent += n;
+  }
+  c->out_len = c->out_sent = 0;
+  return 0;
+}
+
+// Ask epoll for input while the client may send more and the output
+// is not backed up, and for output while there is some pending.
+static void update_events(int epfd, struct connection *c) {
+  uint32_t events = 0;
+  if (!c->eof && c->in_len < IN_SIZE && c->out_len-c->out_sent < OUT_LIMIT) {
+    events |= EPOLLIN;
+  }
+  if (c->out_sent < c->out_len) {
+    events |= EPOLLOUT;
+  }
+  if (events != c->events) {
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+  }
+}
+
+// The list of open connections.
+static struct connection *open_connections = NULL;
+
+static void close_connection(int epfd, struct connection *c) {
+  if (c->prev) {
+    c->prev->next = c->next;
+  } else {
+    open_connections = c->next;
+  }
+  if (c->next) {
+    c->next->prev = c->prev;
+  }
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->out);
+  free(c);
+}
+
+// Accept the pending connections, and return how many there were.
+static int accept_connections(int epfd, int listener) {
+  int accepted = 0;
+  while (1) {
+    int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        fprintf(stderr, "accept failed (errno: %s)\n", strerror(errno));
+      }
+      return accepted;
+    }
+
+    struct connection *c = calloc(1, sizeof(struct connection));
+    if (!c) {
+      fprintf(stderr, "Error: Failed to allocate memory for connection.\n");
+      exit(EXIT_FAILURE);
+    }
+    c->fd = fd;
+    c->events = EPOLLIN;
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close(fd);
+      free(c);
+      continue;
+    }
+    c->next = open_connections;
+    if (open_connections) {
+      open_connections->prev = c;
+    }
+    open_connections = c;
+    accepted++;
+  }
+}
+
+int query_server_run(const char *path, query_handler_fn handler, void *ctx) {
+  struct query_service service = { handler, NULL, NULL, ctx };
+  return query_server_serve(path, &service);
+}
+
+// Remove the socket at 'path', if it is still the one that 'created'
+// describes, and not some file that has replaced it since.
+static void remove_socket(const char *path, const struct stat *created) {
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+      st.st_dev == created->st_dev && st.st_ino == created->st_ino) {
+    unlink(path);
+  }
+}
+
+int query_server_serve(const char *path, const struct query_service *service) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return 1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listener < 0) {
+    fprintf(stderr, "Failed to create socket (errno: %s)\n", strerror(errno));
+    return 1;
+  }
+
+  // A socket left by an earlier server is replaced, but any other kind
+  // of file is not, as the path may be a mistake.
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "Refusing to replace %s, which is not a socket\n", path);
+      close(listener);
+      return 1;
+    }
+    unlink(path);
+  }
+  if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Failed to listen on %s (errno: %s)\n", path, strerror(errno));
+    close(listener);
+    return 1;
+  }
+  struct stat created;
+  if (lstat(path, &created) != 0 || listen(listener, SOMAXCONN) != 0) {
+    fprintf(stderr, "Failed to listen on %s (errno: %s)\n", path, strerror(errno));
+    close(listener);
+    unlink(path);
+    return 1;
+  }
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+  if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev) != 0) {
+    fprintf(stderr, "Failed to set up epoll (errno: %s)\n", strerror(errno));
+    close(listener);
+    remove_socket(path, &created);
+    return 1;
+  }
+
+  // The signals are blocked except while waiting in epoll_pwait(), so
+  // one that arrives between checking the flags and waiting is not
+  // lost: it stays pending, and ends the next wait at once.
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigset_t blocked, waiting;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  if (service->reload) {
+    sa.sa_handler = request_reload;
+    sigaction(SIGHUP, &sa, NULL);
+    sigaddset(&blocked, SIGHUP);
+  }
+  pthread_sigmask(SIG_BLOCK, &blocked, &waiting);
+  sigdelset(&waiting, SIGINT);
+  sigdelset(&waiting, SIGTERM);
+  sigdelset(&waiting, SIGHUP);
+
+  printf("Listening on %s\n", path);
+  fflush(stdout);
+
+  int ret = 0;
+  uint64_t requests = 0, connections = 0;
+  struct epoll_event events[MAX_EVENTS];
+  while (!stopping) {
+    int nevents = epoll_pwait(epfd, events, MAX_EVENTS, -1, &waiting);
+    if (nevents < 0 && errno != EINTR) {
+      fprintf(stderr, "Failed to wait for connections (errno: %s)\n", strerror(errno));
+      ret = 1;
+      break;
+    }
+    if (reload_requested) {
+      reload_requested = 0;
+      service->reload(service->ctx);
+    }
+    for (int i = 0; i < nevents; i++) {
+      struct connection *c = events[i].data.ptr;
+      if (!c) {
+        connections += accept_connections(epfd, listener);
+        continue;
+      }
+
+      int broken = 0;
+      if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !c->eof && c->in_len < IN_SIZE) {
+        ssize_t n = recv(c->fd, c->in+c->in_len, IN_SIZE-c->in_len, 0);
+        if (n > 0) {
+          c->in_len += n;
+        } else if (n == 0) {
+          c->eof = 1;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          broken = 1;
+        }
+      }
+
+      // Sending may make room for requests that were held back, so go
+      // on until no more can be answered.
+      while (!broken) {
+        int answered = handle_requests(c, service->handle, service->ctx);
+        if (service->release) {
+          service->release(service->ctx);
+        }
+        requests += answered;
+        broken = send_responses(c) != 0;
+        if (answered == 0) {
+          break;
+        }
+      }
+
+      if (broken || (c->eof && c->out_sent == c->out_len)) {
+        close_connection(epfd, c);
+      } else {
+        update_events(epfd, c);
+      }
+    }
+  }
+
+  printf("Served %lu requests on %lu connections\n",
+         (unsigned long)requests, (unsigned long)connections);
+
+  while (open_connections) {
+    close_connection(epfd, open_connections);
+  }
+  close(epfd);
+  close(listener);
+  remove_socket(path, &created);
+  pthread_sigmask(SIG_UNBLOCK, &blocked, NULL);
+  return ret;
+}
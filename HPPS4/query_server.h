@@ -0,0 +1,87 @@
+// A server that answers queries over a Unix domain socket, so that the
+// records only have to be read and indexed once, however many queries
+// are asked.  Programs built on id_query_loop() or coord_query_loop()
+// become servers when run as
+//
+//   PROGRAM --serve SOCKET FILE
+//
+// and query_client.c talks to them.
+//
+// The protocol is binary, with all numbers in host byte order (both
+// ends are on the same machine).  A client sends fixed-size requests
+// and gets one response per request, in the same order.  A client may
+// send any number of requests without waiting for the responses in
+// between (pipelining); the 'tag' of each request is echoed in its
+// response so the client can match them up.  Many clients can be
+// connected at once, and are served by one thread with epoll.
+
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <stdint.h>
+
+#include "record.h"
+
+enum query_type {
+  QUERY_ID = 1,    // Look up 'id'
+  QUERY_COORD = 2  // Look up the record closest to ('lon', 'lat')
+};
+
+struct query_request {
+  uint32_t tag;    // Chosen by the client
+  uint32_t type;   // An enum query_type
+  int64_t id;
+  double lon, lat;
+};
+
+enum query_status {
+  QUERY_FOUND = 0,
+  QUERY_NOT_FOUND = 1,
+  QUERY_BAD_REQUEST = 2  // The server does not handle this type
+};
+
+// Followed by 'name_len' bytes of the record's name, without a NUL.
+// Unless the status is QUERY_FOUND, only 'tag' and 'status' are
+// meaningful, and 'name_len' is zero.
+struct query_response {
+  uint32_t tag;
+  uint32_t status;   // An enum query_status
+  int64_t osm_id;
+  double lon, lat;
+  uint32_t name_len;
+  uint32_t reserved;
+};
+
+// Answer a request: store the record found in *r and return
+// QUERY_FOUND, or return one of the other statuses.
+typedef int (*query_handler_fn)(void *ctx, const struct query_request *req,
+                                const struct record **r);
+
+// Listen on a Unix domain socket at 'path', replacing any socket file
+// already there, and answer requests with 'handler' until the process
+// receives SIGINT or SIGTERM.  If 'path' is some other kind of file, it
+// is left alone and the server does not start.  The socket file is
+// removed on return, unless it has been replaced in the meantime.
+// Returns 0 on a clean shutdown, or 1 if the socket could not be set
+// up or waiting on it failed.  While serving, the calling thread keeps
+// these signals blocked except when it waits, so none is missed.
+int query_server_run(const char *path, query_handler_fn handler, void *ctx);
+
+// Everything a server can be asked to do.  The functions other than
+// 'handle' are optional, and may be NULL.
+struct query_service {
+  query_handler_fn handle;
+  // Called when the server no longer uses any record that 'handle'
+  // returned, after each batch of requests.
+  void (*release)(void *ctx);
+  // Called on the server's thread when the process receives SIGHUP,
+  // for example to start reloading the records.  Without it, SIGHUP
+  // keeps its default action.
+  void (*reload)(void *ctx);
+  void *ctx;
+};
+
+// Like query_server_run(), with the functions of 'service'.
+int query_server_serve(const char *path, const struct query_service *service);
+
+#endif
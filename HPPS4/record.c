@@ -1,144 +1,200 @@
 #include "record.h"
+#include "bigmem.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-
-// Sanity check to make sure we are reading the right kind of file.
-int input_looks_ok(FILE *f) {
-  char *line = NULL;
-  size_t n;
-  if (getline(&line, &n, f) == -1) {
-    return -1;
+#include <sys/stat.h>
+
+#define HEADER "name\talternative_names\tosm_type\tosm_id\tclass\ttype\tlon\tlat\tplace_rank\timportance\tstreet\tcity\tcounty\tstate\tcountry\tcountry_code\tdisplay_name\twest\tsouth\teast\tnorth\twikidata\twikipedia\thousenumbers\n"
+
+// The string column held by each field of a line, or -1 for the
+// numeric fields, which are parsed instead, except for the bounding
+// box, which nothing uses and is skipped.
+static const int field_columns[] = {
+  RECORD_NAME, RECORD_ALTERNATIVE_NAMES, RECORD_OSM_TYPE, -1 /* osm_id */,
+  RECORD_CLASS, RECORD_TYPE, -1 /* lon */, -1 /* lat */,
+  -1 /* place_rank */, -1 /* importance */, RECORD_STREET, RECORD_CITY,
+  RECORD_COUNTY, RECORD_STATE, RECORD_COUNTRY, RECORD_COUNTRY_CODE,
+  RECORD_DISPLAY_NAME, -1 /* west */, -1 /* south */, -1 /* east */,
+  -1 /* north */, RECORD_WIKIDATA, RECORD_WIKIPEDIA, RECORD_HOUSENUMBERS
+};
+
+// Bytes read at a time by read_records_streaming().
+#define READ_CHUNK_SIZE (4 << 20)
+
+#define NUM_FIELDS (int)(sizeof(field_columns) / sizeof(field_columns[0]))
+
+// Read the whole of an open file into memory from bigmem_alloc(), with
+// room for a NUL after it.  Returns NULL on failure.
+static char* read_file(FILE *f, size_t *size) {
+  struct stat st;
+  size_t capacity = fstat(fileno(f), &st) == 0 && st.st_size > 0 ? (size_t)st.st_size + 1 : 1 << 20;
+  char *data = bigmem_alloc(capacity);
+  size_t len = 0;
+  while (data) {
+    len += fread(data + len, 1, capacity - 1 - len, f);
+    if (len < capacity - 1) {
+      break;
+    }
+    // The file was not at its end, as with a pipe.
+    capacity *= 2;
+    data = bigmem_realloc(data, capacity);
   }
-
-  int ret;
-  if (strcmp(line, "name	alternative_names	osm_type	osm_id	class	type	lon	lat	place_rank	importance	street	city	county	state	country	country_code	display_name	west	south	east	north	wikidata	wikipedia	housenumbers\n") == 0) {
-    ret = 1;
-  } else {
-    ret = 0;
+  if (!data || ferror(f)) {
+    bigmem_free(data);
+    return NULL;
   }
-
-  free(line);
-  return ret;
+  data[len] = 0;
+  *size = len;
+  return data;
 }
 
-// Read a single record from an open file.  This is pretty tedious, as
-// we handle each field explicitly.
-int read_record(struct record *r, FILE *f) {
-  char *line = NULL;
-  size_t n;
-  if (getline(&line, &n, f) == -1) {
-    free(line);
-    return -1;
-  }
-
+void record_parse_line(struct record *r, char *line) {
+  memset(r, 0, sizeof(*r));
   r->line = line;
 
-  char* start = line;
-  char* end;
-
-  if ((end = strstr(start, "\t"))) {
-    r->name = start; *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->alternative_names = start; *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->osm_type = start; *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->osm_id = atol(start); *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->class = start; *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->type = start; *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->lon = atof(start); *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->lat = atof(start); *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->place_rank = atoi(start); *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->importance = atof(start); *end = 0; start = end+1;
-  }
-
-  if ((end = strstr(start, "\t"))) {
-    r->street = start; *end = 0; start = end+1;
+  char *start = line;
+  int field = 0;
+  for (; field < NUM_FIELDS; field++) {
+    char *end = strchr(start, '\t');
+    if (end) {
+      *end = 0;
+    }
+    if (field_columns[field] >= 0) {
+      r->strings[field_columns[field]] = start - line;
+    } else if (field == 3) {
+      r->osm_id = atol(start);
+    } else if (field == 6) {
+      r->lon = atof(start);
+    } else if (field == 7) {
+      r->lat = atof(start);
+    } else if (field == 8) {
+      r->place_rank = atoi(start);
+    } else if (field == 9) {
+      r->importance = atof(start);
+    }
+    if (!end) {
+      break;
+    }
+    start = end+1;
   }
 
-  if ((end = strstr(start, "\t"))) {
-    r->city = start; *end = 0; start = end+1;
+  // Missing fields are the empty string at the end of the line.
+  uint32_t last = start - line + strlen(start);
+  for (field++; field < NUM_FIELDS; field++) {
+    if (field_columns[field] >= 0) {
+      r->strings[field_columns[field]] = last;
+    }
   }
+}
 
-  if ((end = strstr(start, "\t"))) {
-    r->county = start; *end = 0; start = end+1;
-  }
+int record_is_header(const char *line, size_t len) {
+  return len >= strlen(HEADER) && strncmp(line, HEADER, strlen(HEADER)) == 0;
+}
 
-  if ((end = strstr(start, "\t"))) {
-    r->state = start; *end = 0; start = end+1;
-  }
+static const char *column_names[RECORD_NUM_STRING_COLUMNS] = {
+  "name", "alternative_names", "osm_type", "class", "type", "street",
+  "city", "county", "state", "country", "country_code", "display_name",
+  "wikidata", "wikipedia", "housenumbers"
+};
 
-  if ((end = strstr(start, "\t"))) {
-    r->country = start; *end = 0; start = end+1;
+int record_column_by_name(const char *name) {
+  for (int i = 0; i < RECORD_NUM_STRING_COLUMNS; i++) {
+    if (strcmp(name, column_names[i]) == 0) {
+      return i;
+    }
   }
+  return -1;
+}
 
-  if ((end = strstr(start, "\t"))) {
-    r->country_code = start; *end = 0; start = end+1;
-  }
+const char* record_column_name(enum record_column column) {
+  return column_names[column];
+}
 
-  if ((end = strstr(start, "\t"))) {
-    r->display_name = start; *end = 0; start = end+1;
+// Parse the lines from 'start' up to 'end' into records from rs[*i]
+// on, and advance *i past them.  A line is only parsed once its newline
+// has been read, unless 'last' is set, in which case the rest is
+// parsed as the last line.  Returns the start of the first line not
+// parsed.  The byte at 'end' must be writable.
+static char* parse_lines(char *start, char *end, int last, struct record *rs, int *i) {
+  while (start < end) {
+    char *newline = memchr(start, '\n', end - start);
+    if (newline == NULL) {
+      if (!last) {
+        break;
+      }
+      newline = end;
+    }
+    *newline = 0;
+    if (newline > start) {
+      record_parse_line(&rs[(*i)++], start);
+    }
+    start = newline+1;
   }
+  return start;
+}
 
-  if ((end = strstr(start, "\t"))) {
-    r->west = atof(start); *end = 0; start = end+1;
+// The records are allocated with one extra record in front of them,
+// which points at the arena, so that the caller need only keep track of
+// the records.
+static struct record* read_all(FILE *f, int *n) {
+  size_t size;
+  TRACE_BEGIN("read file");
+  char *arena = read_file(f, &size);
+  TRACE_END();
+  if (arena == NULL) {
+    return NULL;
   }
 
-  if ((end = strstr(start, "\t"))) {
-    r->west = atof(start); *end = 0; start = end+1;
+  // Sanity check to make sure we are reading the right kind of file.
+  if (!record_is_header(arena, size)) {
+    bigmem_free(arena);
+    return NULL;
   }
 
-  if ((end = strstr(start, "\t"))) {
-    r->east = atof(start); *end = 0; start = end+1;
+  TRACE_BEGIN("parse lines");
+  char *start = arena + strlen(HEADER);
+  size_t lines = 0;
+  for (char *p = start; (p = memchr(p, '\n', arena + size - p)); p++) {
+    lines++;
   }
 
-  if ((end = strstr(start, "\t"))) {
-    r->north = atof(start); *end = 0; start = end+1;
+  struct record *rs = bigmem_alloc((lines + 2) * sizeof(struct record));
+  if (rs == NULL) {
+    TRACE_END();
+    bigmem_free(arena);
+    return NULL;
   }
+  rs[0].line = arena;
+  rs++;
 
-  if ((end = strstr(start, "\t"))) {
-    r->wikidata = start; *end = 0; start = end+1;
-  }
+  int i = 0;
+  parse_lines(start, arena + size, 1, rs, &i);
+  TRACE_END();
+  *n = i;
+  return rs;
+}
 
-  if ((end = strstr(start, "\t"))) {
-    r->wikipedia = start; *end = 0; start = end+1;
-  }
+struct record* read_records(const char *filename, int *n) {
+  FILE *f = fopen(filename, "r");
+  *n = 0;
 
-  if ((end = strstr(start, "\t"))) {
-    r->housenumbers = start; *end = 0; start = end+1;
+  if (f == NULL) {
+    return NULL;
   }
 
-  return 0;
+  TRACE_BEGIN("read_records");
+  struct record *rs = read_all(f, n);
+  fclose(f);
+  TRACE_END();
+  return rs;
 }
 
-struct record* read_records(const char *filename, int *n) {
+struct record* read_records_streaming(const char *filename, int *n,
+                                      records_ready_fn ready, void *arg) {
   FILE *f = fopen(filename, "r");
   *n = 0;
 
@@ -146,29 +202,96 @@ struct record* read_records(const char *filename, int *n) {
     return NULL;
   }
 
-  if (!input_looks_ok(f)) {
-    return NULL;
+  // Every record takes at least two bytes of the file, a character and
+  // a newline, which bounds the number of records, so address space
+  // for the array of them can be reserved in advance, and the array
+  // never moves.  Memory is committed to it a chunk at a time, as the
+  // bound for the lines read so far grows.
+  struct stat st;
+  size_t size = fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) ? (size_t)st.st_size : 0;
+  char *arena = size > 0 ? bigmem_alloc(size + 1) : NULL;
+  struct record *rs = arena ? bigmem_reserve((size/2 + 2) * sizeof(struct record)) : NULL;
+  if (rs && bigmem_commit(rs, sizeof(struct record)) != 0) {
+    bigmem_free(rs);
+    rs = NULL;
   }
+  if (rs == NULL) {
+    // Without a size, as for a pipe, or the room to reserve, the whole
+    // file is read first.
+    bigmem_free(arena);
+    rs = read_all(f, n);
+    fclose(f);
+    if (rs && ready) {
+      ready(arg, rs, *n);
+    }
+    return rs;
+  }
+  rs[0].line = arena;
+  rs++;
 
-  int capacity = 100;
+  size_t len = 0;
+  char *start = NULL;
   int i = 0;
-  struct record *rs = malloc(capacity * sizeof(struct record));
-  while (read_record(&rs[i], f) == 0) {
-    i++;
-    if (i == capacity) {
-      capacity *= 2;
-      rs = realloc(rs, capacity * sizeof(struct record));
+  int ok = 1;
+  while (ok) {
+    size_t want = size - len < READ_CHUNK_SIZE ? size - len : READ_CHUNK_SIZE;
+    TRACE_BEGIN("read chunk");
+    size_t got = want > 0 ? fread(arena + len, 1, want, f) : 0;
+    TRACE_END();
+    len += got;
+    int last = got == 0 || len == size;
+
+    // Sanity check to make sure we are reading the right kind of file.
+    if (start == NULL) {
+      if (len < strlen(HEADER) && !last) {
+        continue;
+      }
+      if (!record_is_header(arena, len)) {
+        ok = 0;
+        break;
+      }
+      start = arena + strlen(HEADER);
+    }
+
+    // The slot in front, the records so far, and at most one for every
+    // two bytes not yet parsed, plus a last line without a newline.
+    size_t bound = 1 + i + (arena + len - start)/2 + 1;
+    if (bigmem_commit(rs-1, bound * sizeof(struct record)) != 0) {
+      ok = 0;
+      break;
+    }
+
+    int before = i;
+    TRACE_BEGIN("parse chunk");
+    start = parse_lines(start, arena + len, last, rs, &i);
+    TRACE_END();
+    if (ready && i > before) {
+      ready(arg, rs, i);
+    }
+    if (last) {
+      ok = !ferror(f);
+      break;
     }
   }
+  fclose(f);
+
+  if (!ok) {
+    if (ready && i > 0) {
+      ready(arg, NULL, 0);
+    }
+    bigmem_free(arena);
+    bigmem_free(rs-1);
+    return NULL;
+  }
 
   *n = i;
-  fclose(f);
   return rs;
 }
 
 void free_records(struct record *rs, int n) {
-  for (int i = 0; i < n; i++) {
-    free(rs[i].line);
+  (void)n;
+  if (rs) {
+    bigmem_free((void*)rs[-1].line);
+    bigmem_free(rs-1);
   }
-  free(rs);
 }
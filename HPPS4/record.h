@@ -4,42 +4,43 @@
 #include <stdio.h>
 #include <stdint.h>
 
-// An OpenStreetMap place record.  All the 'const char*' strings are
-// pointers into the string stored in the 'line' field.  This string
-// is "owned" by the record, meaning that it is freed exactly when the
-// record itself is freed.
+// The string-valued columns of a record.
+enum record_column {
+  RECORD_NAME,
+  RECORD_ALTERNATIVE_NAMES,
+  RECORD_OSM_TYPE,
+  RECORD_CLASS,
+  RECORD_TYPE,
+  RECORD_STREET,
+  RECORD_CITY,
+  RECORD_COUNTY,
+  RECORD_STATE,
+  RECORD_COUNTRY,
+  RECORD_COUNTRY_CODE,
+  RECORD_DISPLAY_NAME,
+  RECORD_WIKIDATA,
+  RECORD_WIKIPEDIA,
+  RECORD_HOUSENUMBERS,
+  RECORD_NUM_STRING_COLUMNS
+};
+
+// An OpenStreetMap place record.  The text of all the records is kept
+// in one arena, which holds the lines of the dataset with each field
+// terminated by a NUL.  A record points at its own line, and finds its
+// strings at 32-bit offsets from there, so it takes 104 bytes instead
+// of 17 pointers and a line of its own.  Use record_string() and
+// record_name() to get at the strings.
 //
-// You don't need to worry about the meaning of these fields.  The
-// ones that matter are osm_id, lon, lat, and name.
+// You don't need to worry about the meaning of most of the columns.
+// The ones that matter are osm_id, lon, lat, and name.
 struct record {
-  const char *name;
-  const char *alternative_names;
-  const char *osm_type;
+  const char *line;   // The record's line in the arena
   int64_t osm_id;
-  const char *class;
-  const char *type;
   double lon;
   double lat;
-  int place_rank;
   double importance;
-  const char *street;
-  const char *city;
-  const char *county;
-  const char *state;
-  const char *country;
-  const char *country_code;
-  const char *display_name;
-  double west;
-  double south;
-  double east;
-  double north;
-  const char *wikidata;
-  const char *wikipedia;
-  const char *housenumbers;
-
-  // Not a real field - all the other char* elements are pointers into
-  // this memory, which we can pass to free().
-  char *line;
+  int32_t place_rank;
+  uint32_t strings[RECORD_NUM_STRING_COLUMNS]; // Offset of each string from 'line'
 };
 
 // Read an OpenStreetMap place names dataset from a given file.  On
@@ -47,8 +48,50 @@ struct record {
 // *n to the number of records.  Returns NULL on failure.
 struct record* read_records(const char *filename, int *n);
 
+// Called by read_records_streaming() when records have been read.
+// The first 'n' records of 'rs' are complete.  Neither they nor 'rs'
+// move afterwards, so pointers to them stay valid until the records
+// are freed.
+typedef void (*records_ready_fn)(void *arg, const struct record *rs, int n);
+
+// Like read_records(), but the file is read a few megabytes at a time,
+// and ready(arg, ...) is called after each piece with all the records
+// read so far, so that they can be used while the rest are read.  If
+// reading fails after that, ready(arg, NULL, 0) is called before the
+// records are freed, and must not return while they are still in use.
+struct record* read_records_streaming(const char *filename, int *n,
+                                      records_ready_fn ready, void *arg);
+
+// Whether the 'len' bytes at 'line' start with the header line of a
+// dataset, newline included.  Used as a sanity check that a file is a
+// dataset at all.
+int record_is_header(const char *line, size_t len);
+
+// Fill in a record from a single line of a dataset, without its
+// newline, which is split into fields in place.  The record points into
+// the line.  'line' must be NUL-terminated, and shorter than 4 GiB, as
+// the offsets of the strings are 32 bits.
+void record_parse_line(struct record *r, char *line);
+
+// Find a string column by its name in the dataset header, such as
+// "country_code".  Returns -1 if there is no such string column.
+int record_column_by_name(const char *name);
+
+// The name of a string column in the dataset header.
+const char* record_column_name(enum record_column column);
+
+// The value of a string column of a record.
+static inline const char* record_string(const struct record *r, enum record_column column) {
+  return r->line + r->strings[column];
+}
+
+static inline const char* record_name(const struct record *r) {
+  return r->line;
+}
+
 // Free records returned by read_records().  The 'n' argument must
 // correspond to the number of records, as produced by read_records().
+// All the text of the records goes at once.
 void free_records(struct record *r, int n);
 
 #endif
@@ -0,0 +1,178 @@
+#include "secondary_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bigmem.h"
+
+// The index is an open-addressing hash table with one slot per
+// distinct value.  A slot does not hold the value itself, but the
+// number of a record that has it, together with the full hash so most
+// mismatches are rejected without comparing strings.  The records of
+// each value are stored contiguously in one shared array of record
+// numbers, and the slot points to its range in that array.
+
+struct slot {
+  uint32_t hash;    // Hash of the value
+  int row;          // A record with this value, or -1 if the slot is empty
+  int first;        // Start of the value's records in 'rows'
+  int count;        // Number of records with the value
+};
+
+struct secondary_index {
+  const struct record *rs;
+  enum record_column column;
+  struct slot *slots;
+  size_t capacity;  // Number of slots, a power of two
+  int *rows;        // Record numbers, grouped by value
+  int n;            // Number of indexed records
+  int nrecords;     // Number of records the index was built on
+};
+
+// FNV-1a.
+static uint32_t hash_string(const char *s) {
+  uint32_t h = 2166136261u;
+  for (; *s; s++) {
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  }
+  return h;
+}
+
+// Find the slot for a value: either the slot holding it, or the empty
+// slot where it belongs.
+static struct slot* find_slot(const struct secondary_index *index, const char *value,
+                              uint32_t hash) {
+  size_t mask = index->capacity-1;
+  for (size_t i = hash & mask; ; i = (i+1) & mask) {
+    struct slot *s = &index->slots[i];
+    if (s->row < 0) {
+      return s;
+    }
+    if (s->hash == hash &&
+        strcmp(record_string(&index->rs[s->row], index->column), value) == 0) {
+      return s;
+    }
+  }
+}
+
+struct secondary_index* secondary_index_create(const struct record *rs, int n,
+                                               enum record_column column) {
+  struct secondary_index *index = malloc(sizeof(struct secondary_index));
+  if (!index) {
+    return NULL;
+  }
+
+  // At most half full, even if every value is distinct.
+  index->capacity = 16;
+  while (index->capacity < 2*(size_t)n) {
+    index->capacity *= 2;
+  }
+
+  index->rs = rs;
+  index->column = column;
+  index->n = 0;
+  index->nrecords = n;
+  index->slots = bigmem_alloc(index->capacity * sizeof(struct slot));
+  if (!index->slots) {
+    free(index);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < index->capacity; i++) {
+    index->slots[i].row = -1;
+  }
+
+  // First pass: count the records of each distinct value.
+  for (int i = 0; i < n; i++) {
+    const char *value = record_string(&rs[i], column);
+    if (!value || !*value) {
+      continue;
+    }
+    uint32_t hash = hash_string(value);
+    struct slot *s = find_slot(index, value, hash);
+    if (s->row < 0) {
+      s->hash = hash;
+      s->row = i;
+      s->count = 0;
+    }
+    s->count++;
+    index->n++;
+  }
+
+  index->rows = bigmem_alloc((index->n > 0 ? index->n : 1) * sizeof(int));
+  if (!index->rows) {
+    bigmem_free(index->slots);
+    free(index);
+    return NULL;
+  }
+
+  // Give every value its range of the row array.
+  int next = 0;
+  for (size_t i = 0; i < index->capacity; i++) {
+    if (index->slots[i].row >= 0) {
+      index->slots[i].first = next;
+      next += index->slots[i].count;
+      index->slots[i].count = 0;
+    }
+  }
+
+  // Second pass: fill in the record numbers, in increasing order.
+  for (int i = 0; i < n; i++) {
+    const char *value = record_string(&rs[i], column);
+    if (!value || !*value) {
+      continue;
+    }
+    struct slot *s = find_slot(index, value, hash_string(value));
+    index->rows[s->first + s->count++] = i;
+  }
+
+  return index;
+}
+
+void secondary_index_free(struct secondary_index *index) {
+  if (index) {
+    bigmem_free(index->slots);
+    bigmem_free(index->rows);
+    free(index);
+  }
+}
+
+const int* secondary_index_lookup(const struct secondary_index *index, const char *value,
+                                  int *count) {
+  struct slot *s = find_slot(index, value, hash_string(value));
+  if (s->row < 0) {
+    *count = 0;
+    return NULL;
+  }
+  *count = s->count;
+  return &index->rows[s->first];
+}
+
+int secondary_index_encode(const struct secondary_index *index, int *codes, int *examples) {
+  for (int i = 0; i < index->nrecords; i++) {
+    codes[i] = -1;
+  }
+
+  int code = 0;
+  for (size_t i = 0; i < index->capacity; i++) {
+    const struct slot *s = &index->slots[i];
+    if (s->row >= 0) {
+      for (int j = s->first; j < s->first+s->count; j++) {
+        codes[index->rows[j]] = code;
+      }
+      if (examples) {
+        examples[code] = s->row;
+      }
+      code++;
+    }
+  }
+  return code;
+}
+
+size_t secondary_index_size(const struct secondary_index *index) {
+  return sizeof(struct secondary_index)
+    + index->capacity * sizeof(struct slot)
+    + index->n * sizeof(int);
+}
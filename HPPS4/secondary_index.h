@@ -0,0 +1,41 @@
+// A hash index on one string column of an array of records, for
+// exact-match lookups on columns such as wikidata or country_code.
+// Several records may share a value.  The index stores record numbers
+// (indexes into the array) rather than copies of the strings, and
+// compares against the records themselves, so the records must
+// outlive the index.  Records with an empty value are not indexed.
+
+#ifndef SECONDARY_INDEX_H
+#define SECONDARY_INDEX_H
+
+#include "record.h"
+
+// An opaque struct representing a secondary index.
+struct secondary_index;
+
+// Build an index on the given column of the 'n' records in 'rs'.
+struct secondary_index* secondary_index_create(const struct record *rs, int n,
+                                               enum record_column column);
+
+// Free an index.  The records are not freed.
+void secondary_index_free(struct secondary_index *index);
+
+// Find the records whose column is equal to 'value'.  Returns an
+// array of record numbers in increasing order, and sets *count to its
+// length (zero if there are no matches).  The array belongs to the
+// index.
+const int* secondary_index_lookup(const struct secondary_index *index, const char *value,
+                                  int *count);
+
+// Dictionary-encode the column: number the distinct values 0, 1, ...
+// and store the number of each record's value in codes[i], or -1 for
+// records with an empty value.  'codes' must have room for every
+// record the index was built on, and 'examples', if not NULL, for
+// one entry per distinct value; examples[c] is set to a record whose
+// value has number c.  Returns the number of distinct values.
+int secondary_index_encode(const struct secondary_index *index, int *codes, int *examples);
+
+// Number of bytes allocated by the index.
+size_t secondary_index_size(const struct secondary_index *index);
+
+#endif
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "record.h"
+#include "bigmem.h"
+#include "timing.h"
+
+// Splits a dataset into shards, each a dataset of its own that any of
+// the query programs can load, for example
+//
+//   ./shard -t region -n 8 planet-latest_geonames.tsv planet
+//
+// writes planet.0.tsv to planet.7.tsv, and the manifest planet.shards
+// that query_router.c uses to send each query to the shards that can
+// answer it.  With -t id, each shard holds a range of ids, and no id is
+// in two shards.  With -t region (the default), the records are split
+// into rectangles of the globe by cutting the longer side at the median
+// record, again and again, so each shard has the records near each
+// other; the router answers only coordinate queries on such shards.
+// Either way, the shards are about the same size, and the lines of a
+// shard are in the same order as in the dataset.
+//
+// The manifest has a line per shard, giving the number of records, the
+// smallest and largest id, and the bounding box of the coordinates,
+// followed by the name of the shard's file relative to the manifest.
+//
+// Only the ids and coordinates of the records are kept in memory, and
+// the dataset is read twice, so a dataset too large to index in one
+// process can still be split.
+
+// What is kept of each record while splitting.
+struct shard_row {
+  int64_t osm_id;
+  double lon, lat;
+};
+
+struct shard_info {
+  int count;
+  int64_t min_id, max_id;
+  double west, south, east, north;
+};
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [-t id|region] [-n SHARDS] FILE PREFIX\n", prog);
+  exit(1);
+}
+
+// The rows, and the axis to order by, for the comparison functions.
+static const struct shard_row *sort_rows;
+static int sort_by_lat;
+
+// By id, then by position in the dataset.
+static int compare_id(const void *a, const void *b) {
+  int i = *(const int*)a, j = *(const int*)b;
+  int64_t x = sort_rows[i].osm_id, y = sort_rows[j].osm_id;
+  if (x != y) {
+    return (x > y) - (x < y);
+  }
+  return (i > j) - (i < j);
+}
+
+// By longitude or latitude, then by position in the dataset.
+static int compare_coord(const void *a, const void *b) {
+  int i = *(const int*)a, j = *(const int*)b;
+  double x = sort_by_lat ? sort_rows[i].lat : sort_rows[i].lon;
+  double y = sort_by_lat ? sort_rows[j].lat : sort_rows[j].lon;
+  if (x != y) {
+    return (x > y) - (x < y);
+  }
+  return (i > j) - (i < j);
+}
+
+// Read the id and coordinates of every record.  Returns NULL with
+// errno set on failure.
+static struct shard_row* read_rows(const char *filename, int *n) {
+  FILE *f = fopen(filename, "r");
+  if (!f) {
+    return NULL;
+  }
+
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len = getline(&line, &line_size, f);
+  if (len == -1 || !record_is_header(line, len)) {
+    free(line);
+    fclose(f);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  int capacity = 1 << 16;
+  int count = 0;
+  struct shard_row *rows = bigmem_alloc(capacity * sizeof(struct shard_row));
+  while (rows && (len = getline(&line, &line_size, f)) != -1) {
+    if (line[len-1] == '\n') {
+      line[--len] = 0;
+    }
+    if (len == 0) {
+      continue;
+    }
+    if (count == capacity) {
+      capacity *= 2;
+      rows = bigmem_realloc(rows, capacity * sizeof(struct shard_row));
+      if (!rows) {
+        break;
+      }
+    }
+    struct record r;
+    record_parse_line(&r, line);
+    rows[count].osm_id = r.osm_id;
+    rows[count].lon = r.lon;
+    rows[count].lat = r.lat;
+    count++;
+  }
+  int failed = !rows || ferror(f);
+  free(line);
+  fclose(f);
+  if (failed) {
+    bigmem_free(rows);
+    errno = ENOMEM;
+    return NULL;
+  }
+  *n = count;
+  return rows;
+}
+
+// Split the rows in 'order' into 'nshards' ranges of ids.  Rows with
+// the same id stay in the same shard.
+static void split_by_id(const struct shard_row *rows, int *order, int n,
+                        int nshards, int *shard_of) {
+  sort_rows = rows;
+  qsort(order, n, sizeof(int), compare_id);
+  int start = 0;
+  for (int s = 0; s < nshards; s++) {
+    int end = s == nshards-1 ? n : (int)((int64_t)n * (s+1) / nshards);
+    if (end < start) {
+      end = start;
+    }
+    while (end > 0 && end < n && rows[order[end]].osm_id == rows[order[end-1]].osm_id) {
+      end++;
+    }
+    for (int i = start; i < end; i++) {
+      shard_of[order[i]] = s;
+    }
+    start = end;
+  }
+}
+
+// Split the rows in 'order' into 'nshards' rectangles, numbered from
+// 'first', by cutting across the longer side of their bounding box.
+static void split_by_region(const struct shard_row *rows, int *order, int n,
+                            int first, int nshards, int *shard_of) {
+  if (nshards == 1 || n == 0) {
+    for (int i = 0; i < n; i++) {
+      shard_of[order[i]] = first;
+    }
+    return;
+  }
+
+  double west = rows[order[0]].lon, east = west;
+  double south = rows[order[0]].lat, north = south;
+  for (int i = 1; i < n; i++) {
+    const struct shard_row *r = &rows[order[i]];
+    west = r->lon < west ? r->lon : west;
+    east = r->lon > east ? r->lon : east;
+    south = r->lat < south ? r->lat : south;
+    north = r->lat > north ? r->lat : north;
+  }
+
+  sort_rows = rows;
+  sort_by_lat = north - south > east - west;
+  qsort(order, n, sizeof(int), compare_coord);
+
+  // Each half gets records in proportion to its number of shards.
+  int left = nshards / 2;
+  int cut = (int)((int64_t)n * left / nshards);
+  split_by_region(rows, order, cut, first, left, shard_of);
+  split_by_region(rows, order+cut, n-cut, first+left, nshards-left, shard_of);
+}
+
+// Copy each record of the dataset to the file of its shard.  Returns 0
+// on success, or -1 with errno set.
+static int write_shards(const char *filename, const char *prefix, int nshards,
+                        const int *shard_of) {
+  FILE *in = fopen(filename, "r");
+  if (!in) {
+    return -1;
+  }
+  FILE **outs = calloc(nshards, sizeof(FILE*));
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len = getline(&line, &line_size, in);
+  int failed = !outs || len == -1;
+
+  for (int s = 0; s < nshards && !failed; s++) {
+    char *path;
+    if (asprintf(&path, "%s.%d.tsv", prefix, s) < 0) {
+      failed = 1;
+      break;
+    }
+    outs[s] = fopen(path, "w");
+    free(path);
+    failed = !outs[s] || fwrite(line, 1, len, outs[s]) != (size_t)len;
+  }
+
+  int i = 0;
+  while (!failed && (len = getline(&line, &line_size, in)) != -1) {
+    if (len == 1 && line[0] == '\n') {
+      continue;
+    }
+    FILE *out = outs[shard_of[i++]];
+    failed = fwrite(line, 1, len, out) != (size_t)len ||
+      (line[len-1] != '\n' && fputc('\n', out) == EOF);
+  }
+  failed = failed || ferror(in);
+
+  int saved = errno;
+  for (int s = 0; outs && s < nshards; s++) {
+    if (outs[s] && fclose(outs[s]) != 0) {
+      failed = 1;
+      saved = errno;
+    }
+  }
+  free(outs);
+  free(line);
+  fclose(in);
+  errno = saved;
+  return failed ? -1 : 0;
+}
+
+// Write the manifest, with the shard files named relative to it.
+static int write_manifest(const char *prefix, int nshards, const struct shard_info *info) {
+  char *path;
+  if (asprintf(&path, "%s.shards", prefix) < 0) {
+    return -1;
+  }
+  FILE *f = fopen(path, "w");
+  free(path);
+  if (!f) {
+    return -1;
+  }
+
+  const char *base = strrchr(prefix, '/');
+  base = base ? base+1 : prefix;
+  fprintf(f, "# shard records min_id max_id west south east north file\n");
+  for (int s = 0; s < nshards; s++) {
+    const struct shard_info *si = &info[s];
+    fprintf(f, "%d %d %ld %ld %.17g %.17g %.17g %.17g %s.%d.tsv\n",
+            s, si->count, (long)si->min_id, (long)si->max_id,
+            si->west, si->south, si->east, si->north, base, s);
+  }
+  return fclose(f);
+}
+
+int main(int argc, char** argv) {
+  int by_id = 0, nshards = 4;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+    switch (opt) {
+    case 't':
+      if (strcmp(optarg, "id") == 0) {
+        by_id = 1;
+      } else if (strcmp(optarg, "region") == 0) {
+        by_id = 0;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'n':
+      nshards = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc-2 || nshards < 1) {
+    usage(argv[0]);
+  }
+  const char *file = argv[optind];
+  const char *prefix = argv[optind+1];
+
+  uint64_t start = microseconds();
+  int n;
+  struct shard_row *rows = read_rows(file, &n);
+  if (!rows) {
+    fprintf(stderr, "Failed to read input from %s (errno: %s)\n", file, strerror(errno));
+    return 1;
+  }
+  printf("Reading records: %dms\n", (int)((microseconds()-start)/1000));
+
+  start = microseconds();
+  int *order = bigmem_alloc((n > 0 ? n : 1) * sizeof(int));
+  int *shard_of = bigmem_alloc((n > 0 ? n : 1) * sizeof(int));
+  struct shard_info *info = calloc(nshards, sizeof(struct shard_info));
+  if (!order || !shard_of || !info) {
+    fprintf(stderr, "Error: Failed to allocate memory for shards.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < n; i++) {
+    order[i] = i;
+  }
+  if (by_id) {
+    split_by_id(rows, order, n, nshards, shard_of);
+  } else {
+    split_by_region(rows, order, n, 0, nshards, shard_of);
+  }
+
+  for (int i = 0; i < n; i++) {
+    struct shard_info *si = &info[shard_of[i]];
+    const struct shard_row *r = &rows[i];
+    if (si->count++ == 0) {
+      si->min_id = si->max_id = r->osm_id;
+      si->west = si->east = r->lon;
+      si->south = si->north = r->lat;
+    } else {
+      si->min_id = r->osm_id < si->min_id ? r->osm_id : si->min_id;
+      si->max_id = r->osm_id > si->max_id ? r->osm_id : si->max_id;
+      si->west = r->lon < si->west ? r->lon : si->west;
+      si->east = r->lon > si->east ? r->lon : si->east;
+      si->south = r->lat < si->south ? r->lat : si->south;
+      si->north = r->lat > si->north ? r->lat : si->north;
+    }
+  }
+  printf("Splitting records: %dms\n", (int)((microseconds()-start)/1000));
+
+  start = microseconds();
+  if (write_shards(file, prefix, nshards, shard_of) != 0 ||
+      write_manifest(prefix, nshards, info) != 0) {
+    fprintf(stderr, "Failed to write shards of %s (errno: %s)\n", prefix, strerror(errno));
+    return 1;
+  }
+  printf("Writing shards: %dms\n", (int)((microseconds()-start)/1000));
+
+  for (int s = 0; s < nshards; s++) {
+    printf("Shard %d: %d records\n", s, info[s].count);
+  }
+
+  bigmem_free(rows);
+  bigmem_free(order);
+  bigmem_free(shard_of);
+  free(info);
+  return 0;
+}
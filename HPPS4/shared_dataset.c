@@ -0,0 +1,284 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include "shared_dataset.h"
+
+#define MAGIC "HPPSDS02"
+
+// All offsets are in bytes from the start of the image.
+struct image_header {
+  char magic[8];
+  uint64_t size;          // Bytes in the image, before rounding up
+  uint32_t n;             // Number of records
+  uint32_t reserved;
+  uint64_t records;       // Offset of the n image_records
+  uint64_t ids;           // Offset of the n image_ids
+  uint64_t strings;       // Offset of the strings
+};
+
+// A struct record with the line as an offset.
+struct image_record {
+  uint64_t line;          // Offset of the line
+  int64_t osm_id;
+  double lon, lat, importance;
+  int32_t place_rank;
+  uint32_t strings[RECORD_NUM_STRING_COLUMNS]; // Offset of each string from 'line'
+};
+
+struct image_id {
+  int64_t osm_id;
+  uint32_t row;
+  uint32_t reserved;
+};
+
+struct shared_dataset {
+  const char *base;
+  size_t mapped;          // Bytes mapped
+  const struct image_header *header;
+  const struct image_record *records;
+  const struct image_id *ids;
+};
+
+// The file behind an image name; see shared_dataset.h.
+// Returns NULL with errno set if the name is not valid, or if there is
+// no memory for the path.
+static char* image_path(const char *name) {
+  if (name[0] == '/') {
+    name++;
+  }
+  if (name[0] == 0 || strchr(name, '/')) {
+    errno = EINVAL;
+    return NULL;
+  }
+  const char *dir = getenv("SHARED_DATASET_DIR");
+  char *path;
+  if (asprintf(&path, "%s/%s", dir && *dir ? dir : "/dev/shm", name) < 0) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return path;
+}
+
+static size_t align8(size_t n) {
+  return (n + 7) & ~(size_t)7;
+}
+
+// Bytes of the line of a record, up to the end of its last string.
+static size_t line_length(const struct record *r) {
+  size_t len = 0;
+  for (int c = 0; c < RECORD_NUM_STRING_COLUMNS; c++) {
+    size_t end = r->strings[c] + strlen(record_string(r, c)) + 1;
+    len = end > len ? end : len;
+  }
+  return len;
+}
+
+// Records with the same id are kept in their order in the dataset, so
+// that a lookup finds the first, as a scan would.
+static int compare_image_id(const void *a, const void *b) {
+  const struct image_id *x = a;
+  const struct image_id *y = b;
+  if (x->osm_id != y->osm_id) {
+    return (x->osm_id > y->osm_id) - (x->osm_id < y->osm_id);
+  }
+  return (x->row > y->row) - (x->row < y->row);
+}
+
+int shared_dataset_create(const char *name, const struct record *rs, int n) {
+  char *path = image_path(name);
+  if (!path) {
+    return -1;
+  }
+  char *tmp = NULL;
+  if (asprintf(&tmp, "%s.%ld", path, (long)getpid()) < 0) {
+    free(path);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  size_t strings = 0;
+  for (int i = 0; i < n; i++) {
+    strings += line_length(&rs[i]);
+  }
+  struct image_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(header.magic));
+  header.n = n;
+  header.records = align8(sizeof(struct image_header));
+  header.ids = header.records + n * sizeof(struct image_record);
+  header.strings = header.ids + n * sizeof(struct image_id);
+  header.size = header.strings + strings;
+
+  int fd = open(tmp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    free(tmp);
+    free(path);
+    return -1;
+  }
+
+  // On hugetlbfs (see shared_dataset.h), the size must be a whole
+  // number of huge pages.
+  struct statfs fs;
+  size_t block = fstatfs(fd, &fs) == 0 && fs.f_bsize > 0 ? (size_t)fs.f_bsize : 4096;
+  size_t mapped = (header.size + block - 1) / block * block;
+
+  char *base = MAP_FAILED;
+  if (ftruncate(fd, mapped) == 0) {
+    base = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  int saved = errno;
+  close(fd);
+  if (base == MAP_FAILED) {
+    unlink(tmp);
+    free(tmp);
+    free(path);
+    errno = saved;
+    return -1;
+  }
+
+  struct image_record *records = (struct image_record*)(base + header.records);
+  struct image_id *ids = (struct image_id*)(base + header.ids);
+  size_t pos = header.strings;
+  for (int i = 0; i < n; i++) {
+    const struct record *r = &rs[i];
+    struct image_record *ir = &records[i];
+    memset(ir, 0, sizeof(*ir));
+    ir->osm_id = r->osm_id;
+    ir->lon = r->lon;
+    ir->lat = r->lat;
+    ir->importance = r->importance;
+    ir->place_rank = r->place_rank;
+    memcpy(ir->strings, r->strings, sizeof(ir->strings));
+    size_t len = line_length(r);
+    memcpy(base+pos, r->line, len);
+    ir->line = pos;
+    pos += len;
+
+    ids[i].osm_id = r->osm_id;
+    ids[i].row = i;
+    ids[i].reserved = 0;
+  }
+  qsort(ids, n, sizeof(struct image_id), compare_image_id);
+
+  memcpy(base, &header, sizeof(header));
+  munmap(base, mapped);
+
+  // Only now does the image appear under its name.
+  int ret = rename(tmp, path);
+  saved = errno;
+  if (ret != 0) {
+    unlink(tmp);
+  }
+  free(tmp);
+  free(path);
+  errno = saved;
+  return ret;
+}
+
+int shared_dataset_remove(const char *name) {
+  char *path = image_path(name);
+  if (!path) {
+    return -1;
+  }
+  int ret = unlink(path);
+  free(path);
+  return ret;
+}
+
+struct shared_dataset* shared_dataset_attach(const char *name) {
+  char *path = image_path(name);
+  if (!path) {
+    return NULL;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  free(path);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct image_header)) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  size_t mapped = st.st_size;
+  const char *base = mmap(NULL, mapped, PROT_READ, MAP_SHARED, fd, 0);
+  int saved = errno;
+  close(fd);
+  if (base == MAP_FAILED) {
+    errno = saved;
+    return NULL;
+  }
+
+  const struct image_header *header = (const struct image_header*)base;
+  if (memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0 ||
+      header->size > mapped ||
+      header->strings > header->size ||
+      header->ids + (uint64_t)header->n * sizeof(struct image_id) > header->strings ||
+      header->records + (uint64_t)header->n * sizeof(struct image_record) > header->ids) {
+    munmap((void*)base, mapped);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  struct shared_dataset *ds = malloc(sizeof(struct shared_dataset));
+  if (!ds) {
+    fprintf(stderr, "Error: Failed to allocate memory for shared dataset.\n");
+    exit(EXIT_FAILURE);
+  }
+  ds->base = base;
+  ds->mapped = mapped;
+  ds->header = header;
+  ds->records = (const struct image_record*)(base + header->records);
+  ds->ids = (const struct image_id*)(base + header->ids);
+  return ds;
+}
+
+void shared_dataset_detach(struct shared_dataset *ds) {
+  if (ds) {
+    munmap((void*)ds->base, ds->mapped);
+    free(ds);
+  }
+}
+
+int shared_dataset_count(const struct shared_dataset *ds) {
+  return ds->header->n;
+}
+
+size_t shared_dataset_size(const struct shared_dataset *ds) {
+  return ds->header->size;
+}
+
+int shared_dataset_find_id(const struct shared_dataset *ds, int64_t id) {
+  size_t lo = 0, hi = ds->header->n;
+  while (lo < hi) {
+    size_t mid = lo + (hi-lo)/2;
+    if (ds->ids[mid].osm_id < id) {
+      lo = mid+1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < ds->header->n && ds->ids[lo].osm_id == id ? (int)ds->ids[lo].row : -1;
+}
+
+void shared_dataset_record(const struct shared_dataset *ds, int row, struct record *r) {
+  const struct image_record *ir = &ds->records[row];
+  r->line = ds->base + ir->line;
+  r->osm_id = ir->osm_id;
+  r->lon = ir->lon;
+  r->lat = ir->lat;
+  r->importance = ir->importance;
+  r->place_rank = ir->place_rank;
+  memcpy(r->strings, ir->strings, sizeof(r->strings));
+}
@@ -0,0 +1,63 @@
+// A dataset image that lives in shared memory, so that several query
+// processes on the same machine can use a single copy of the records
+// and of an id index built on them.
+//
+// One process creates the image from records it has read, for example
+// with the shared_load program, and others attach it read-only.  The
+// image holds no pointers, only offsets from its start, so it can be
+// mapped at any address.  It is laid out as
+//
+//   header | records | id index | strings
+//
+// where the id index is the records' ids sorted, each with the number
+// of its record, and the strings are the lines of the records.
+//
+// The NAME of an image is a plain name, such as "planet", for the file
+// /dev/shm/planet in the shared memory file system.  As with
+// shm_open(), it may start with a slash, but must not be empty or have
+// another slash; other names fail with EINVAL.  The environment
+// variable SHARED_DATASET_DIR names another directory for the images,
+// such as a hugetlbfs mount, so that they are backed by huge pages.
+
+#ifndef SHARED_DATASET_H
+#define SHARED_DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+struct shared_dataset;
+
+// Create the image NAME from the records, replacing any existing one.
+// The image is complete before it becomes visible under NAME, so a
+// process attaching at the same time sees either the old image or the
+// new one.  Returns 0 on success, and -1 with errno set on failure.
+int shared_dataset_create(const char *name, const struct record *rs, int n);
+
+// Remove the image NAME.  Processes that have it attached keep their
+// mapping.  Returns 0 on success, and -1 with errno set on failure.
+int shared_dataset_remove(const char *name);
+
+// Attach the image NAME read-only.  Returns NULL with errno set if it
+// cannot be opened, or with errno set to EINVAL if it is not a
+// complete image.
+struct shared_dataset* shared_dataset_attach(const char *name);
+
+// Unmap an attached image.
+void shared_dataset_detach(struct shared_dataset *ds);
+
+// The number of records in the image.
+int shared_dataset_count(const struct shared_dataset *ds);
+
+// The size of the image in bytes.
+size_t shared_dataset_size(const struct shared_dataset *ds);
+
+// The number of the record with the given id, or -1 if there is none.
+int shared_dataset_find_id(const struct shared_dataset *ds, int64_t id);
+
+// Fill in 'r' with record number 'row'.  Its line is in the mapping,
+// so the strings stay valid until the image is detached.
+void shared_dataset_record(const struct shared_dataset *ds, int row, struct record *r);
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "record.h"
+#include "shared_dataset.h"
+#include "timing.h"
+
+// Creates or removes a dataset image in shared memory (see
+// shared_dataset.h), for example
+//
+//   ./shared_load planet planet-latest_geonames.tsv
+//   ./shared_load -r planet
+//
+// The image stays after the program exits, until it is removed or the
+// machine restarts, and query programs such as id_query_shared attach
+// it by name.  Creating an image with the name of an existing one
+// replaces it; processes that have the old one attached keep using it.
+
+static void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s NAME FILE\n       %s -r NAME\n", prog, prog);
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    usage(argv[0]);
+  }
+
+  if (strcmp(argv[1], "-r") == 0) {
+    if (shared_dataset_remove(argv[2]) != 0) {
+      fprintf(stderr, "Failed to remove %s (errno: %s)\n", argv[2], strerror(errno));
+      return 1;
+    }
+    return 0;
+  }
+
+  const char *name = argv[1];
+  const char *file = argv[2];
+  uint64_t start = microseconds();
+  int n;
+  struct record *rs = read_records(file, &n);
+  if (!rs) {
+    fprintf(stderr, "Failed to read input from %s (errno: %s)\n", file, strerror(errno));
+    return 1;
+  }
+  printf("Reading records: %dms\n", (int)((microseconds()-start)/1000));
+
+  start = microseconds();
+  if (shared_dataset_create(name, rs, n) != 0) {
+    fprintf(stderr, "Failed to create %s (errno: %s)\n", name, strerror(errno));
+    free_records(rs, n);
+    return 1;
+  }
+  printf("Creating image: %dms\n", (int)((microseconds()-start)/1000));
+
+  struct shared_dataset *ds = shared_dataset_attach(name);
+  if (ds) {
+    printf("Image %s: %d records, %zu bytes\n", name, n, shared_dataset_size(ds));
+    shared_dataset_detach(ds);
+  }
+
+  free_records(rs, n);
+  return 0;
+}
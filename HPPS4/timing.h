@@ -1,12 +1,48 @@
 #ifndef TIMING_H
 #define TIMING_H
 
-#include <sys/time.h>
+#include <stdint.h>
+#include <time.h>
 
-static uint64_t microseconds() {
-  static struct timeval t;
-  gettimeofday(&t, NULL);
-  return ((uint64_t)t.tv_sec*1000000)+t.tv_usec;
+#if defined(TIMING_TSC) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+// Nanoseconds since some fixed point in the past.  The clock is
+// monotonic, so it is safe for measuring intervals even if the system
+// time is changed.
+//
+// When compiled with -DTIMING_TSC on x86, the time stamp counter is
+// read instead, which is cheaper than a system call.  It is converted
+// to nanoseconds with a rate that is measured against the monotonic
+// clock on first use, so this is only accurate on CPUs with an
+// invariant TSC.
+static inline uint64_t clock_nanoseconds() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec*1000000000)+t.tv_nsec;
+}
+
+#if defined(TIMING_TSC) && (defined(__x86_64__) || defined(__i386__))
+static inline uint64_t nanoseconds() {
+  static double ns_per_tick = 0;
+  if (ns_per_tick == 0) {
+    uint64_t t0 = clock_nanoseconds(), c0 = __rdtsc();
+    while (clock_nanoseconds()-t0 < 10000000) {
+    }
+    uint64_t t1 = clock_nanoseconds(), c1 = __rdtsc();
+    ns_per_tick = (double)(t1-t0)/(c1-c0);
+  }
+  return (uint64_t)(__rdtsc()*ns_per_tick);
+}
+#else
+static inline uint64_t nanoseconds() {
+  return clock_nanoseconds();
+}
+#endif
+
+static inline uint64_t microseconds() {
+  return nanoseconds()/1000;
 }
 
 #endif
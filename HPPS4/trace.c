@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// Deeper scopes are not recorded, but still kept track of, so that
+// TRACE_END closes the right one.
+#define TRACE_MAX_DEPTH 64
+
+// A scope that has ended.
+struct trace_event {
+  const char *name;
+  uint64_t start;     // Nanoseconds, on the monotonic clock
+  uint64_t duration;
+};
+
+// The events of one thread.  Rings are never freed, so that the trace
+// still has the threads that have exited.
+struct trace_ring {
+  struct trace_ring *next;          // All rings, newest first
+  int tid;                          // Numbered from 1, in order of first use
+  const char *thread_name;
+  uint64_t count;                   // Events recorded, some overwritten since
+  int depth;                        // Scopes open
+  const char *open_names[TRACE_MAX_DEPTH];
+  uint64_t open_starts[TRACE_MAX_DEPTH];
+  struct trace_event events[TRACE_RING_EVENTS];
+};
+
+static __thread struct trace_ring *thread_ring;
+static struct trace_ring *rings;
+static int next_tid = 1;
+static int exit_registered;
+
+static uint64_t trace_clock(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+static void write_at_exit(void) {
+  char name[64];
+  const char *path = getenv("TRACE_FILE");
+  if (!path || !*path) {
+    snprintf(name, sizeof(name), "trace-%d.json", (int)getpid());
+    path = name;
+  }
+  if (trace_write(path) != 0) {
+    fprintf(stderr, "Failed to write trace to %s\n", path);
+  }
+}
+
+// The ring of the calling thread, created on first use.  Returns NULL
+// if there is no memory for it, and then nothing is traced.
+static struct trace_ring* get_ring(void) {
+  struct trace_ring *r = thread_ring;
+  if (r) {
+    return r;
+  }
+  r = calloc(1, sizeof(struct trace_ring));
+  if (!r) {
+    return NULL;
+  }
+  r->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+  r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&rings, &r->next, r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+  if (!__atomic_exchange_n(&exit_registered, 1, __ATOMIC_RELAXED)) {
+    atexit(write_at_exit);
+  }
+  thread_ring = r;
+  return r;
+}
+
+void trace_begin(const char *name) {
+  struct trace_ring *r = get_ring();
+  if (!r) {
+    return;
+  }
+  if (r->depth < TRACE_MAX_DEPTH) {
+    r->open_names[r->depth] = name;
+    r->open_starts[r->depth] = trace_clock();
+  }
+  r->depth++;
+}
+
+void trace_end(void) {
+  uint64_t end = trace_clock();
+  struct trace_ring *r = thread_ring;
+  if (!r || r->depth == 0) {
+    return;
+  }
+  r->depth--;
+  if (r->depth < TRACE_MAX_DEPTH) {
+    struct trace_event *e = &r->events[r->count % TRACE_RING_EVENTS];
+    e->name = r->open_names[r->depth];
+    e->start = r->open_starts[r->depth];
+    e->duration = end - e->start;
+    __atomic_store_n(&r->count, r->count+1, __ATOMIC_RELEASE);
+  }
+}
+
+void trace_thread_name(const char *name) {
+  struct trace_ring *r = get_ring();
+  if (r) {
+    r->thread_name = name;
+  }
+}
+
+int trace_write(const char *path) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    return -1;
+  }
+
+  // Times are shown from the first event kept.
+  uint64_t first_time = UINT64_MAX;
+  struct trace_ring *head = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+  for (struct trace_ring *r = head; r; r = r->next) {
+    uint64_t count = __atomic_load_n(&r->count, __ATOMIC_ACQUIRE);
+    uint64_t from = count > TRACE_RING_EVENTS ? count - TRACE_RING_EVENTS : 0;
+    for (uint64_t i = from; i < count; i++) {
+      uint64_t start = r->events[i % TRACE_RING_EVENTS].start;
+      first_time = start < first_time ? start : first_time;
+    }
+  }
+
+  int pid = (int)getpid();
+  const char *sep = "";
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (struct trace_ring *r = head; r; r = r->next) {
+    if (r->thread_name) {
+      fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+              "\"args\":{\"name\":\"%s\"}}", sep, pid, r->tid, r->thread_name);
+      sep = ",\n";
+    }
+    uint64_t count = __atomic_load_n(&r->count, __ATOMIC_ACQUIRE);
+    uint64_t from = count > TRACE_RING_EVENTS ? count - TRACE_RING_EVENTS : 0;
+    for (uint64_t i = from; i < count; i++) {
+      const struct trace_event *e = &r->events[i % TRACE_RING_EVENTS];
+      fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+              sep, e->name, pid, r->tid, (e->start - first_time) / 1000.0, e->duration / 1000.0);
+      sep = ",\n";
+    }
+  }
+  fprintf(f, "\n]}\n");
+
+  if (ferror(f)) {
+    int saved = errno;
+    fclose(f);
+    errno = saved;
+    return -1;
+  }
+  return fclose(f);
+}
@@ -0,0 +1,51 @@
+// A timeline of where a program spends its time, written in the
+// trace event format of Chrome, for viewing in chrome://tracing or
+// https://ui.perfetto.dev.  Each thread shows up as a row of nested
+// scopes, so it shows how reading, building and querying overlap
+// between threads, and where a thread stalls.
+//
+// Tracing is compiled out unless -DTRACE is added to CFLAGS, and then
+// the scopes cost two clock reads each.  Each thread records into a
+// ring of its own, without locks, which keeps the latest
+// TRACE_RING_EVENTS scopes that have ended; with a scope per query, a
+// run of more queries than that loses the scopes of loading and
+// building.  The trace is written when the program exits, to the file
+// named by the environment variable TRACE_FILE, or else to
+// trace-PID.json.
+//
+// A scope is opened with TRACE_BEGIN and closed with TRACE_END on the
+// same thread, for example
+//
+//   TRACE_BEGIN("read_records");
+//   ...
+//   TRACE_END();
+//
+// The names must be string literals, as only the pointers are kept.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_RING_EVENTS (1 << 20)
+
+#ifdef TRACE
+#define TRACE_BEGIN(name) trace_begin(name)
+#define TRACE_END() trace_end()
+#define TRACE_THREAD(name) trace_thread_name(name)
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END() ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+#endif
+
+// Open and close a scope on the calling thread.  Scopes nest.
+void trace_begin(const char *name);
+void trace_end(void);
+
+// Name the calling thread in the timeline.
+void trace_thread_name(const char *name);
+
+// Write the trace so far to 'path'.  Returns 0 on success, or -1 with
+// errno set.  Called at exit when anything was traced.
+int trace_write(const char *path);
+
+#endif
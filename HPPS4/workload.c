@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "record.h"
+
+// Reproducible query workloads for the query programs, for example
+//
+//   ./workload -t id -d zipf -m 0.1 -c 100000 planet-latest_geonames.tsv > ids.txt
+//   ./workload -t coord -H 20 -r 0.5 planet-latest_geonames.tsv > coords.txt
+//
+// The output depends only on the options and the dataset, not on the
+// C library, as the generator has its own pseudo-random numbers.
+//
+// Records are ranked by popularity in a random order fixed by the
+// seed.  With the Zipf distribution, the record of rank i (from 1) is
+// picked with probability proportional to 1/i^z (-z); with the uniform
+// distribution, every record is equally likely.
+//
+// An id query asks for the id of the picked record, except that a
+// fraction of the queries (-m) ask for ids that are not in the
+// dataset.  A coordinate query is a point at a normally distributed
+// offset (with standard deviation -r degrees) from the picked record,
+// or with -H from one of that many hotspots, which are themselves
+// picked records and are chosen with the same distribution.  The
+// missing fraction of coordinate queries are uniform over the globe.
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-t id|coord] [-c COUNT] [-s SEED] [-d uniform|zipf] [-z EXPONENT]\n"
+          "          [-m MISS_FRACTION] [-H HOTSPOTS] [-r RADIUS] FILE\n",
+          prog);
+  exit(1);
+}
+
+// The splitmix64 generator.
+static uint64_t next_random(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Uniform in [0,1).
+static double random_unit(uint64_t *state) {
+  return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Uniform in [0,n).
+static int random_below(uint64_t *state, int n) {
+  return (int)(random_unit(state) * n);
+}
+
+// Standard normal, by the Box-Muller transform.
+static double random_normal(uint64_t *state) {
+  double u = 1 - random_unit(state);
+  double v = random_unit(state);
+  return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+// Picks popularity ranks in [0,n).
+struct popularity {
+  int n;
+  double *cdf; // cdf[i] is the probability of a rank <= i, or NULL for uniform
+};
+
+static void popularity_init(struct popularity *p, int n, int zipf, double exponent) {
+  p->n = n;
+  p->cdf = NULL;
+  if (!zipf || n == 0) {
+    return;
+  }
+
+  p->cdf = malloc(n * sizeof(double));
+  if (!p->cdf) {
+    fprintf(stderr, "Error: Failed to allocate memory for Zipf distribution.\n");
+    exit(EXIT_FAILURE);
+  }
+  double sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += pow(i+1, -exponent);
+    p->cdf[i] = sum;
+  }
+  for (int i = 0; i < n; i++) {
+    p->cdf[i] /= sum;
+  }
+}
+
+static int popularity_pick(const struct popularity *p, uint64_t *state) {
+  if (!p->cdf) {
+    return random_below(state, p->n);
+  }
+
+  // First rank whose cumulative probability exceeds u.
+  double u = random_unit(state);
+  int lo = 0, hi = p->n-1;
+  while (lo < hi) {
+    int mid = lo + (hi-lo)/2;
+    if (p->cdf[mid] > u) {
+      hi = mid;
+    } else {
+      lo = mid+1;
+    }
+  }
+  return lo;
+}
+
+static int compare_id(const void *a, const void *b) {
+  int64_t x = *(const int64_t*)a;
+  int64_t y = *(const int64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// An id that is not in the sorted array, drawn from the same range as
+// the ids that are.
+static int64_t missing_id(const int64_t *ids, int n, uint64_t *state) {
+  int64_t max = n > 0 ? ids[n-1] : 0;
+  uint64_t range = max > 0 ? (uint64_t)max*2 : 1000000;
+  while (1) {
+    int64_t id = (int64_t)(next_random(state) % range) + 1;
+    if (!bsearch(&id, ids, n, sizeof(int64_t), compare_id)) {
+      return id;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  int coords = 0;
+  long count = 100000;
+  uint64_t seed = 1;
+  int zipf = 1;
+  double exponent = 0.99;
+  double miss = 0;
+  int nhotspots = 0;
+  double radius = 0.01;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:c:s:d:z:m:H:r:")) != -1) {
+    switch (opt) {
+    case 't':
+      if (strcmp(optarg, "id") == 0) {
+        coords = 0;
+      } else if (strcmp(optarg, "coord") == 0) {
+        coords = 1;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'c':
+      count = atol(optarg);
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'd':
+      if (strcmp(optarg, "uniform") == 0) {
+        zipf = 0;
+      } else if (strcmp(optarg, "zipf") == 0) {
+        zipf = 1;
+      } else {
+        usage(argv[0]);
+      }
+      break;
+    case 'z':
+      exponent = atof(optarg);
+      break;
+    case 'm':
+      miss = atof(optarg);
+      break;
+    case 'H':
+      nhotspots = atoi(optarg);
+      break;
+    case 'r':
+      radius = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc-1 || count < 0 || nhotspots < 0) {
+    usage(argv[0]);
+  }
+
+  int n;
+  struct record *rs = read_records(argv[optind], &n);
+  if (!rs) {
+    fprintf(stderr, "Failed to read input from %s (errno: %s)\n",
+            argv[optind], strerror(errno));
+    return 1;
+  }
+  if (n == 0) {
+    fprintf(stderr, "No records in %s\n", argv[optind]);
+    return 1;
+  }
+
+  uint64_t state = seed;
+
+  // The record of each popularity rank: a seeded Fisher-Yates shuffle.
+  int *ranked = malloc(n * sizeof(int));
+  int64_t *ids = malloc(n * sizeof(int64_t));
+  if (!ranked || !ids) {
+    fprintf(stderr, "Error: Failed to allocate memory for workload.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < n; i++) {
+    ranked[i] = i;
+    ids[i] = rs[i].osm_id;
+  }
+  for (int i = n-1; i > 0; i--) {
+    int j = random_below(&state, i+1);
+    int tmp = ranked[i];
+    ranked[i] = ranked[j];
+    ranked[j] = tmp;
+  }
+  qsort(ids, n, sizeof(int64_t), compare_id);
+
+  // Hotspots are the most popular records, and are themselves picked
+  // by popularity.
+  if (nhotspots > n) {
+    nhotspots = n;
+  }
+  struct popularity popularity;
+  popularity_init(&popularity, coords && nhotspots > 0 ? nhotspots : n, zipf, exponent);
+
+  for (long q = 0; q < count; q++) {
+    int missing = random_unit(&state) < miss;
+    const struct record *r = &rs[ranked[popularity_pick(&popularity, &state)]];
+
+    if (!coords) {
+      printf("%ld\n", (long)(missing ? missing_id(ids, n, &state) : r->osm_id));
+    } else if (missing) {
+      // Two statements, as the order in which function arguments are
+      // evaluated is unspecified.
+      double lon = random_unit(&state)*360 - 180;
+      double lat = random_unit(&state)*180 - 90;
+      printf("%f %f\n", lon, lat);
+    } else {
+      double lon = r->lon + random_normal(&state)*radius;
+      double lat = r->lat + random_normal(&state)*radius;
+      lon = lon < -180 ? lon+360 : lon > 180 ? lon-360 : lon;
+      lat = lat < -90 ? -90 : lat > 90 ? 90 : lat;
+      printf("%f %f\n", lon, lat);
+    }
+  }
+
+  free(popularity.cdf);
+  free(ranked);
+  free(ids);
+  free_records(rs, n);
+  return 0;
+}